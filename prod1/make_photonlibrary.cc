@@ -18,6 +18,8 @@
 #include "event/SLArEventAnode.hh"
 #include "event/SLArEventSuperCellArray.hh"
 
+#include "plib_compress.hh"
+
 const int N_CRU = 2;
 const int N_CRU_TILE = 30;
 const int N_CRU_SIPM = 160;
@@ -46,10 +48,27 @@ int get_tile_index_lat(const int& mt_idx, const int& t_idx) {
   return t_idx + N_EDGE_TILE*(mt_idx);
 }
 
+/**
+ * compression_rules: space-separated list of plib_compress.hh rules, e.g.
+ * "lz4:4 vis_sipm_*=zstd:5" (default: zlib level 1 for all the branches).
+ * Byte shuffle is not supported here.
+ */
 int make_photonlibrary(
     const TString& input_list_path, 
-    const TString& output_file_path)
+    const TString& output_file_path,
+    const TString& compression_rules = "")
 {
+  plib_compress::CompressionPolicy compression_policy;
+  TObjArray* rules = compression_rules.Tokenize(" ");
+  for (TObject* rule : *rules) {
+    const TString rule_str = ((TObjString*)rule)->GetString();
+    if (compression_policy.AddRule(rule_str) == false) {
+      printf("ERROR: Invalid compression rule %s\n", rule_str.Data());
+      exit(1);
+    }
+  }
+  delete rules;
+
   TChain EvChain("EventTree");
   TChain GenChain("GenTree");
 
@@ -83,7 +102,7 @@ int make_photonlibrary(
       "/eos/user/g/guffantd/DUNE/SoLAr_ProtoDUNE3/solar-plibrary.root", 
       "recreate",
       "SoLAr-ProtoDUNE3 Photon Library", 
-      1); // minimal compression for fast access
+      compression_policy.GetFileSettings(1)); // minimal compression for fast access
 
   TTree* plib = new TTree("photonLib", "SoLAr@ProtoDUNE3 Photon Library"); 
 
@@ -131,6 +150,8 @@ int make_photonlibrary(
   plib->Branch("vis_sipm_edge00", &vis_sipm_lat1, "vis_sipm_edge0[600]/F");
   plib->Branch("vis_sipm_edge11", &vis_sipm_lat1, "vis_sipm_edge1[600]/F");
 
+  compression_policy.Apply(plib, output_file->GetCompressionSettings());
+
   float* vis_tot_tile[3] = {vis_tot_tile_main, vis_tot_tile_lat0, vis_tot_tile_lat1};
   float* vis_dir_tile[3] = {vis_dir_tile_main, vis_dir_tile_lat0, vis_dir_tile_lat1};
   float* vis_wls_tile[3] = {vis_wls_tile_main, vis_wls_tile_lat0, vis_wls_tile_lat1};
@@ -0,0 +1,95 @@
+/**
+ * @file        : plib_compress.hh
+ */
+
+#ifndef PLIB_COMPRESS_HH
+#define PLIB_COMPRESS_HH
+
+#include <vector>
+#include "Compression.h"
+#include "TString.h"
+#include "TRegexp.h"
+#include "TObjArray.h"
+#include "TObjString.h"
+#include "TTree.h"
+#include "TBranch.h"
+
+/**
+ * Per-branch compression of make_photonlibrary, a self-contained subset of
+ * the prod2 vis_compress rules: a codec is `<algorithm>:<level>` with
+ * algorithm one of `zlib`, `lzma`, `lz4`, `zstd`, or just `none`. A rule
+ * `<branch wildcard>=<codec>` sets the codec of the matching branches
+ * (last match wins), a rule without `=` the default codec of the file.
+ * Byte shuffle is not supported here.
+ */
+namespace plib_compress {
+
+  inline bool parse_codec(const TString& str, int& settings) {
+    if (str == "none") {
+      settings = ROOT::CompressionSettings(ROOT::kZLIB, 0);
+      return true;
+    }
+    const Ssiz_t icol = str.Index(":");
+    if (icol == kNPOS) return false;
+    const TString algo = str(0, icol);
+    const TString level_str = str(icol+1, str.Length()-icol-1);
+    if (level_str.IsDigit() == false) return false;
+    const int level = level_str.Atoi();
+    if (level < 1 || level > 9) return false;
+
+    ROOT::ECompressionAlgorithm algorithm = ROOT::kUndefinedCompressionAlgorithm;
+    if (algo == "zlib") algorithm = ROOT::kZLIB;
+    else if (algo == "lzma") algorithm = ROOT::kLZMA;
+    else if (algo == "lz4") algorithm = ROOT::kLZ4;
+    else if (algo == "zstd") algorithm = ROOT::kZSTD;
+    else return false;
+    settings = ROOT::CompressionSettings(algorithm, level);
+    return true;
+  }
+
+  class CompressionPolicy {
+    public:
+      bool AddRule(const TString& rule) {
+        const Ssiz_t ieq = rule.Index("=");
+        int settings = 0;
+        if (ieq == kNPOS) {
+          if (parse_codec(rule, settings) == false) return false;
+          fDefault = settings;
+          fHasDefault = true;
+          return true;
+        }
+        if (parse_codec(rule(ieq+1, rule.Length()-ieq-1), settings) == false) return false;
+        fPatterns.push_back( rule(0, ieq) );
+        fSettings.push_back( settings );
+        return true;
+      }
+
+      // Settings for the output TFile (the caller's fallback if no default)
+      int GetFileSettings(const int& fallback) const {
+        return fHasDefault ? fDefault : fallback;
+      }
+
+      // Set the codec of each branch, the unmatched ones get the file settings
+      void Apply(TTree* tree, const int& file_settings) const {
+        for (TObject* obj : *tree->GetListOfBranches()) {
+          TBranch* br = (TBranch*)obj;
+          const TString name = br->GetName();
+          int settings = file_settings;
+          for (size_t i = 0; i < fPatterns.size(); i++) {
+            TRegexp re(fPatterns[i], kTRUE);
+            Ssiz_t len = 0;
+            if (name.Index(re, &len) == 0 && len == name.Length()) settings = fSettings[i];
+          }
+          br->SetCompressionSettings(settings);
+        }
+      }
+
+    private:
+      bool fHasDefault = false;
+      int  fDefault = 0;
+      std::vector<TString> fPatterns;
+      std::vector<int> fSettings;
+  };
+}
+
+#endif /* end of include guard PLIB_COMPRESS_HH */
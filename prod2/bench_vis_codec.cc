@@ -0,0 +1,350 @@
+/**
+ * @file        : bench_vis_codec.cc
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+#include <getopt.h>
+#include "TFile.h"
+#include "TTree.h"
+#include "TLeaf.h"
+#include "TBranch.h"
+#include "TSystem.h"
+
+#include "vis_quant.hh"
+#include "vis_compress.hh"
+#include "vis_tree_io.hh"
+
+/**
+ * Codec benchmark on a real photon library. A sample of entries is loaded
+ * in memory and, for each class of branches (scalars, tile arrays, SiPM
+ * arrays) and each candidate codec, written to a temporary file and read
+ * back. Reports the compression ratio and the write/read throughput (MB/s
+ * of uncompressed payload) and recommends the codec of each class that
+ * minimises the time per MB of a file written once and read N times from
+ * a storage of the given bandwidth:
+ *
+ *    t = 1/W + 1/(r*B) + N * (1/R + 1/(r*B))
+ *
+ * with W, R the write and read throughput, r the compression ratio and B
+ * the storage bandwidth.
+ */
+
+enum EBranchClass {kClassScalar = 0, kClassTile, kClassSiPM, N_CLASS};
+
+const char* const CLASS_LABEL[N_CLASS] = {"scalar", "tile", "sipm"};
+
+// wildcards of the branches of each class for the recommended policy
+const char* const CLASS_RULES[N_CLASS] = {"", "vis_*_tile_*,t_quant_tile_*", "vis_sipm_*"};
+
+struct SampleBranch {
+  TString name;
+  TString leaflist;
+  int cls = kClassScalar;
+  size_t entry_bytes = 0;
+  bool is_float = false;
+  std::vector<char> data; // n_entries * entry_bytes
+};
+
+struct CodecResult {
+  vis_compress::CodecSpec codec;
+  double ratio = 0;
+  double write_mbps = 0;
+  double read_mbps = 0;
+  double cost = 0;
+};
+
+size_t get_type_size(const TString& type_name) {
+  if (type_name == "Float_t" || type_name == "Float16_t" || type_name == "Int_t" ||
+      type_name == "UInt_t") return 4;
+  if (type_name == "Double_t" || type_name == "Long64_t" || type_name == "ULong64_t") return 8;
+  if (type_name == "Short_t" || type_name == "UShort_t") return 2;
+  if (type_name == "Char_t" || type_name == "UChar_t" || type_name == "Bool_t") return 1;
+  return 0;
+}
+
+bool run_codec(std::vector<SampleBranch*>& branches, const Long64_t& n_entries,
+    const vis_compress::CodecSpec& codec, const TString& tmp_path, CodecResult& result)
+{
+  typedef std::chrono::steady_clock clock;
+  double payload = 0;
+  for (const auto& br : branches) payload += br->entry_bytes * n_entries;
+
+  // write
+  std::vector<std::vector<char>> buffers(branches.size());
+  const auto t0 = clock::now();
+  TFile* file = new TFile(tmp_path, "recreate", "", codec.Settings());
+  TTree* tree = new TTree("bench", "codec benchmark");
+  for (size_t ib = 0; ib < branches.size(); ib++) {
+    buffers[ib].resize(branches[ib]->entry_bytes);
+    tree->Branch(branches[ib]->name, buffers[ib].data(), branches[ib]->leaflist);
+  }
+  for (Long64_t i = 0; i < n_entries; i++) {
+    for (size_t ib = 0; ib < branches.size(); ib++) {
+      const SampleBranch* br = branches[ib];
+      const char* src = &br->data[i*br->entry_bytes];
+      if (codec.shuffle && br->is_float) {
+        vis_compress::byte_shuffle(src, buffers[ib].data(), br->entry_bytes/sizeof(float), sizeof(float));
+      }
+      else {
+        std::copy(src, src + br->entry_bytes, buffers[ib].begin());
+      }
+    }
+    tree->Fill();
+  }
+  file->cd();
+  tree->Write();
+  const double zip_bytes = tree->GetZipBytes();
+  const double tot_bytes = tree->GetTotBytes();
+  file->Close();
+  delete file;
+  const double t_write = std::chrono::duration<double>(clock::now() - t0).count();
+
+  // read
+  const auto t1 = clock::now();
+  file = TFile::Open(tmp_path);
+  if (file == nullptr || file->IsZombie()) return false;
+  tree = file->Get<TTree>("bench");
+  for (size_t ib = 0; ib < branches.size(); ib++) {
+    tree->SetBranchAddress(branches[ib]->name, buffers[ib].data());
+  }
+  std::vector<unsigned char> shuffle_tmp;
+  for (Long64_t i = 0; i < n_entries; i++) {
+    tree->GetEntry(i);
+    if (codec.shuffle == false) continue;
+    for (size_t ib = 0; ib < branches.size(); ib++) {
+      if (branches[ib]->is_float == false) continue;
+      vis_compress::byte_unshuffle(buffers[ib].data(),
+          branches[ib]->entry_bytes/sizeof(float), sizeof(float), shuffle_tmp);
+    }
+  }
+  file->Close();
+  delete file;
+  const double t_read = std::chrono::duration<double>(clock::now() - t1).count();
+  gSystem->Unlink(tmp_path);
+
+  result.codec = codec;
+  result.ratio = (zip_bytes > 0) ? tot_bytes / zip_bytes : 1.0;
+  result.write_mbps = payload / 1048576.0 / t_write;
+  result.read_mbps = payload / 1048576.0 / t_read;
+  return true;
+}
+
+int bench_vis_codec(const TString& input_file_path, const Long64_t& max_entries,
+    const double& n_reads, const double& bandwidth_mbps, const TString& tmp_dir)
+{
+  TFile* input_file = TFile::Open(input_file_path);
+  if (input_file == nullptr || input_file->IsZombie()) {
+    fprintf(stderr, "bench_vis_codec ERROR: Unable to open %s\n", input_file_path.Data());
+    return 1;
+  }
+  TTree* lib = input_file->Get<TTree>(vis_tree::LIB_TREE);
+  if (lib == nullptr) {
+    fprintf(stderr, "bench_vis_codec ERROR: No %s tree in %s\n",
+        vis_tree::LIB_TREE, input_file_path.Data());
+    return 1;
+  }
+  const Long64_t n_entries = std::min(max_entries, lib->GetEntries());
+
+  // 1. Load the sample. Byte-shuffled branches are unshuffled and log-coded
+  //    branches decoded to float first (as VisLibrary::Load), so that every
+  //    codec is measured on the plain visibilities
+  std::vector<SampleBranch> sample;
+  std::vector<vis_quant::QuantSpec> specs;
+  std::vector<bool> shuffled;
+  for (TObject* obj : *lib->GetListOfBranches()) {
+    TBranch* br = (TBranch*)obj;
+    TLeaf* leaf = (TLeaf*)br->GetListOfLeaves()->At(0);
+    const size_t type_size = get_type_size(leaf->GetTypeName());
+    if (br->GetListOfLeaves()->GetEntries() != 1 || type_size == 0 || leaf->GetLeafCount()) {
+      printf("bench_vis_codec: skipping branch %s\n", br->GetName());
+      continue;
+    }
+    SampleBranch sbr;
+    sbr.name = br->GetName();
+    const vis_quant::QuantSpec spec = vis_quant::get_branch_spec(lib, sbr.name);
+    if (spec.mode == vis_quant::kLogCode) {
+      sbr.leaflist = Form("%s[%i]/F", leaf->GetName(), leaf->GetLenStatic());
+      sbr.entry_bytes = sizeof(float) * leaf->GetLenStatic();
+      sbr.is_float = true;
+    }
+    else {
+      sbr.leaflist = br->GetTitle();
+      sbr.entry_bytes = type_size * leaf->GetLenStatic();
+      sbr.is_float = (TString(leaf->GetTypeName()) == "Float_t");
+    }
+    if (leaf->GetLenStatic() == 1) sbr.cls = kClassScalar;
+    else if (sbr.name.BeginsWith("vis_sipm")) sbr.cls = kClassSiPM;
+    else sbr.cls = kClassTile;
+    sbr.data.resize(sbr.entry_bytes * n_entries);
+    sample.push_back( std::move(sbr) );
+    specs.push_back( spec );
+    shuffled.push_back( vis_compress::is_shuffled(lib, br->GetName()) );
+  }
+
+  // one read buffer per branch, copied (and decoded) into the sample
+  std::vector<std::vector<char>> entry_buffers(sample.size());
+  for (size_t ib = 0; ib < sample.size(); ib++) {
+    const size_t entry_bytes = sample[ib].entry_bytes;
+    entry_buffers[ib].resize(specs[ib].mode == vis_quant::kLogCode ?
+        entry_bytes/sizeof(float)*sizeof(UShort_t) : entry_bytes);
+    lib->SetBranchAddress(sample[ib].name, entry_buffers[ib].data());
+  }
+  std::vector<unsigned char> shuffle_tmp;
+  for (Long64_t i = 0; i < n_entries; i++) {
+    lib->GetEntry(i);
+    for (size_t ib = 0; ib < sample.size(); ib++) {
+      SampleBranch& sbr = sample[ib];
+      char* dst = &sbr.data[i*sbr.entry_bytes];
+      if (specs[ib].mode == vis_quant::kLogCode) {
+        vis_quant::decode((const UShort_t*)entry_buffers[ib].data(), (float*)dst,
+            sbr.entry_bytes/sizeof(float), specs[ib]);
+        continue;
+      }
+      std::copy(entry_buffers[ib].begin(), entry_buffers[ib].end(), dst);
+      if (shuffled[ib]) {
+        vis_compress::byte_unshuffle(dst, sbr.entry_bytes/sizeof(float), sizeof(float), shuffle_tmp);
+      }
+    }
+  }
+  lib->ResetBranchAddresses();
+  input_file->Close();
+  delete input_file;
+  printf("bench_vis_codec: %lld entries of %s loaded\n", n_entries, input_file_path.Data());
+
+  // 2. Candidate codecs
+  const char* candidates[] = {
+    "none", "zlib:1", "zlib:6", "lzma:1", "lz4:1", "lz4:4", "zstd:1", "zstd:3", "zstd:5", "zstd:9"
+  };
+  const TString tmp_path = Form("%s/bench_vis_codec_%i.root", tmp_dir.Data(), gSystem->GetPid());
+
+  std::vector<TString> policy;
+  for (int icl = 0; icl < N_CLASS; icl++) {
+    std::vector<SampleBranch*> branches;
+    bool has_float_array = false;
+    double payload = 0;
+    for (auto& sbr : sample) {
+      if (sbr.cls != icl) continue;
+      branches.push_back(&sbr);
+      payload += sbr.entry_bytes * n_entries;
+      if (sbr.is_float && icl != kClassScalar) has_float_array = true;
+    }
+    if (branches.empty()) continue;
+
+    printf("\n%s branches (%zu, %.1f MB)\n", CLASS_LABEL[icl], branches.size(), payload / 1048576.0);
+    printf("  %-18s %8s %12s %12s %14s\n", "codec", "ratio", "write MB/s", "read MB/s", "cost ms/MB");
+    std::vector<CodecResult> results;
+    for (const auto& cand : candidates) {
+      for (int ishuffle = 0; ishuffle < (has_float_array ? 2 : 1); ishuffle++) {
+        vis_compress::CodecSpec codec;
+        vis_compress::parse_codec(cand, codec);
+        codec.shuffle = (ishuffle == 1);
+        if (codec.shuffle && codec.level == 0) continue;
+        CodecResult res;
+        if (run_codec(branches, n_entries, codec, tmp_path, res) == false) {
+          fprintf(stderr, "bench_vis_codec ERROR: Unable to read back %s\n", tmp_path.Data());
+          return 1;
+        }
+        res.cost = 1e3 * ( 1.0/res.write_mbps + 1.0/(res.ratio*bandwidth_mbps) +
+            n_reads * (1.0/res.read_mbps + 1.0/(res.ratio*bandwidth_mbps)) );
+        printf("  %-18s %8.2f %12.1f %12.1f %14.3f\n", res.codec.Encode().Data(),
+            res.ratio, res.write_mbps, res.read_mbps, res.cost);
+        results.push_back(res);
+      }
+    }
+
+    const CodecResult* best = &results.front();
+    for (const auto& res : results) if (res.cost < best->cost) best = &res;
+    printf("  -> %s\n", best->codec.Encode().Data());
+
+    if (icl == kClassScalar) {
+      policy.push_back( best->codec.Encode() );
+    }
+    else {
+      TString rules = CLASS_RULES[icl];
+      TObjArray* tokens = rules.Tokenize(",");
+      for (TObject* tok : *tokens) {
+        policy.push_back( Form("%s=%s", ((TObjString*)tok)->GetString().Data(), best->codec.Encode().Data()) );
+      }
+      delete tokens;
+    }
+  }
+
+  printf("\nRecommended policy (%g reads per write, %g MB/s storage):\n  ", n_reads, bandwidth_mbps);
+  for (const auto& rule : policy) printf(" -z \"%s\"", rule.Data());
+  printf("\n");
+
+  return 0;
+}
+
+void print_usage() {
+  printf("bench_vis_codec usage:\n");
+  printf("\t-i | --input\tphoton library file (make_vis_map or make_vis_tree output)\n");
+  printf("\t-n | --entries\tnumber of library entries in the sample (default: 1000)\n");
+  printf("\t-r | --reads\texpected reads per write of the library (default: 100)\n");
+  printf("\t-b | --bandwidth\tstorage bandwidth in MB/s (default: 500)\n");
+  printf("\t-t | --tmp-dir\tdirectory of the temporary files (default: /tmp)\n");
+
+  return;
+}
+
+int main (int argc, char *argv[]) {
+  const char* short_opts = "i:n:r:b:t:h";
+  static struct option long_opts[7] =
+  {
+    {"input", required_argument, 0, 'i'},
+    {"entries", required_argument, 0, 'n'},
+    {"reads", required_argument, 0, 'r'},
+    {"bandwidth", required_argument, 0, 'b'},
+    {"tmp-dir", required_argument, 0, 't'},
+    {"help", no_argument, 0, 'h'},
+    {nullptr, no_argument, nullptr, 0}
+  };
+
+  int c, option_index;
+
+  TString input_file_path = "";
+  Long64_t max_entries = 1000;
+  double n_reads = 100;
+  double bandwidth_mbps = 500;
+  TString tmp_dir = "/tmp";
+
+  while ( (c = getopt_long(argc, argv, short_opts, long_opts, &option_index)) != -1) {
+    switch(c) {
+      case 'i' :
+        input_file_path = optarg;
+        break;
+      case 'n' :
+        max_entries = std::max(1LL, std::atoll(optarg));
+        break;
+      case 'r' :
+        n_reads = std::max(0.0, std::atof(optarg));
+        break;
+      case 'b' :
+        bandwidth_mbps = std::atof(optarg);
+        break;
+      case 't' :
+        tmp_dir = optarg;
+        break;
+      case 'h' :
+        print_usage();
+        exit( EXIT_SUCCESS );
+        break;
+      case '?' :
+        printf("bench_vis_codec error: unknown flag %c\n", optopt);
+        print_usage();
+        exit( EXIT_FAILURE );
+        break;
+    }
+  }
+
+  if (input_file_path.IsNull() || bandwidth_mbps <= 0) {
+    printf("bench_vis_codec error: an input library and a positive bandwidth are required\n");
+    print_usage();
+    exit( EXIT_FAILURE );
+  }
+
+  return bench_vis_codec(input_file_path, max_entries, n_reads, bandwidth_mbps, tmp_dir);
+}
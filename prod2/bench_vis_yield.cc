@@ -0,0 +1,214 @@
+/**
+ * @file        : bench_vis_yield.cc
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <getopt.h>
+
+#include "vis_library.hh"
+#include "vis_yield.hh"
+
+/**
+ * Throughput test of the photon-yield engine. Batches of energy-deposition
+ * steps are generated in advance along straight tracks inside the library
+ * bounds (fixed step length, exponentially distributed deposits), then
+ * processed by the vis_yield workers. Reports the steps per second and a
+ * summary of the expected (and sampled) photoelectrons per batch.
+ */
+
+std::vector<std::vector<vis_yield::EDepStep>> generate_batches(
+    const vis_tree::VisLibrary& lib, const int& n_batches, const int& batch_size,
+    const float& step_length, const float& mean_edep, const float& yield, const unsigned& seed)
+{
+  float lo[3], hi[3];
+  for (int k = 0; k < 3; k++) {
+    lo[k] = lib.GetAxis(k).front();
+    hi[k] = lib.GetAxis(k).back();
+  }
+
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> uni(0, 1);
+  std::normal_distribution<float> gaus(0, 1);
+  std::exponential_distribution<float> expo(1.0 / mean_edep);
+
+  std::vector<std::vector<vis_yield::EDepStep>> batches(n_batches);
+  for (auto& batch : batches) {
+    batch.resize(batch_size);
+    float pos[3] = {0, 0, 0}, dir[3] = {0, 0, 0};
+    bool new_track = true;
+    for (auto& step : batch) {
+      if (new_track) {
+        float norm = 0;
+        for (int k = 0; k < 3; k++) {
+          pos[k] = lo[k] + uni(rng)*(hi[k] - lo[k]);
+          dir[k] = gaus(rng);
+          norm += dir[k]*dir[k];
+        }
+        norm = std::sqrt(norm);
+        for (int k = 0; k < 3; k++) dir[k] /= norm;
+        new_track = false;
+      }
+      step = {pos[0], pos[1], pos[2], expo(rng), yield};
+      for (int k = 0; k < 3; k++) {
+        pos[k] += step_length*dir[k];
+        if (pos[k] < lo[k] || pos[k] > hi[k]) new_track = true;
+      }
+    }
+  }
+  return batches;
+}
+
+int bench_vis_yield(const TString& input_file_path, const int& num_threads,
+    const int& n_batches, const int& batch_size, const float& step_length,
+    const float& mean_edep, const float& yield, const bool& sample, const unsigned& seed)
+{
+  const unsigned group_mask = (1u << vis_tree::kGroupSiPM) | (1u << vis_tree::kGroupTileTot);
+  vis_tree::VisLibrary lib;
+  printf("bench_vis_yield: loading %s...\n", input_file_path.Data());
+  if (lib.Load(input_file_path, group_mask) == false) return 1;
+  if (lib.HasGroup(vis_tree::kGroupSiPM) == false) {
+    fprintf(stderr, "bench_vis_yield ERROR: no SiPM visibilities in %s\n", input_file_path.Data());
+    return 1;
+  }
+
+  const auto batches = generate_batches(lib, n_batches, batch_size, step_length, mean_edep, yield, seed);
+
+  std::vector<double> sipm_pe(n_batches, 0), tile_pe(n_batches, 0), sipm_counts(n_batches, 0);
+  std::vector<size_t> n_located(n_batches, 0), n_sources(n_batches, 0);
+  auto consume = [&](const size_t& ib, const vis_yield::YieldEngine& engine) {
+    const auto& sipm = engine.GetSiPM();
+    const auto& tile = engine.GetTile();
+    sipm_pe[ib] = std::accumulate(sipm.begin(), sipm.end(), 0.0);
+    tile_pe[ib] = std::accumulate(tile.begin(), tile.end(), 0.0);
+    if (sample) {
+      const auto& counts = engine.GetSiPMCounts();
+      sipm_counts[ib] = std::accumulate(counts.begin(), counts.end(), 0.0);
+    }
+    n_located[ib] = engine.GetNLocated();
+    n_sources[ib] = engine.GetNSources();
+  };
+
+  const auto t0 = std::chrono::steady_clock::now();
+  vis_yield::process_batches(lib, batches, num_threads, sample, seed, consume);
+  const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+  const double n_steps = double(n_batches) * batch_size;
+  auto mean = [&](const auto& v) {
+    return std::accumulate(v.begin(), v.end(), 0.0) / n_batches;
+  };
+  printf("bench_vis_yield: %i batches of %i steps, %i threads, %s\n",
+      n_batches, batch_size, num_threads, sample ? "Poisson sampling" : "expectation only");
+  printf("  steps/s          : %.3e (%.3e per thread)\n", n_steps/elapsed, n_steps/elapsed/num_threads);
+  printf("  batches/s        : %.1f\n", n_batches/elapsed);
+  printf("  located steps    : %.1f%%\n", 100.0 * mean(n_located) * n_batches / n_steps);
+  printf("  points per batch : %.1f\n", mean(n_sources));
+  printf("  SiPM PE / batch  : %.3e expected", mean(sipm_pe));
+  if (sample) printf(", %.3e sampled", mean(sipm_counts));
+  printf("\n");
+  if (lib.HasGroup(vis_tree::kGroupTileTot)) printf("  tile PE / batch  : %.3e expected\n", mean(tile_pe));
+
+  return 0;
+}
+
+void print_usage() {
+  printf("bench_vis_yield usage:\n");
+  printf("\t-i | --input\tmake_vis_map library file\n");
+  printf("\t-j | --threads\tnumber of worker threads (default: hardware concurrency)\n");
+  printf("\t-n | --batches\tnumber of batches (default: 200)\n");
+  printf("\t-b | --batch\tsteps per batch (default: 10000)\n");
+  printf("\t-l | --step\tstep length in mm (default: 1)\n");
+  printf("\t-e | --edep\tmean energy deposit per step in MeV (default: 0.2)\n");
+  printf("\t-y | --yield\tscintillation yield in photons/MeV (default: 40000)\n");
+  printf("\t-p | --poisson\tsample the photoelectrons\n");
+  printf("\t-s | --seed\trandom seed (default: 1)\n");
+
+  return;
+}
+
+int main (int argc, char *argv[]) {
+  const char* short_opts = "i:j:n:b:l:e:y:ps:h";
+  static struct option long_opts[11] =
+  {
+    {"input", required_argument, 0, 'i'},
+    {"threads", required_argument, 0, 'j'},
+    {"batches", required_argument, 0, 'n'},
+    {"batch", required_argument, 0, 'b'},
+    {"step", required_argument, 0, 'l'},
+    {"edep", required_argument, 0, 'e'},
+    {"yield", required_argument, 0, 'y'},
+    {"poisson", no_argument, 0, 'p'},
+    {"seed", required_argument, 0, 's'},
+    {"help", no_argument, 0, 'h'},
+    {nullptr, no_argument, nullptr, 0}
+  };
+
+  int c, option_index;
+
+  TString input_file_path = "";
+  int num_threads = std::max(1u, std::thread::hardware_concurrency());
+  int n_batches = 200;
+  int batch_size = 10000;
+  float step_length = 1.0;
+  float mean_edep = 0.2;
+  float yield = 40000;
+  bool sample = false;
+  unsigned seed = 1;
+
+  while ( (c = getopt_long(argc, argv, short_opts, long_opts, &option_index)) != -1) {
+    switch(c) {
+      case 'i' :
+        input_file_path = optarg;
+        break;
+      case 'j' :
+        num_threads = std::max(1, atoi(optarg));
+        break;
+      case 'n' :
+        n_batches = std::max(1, atoi(optarg));
+        break;
+      case 'b' :
+        batch_size = std::max(1, atoi(optarg));
+        break;
+      case 'l' :
+        step_length = std::atof(optarg);
+        break;
+      case 'e' :
+        mean_edep = std::atof(optarg);
+        break;
+      case 'y' :
+        yield = std::atof(optarg);
+        break;
+      case 'p' :
+        sample = true;
+        break;
+      case 's' :
+        seed = atoi(optarg);
+        break;
+      case 'h' :
+        print_usage();
+        exit( EXIT_SUCCESS );
+        break;
+      case '?' :
+        printf("bench_vis_yield error: unknown flag %c\n", optopt);
+        print_usage();
+        exit( EXIT_FAILURE );
+        break;
+    }
+  }
+
+  if (input_file_path.IsNull()) {
+    printf("bench_vis_yield error: an input library is required\n");
+    print_usage();
+    exit( EXIT_FAILURE );
+  }
+
+  return bench_vis_yield(input_file_path, num_threads, n_batches, batch_size,
+      step_length, mean_edep, yield, sample, seed);
+}
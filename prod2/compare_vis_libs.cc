@@ -0,0 +1,439 @@
+/**
+ * @file        : compare_vis_libs.cc
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <array>
+#include <map>
+#include <vector>
+#include <thread>
+#include <numeric>
+#include <algorithm>
+#include <getopt.h>
+
+#include "TROOT.h"
+#include "TFile.h"
+#include "TTree.h"
+
+#include "vis_tree_io.hh"
+#include "vis_library.hh"
+
+/**
+ * Validation of a new photon library against a reference one. The points
+ * of the two photonLib trees are matched on x/y/z, then each group of
+ * branches is compared channel by channel on all the matched points:
+ *
+ *  - relative deviation |b - a| / max(|a|, floor), points where both
+ *    values are below the floor are ignored;
+ *  - pull (b - a) / sqrt(a/N_a + b/N_b), with N the number of photons of
+ *    the point from n_events_per_point (Poisson statistics), when both
+ *    libraries store it. Not computed for the arrival-time tables.
+ *
+ * Only the coordinates and events per point are kept in memory. The
+ * matched pairs are sorted on the reference entry and split in contiguous
+ * entry ranges, one per worker thread: each worker opens both libraries
+ * and streams its range entry by entry (VisRowReader), filling its own
+ * per-channel accumulators. When the two libraries have the same entry
+ * order, both trees are read sequentially.
+ */
+
+typedef std::array<float, 3> PointKey;
+
+struct ChannelStats {
+  std::vector<double> sum_rel;
+  std::vector<double> n_rel;
+  std::vector<float>  max_rel;
+  std::vector<size_t> worst_rel;  // matched pair of the maximum
+  std::vector<double> sum_pull;
+  std::vector<double> sum_pull2;
+  std::vector<float>  max_pull;   // maximum |pull|
+  std::vector<size_t> worst_pull;
+
+  void Init(const int& nch) {
+    sum_rel.assign(nch, 0); n_rel.assign(nch, 0); max_rel.assign(nch, 0); worst_rel.assign(nch, 0);
+    sum_pull.assign(nch, 0); sum_pull2.assign(nch, 0); max_pull.assign(nch, 0); worst_pull.assign(nch, 0);
+  }
+
+  void Merge(const ChannelStats& other) {
+    for (size_t c = 0; c < sum_rel.size(); c++) {
+      sum_rel[c] += other.sum_rel[c];
+      n_rel[c] += other.n_rel[c];
+      sum_pull[c] += other.sum_pull[c];
+      sum_pull2[c] += other.sum_pull2[c];
+      if (other.max_rel[c] > max_rel[c]) {
+        max_rel[c] = other.max_rel[c];
+        worst_rel[c] = other.worst_rel[c];
+      }
+      if (other.max_pull[c] > max_pull[c]) {
+        max_pull[c] = other.max_pull[c];
+        worst_pull[c] = other.worst_pull[c];
+      }
+    }
+  }
+};
+
+// Accumulate the deviations of one matched point, nch contiguous channels
+inline void compare_point(const float* a, const float* b, const int& nch,
+    const float& floor, const float& wa, const float& wb, const bool& with_pull,
+    const size_t& ipair, ChannelStats& st)
+{
+  float* max_rel = st.max_rel.data();
+  size_t* worst_rel = st.worst_rel.data();
+  double* sum_rel = st.sum_rel.data();
+  double* n_rel = st.n_rel.data();
+  for (int c = 0; c < nch; c++) {
+    const float d = std::fabs(b[c] - a[c]);
+    const float on = (std::max(std::fabs(a[c]), std::fabs(b[c])) > floor) ? 1.0f : 0.0f;
+    const float rel = on * d / std::max(std::fabs(a[c]), floor);
+    sum_rel[c] += rel;
+    n_rel[c] += on;
+    worst_rel[c] = (rel > max_rel[c]) ? ipair : worst_rel[c];
+    max_rel[c] = std::max(max_rel[c], rel);
+  }
+  if (with_pull == false) return;
+
+  float* max_pull = st.max_pull.data();
+  size_t* worst_pull = st.worst_pull.data();
+  double* sum_pull = st.sum_pull.data();
+  double* sum_pull2 = st.sum_pull2.data();
+  for (int c = 0; c < nch; c++) {
+    const float var = std::fabs(a[c])*wa + std::fabs(b[c])*wb;
+    const float pull = (b[c] - a[c]) / std::sqrt(var + 1e-30f);
+    sum_pull[c] += pull;
+    sum_pull2[c] += pull*pull;
+    worst_pull[c] = (std::fabs(pull) > max_pull[c]) ? ipair : worst_pull[c];
+    max_pull[c] = std::max(max_pull[c], std::fabs(pull));
+  }
+  return;
+}
+
+int compare_vis_libs(
+    const TString& reference_path,
+    const TString& candidate_path,
+    const TString& report_path,
+    const unsigned& group_mask,
+    const float& floor,
+    const int& num_threads,
+    const int& n_worst)
+{
+  ROOT::EnableThreadSafety();
+  const auto t0 = std::chrono::steady_clock::now();
+
+  // 1. Coordinates and events per point of both libraries
+  struct PointTable {
+    std::vector<float> coords;
+    std::vector<UInt_t> events;
+    bool has_events = false;
+    std::vector<int> groups;
+  };
+  auto read_points = [&](const TString& path, PointTable& table) {
+    TFile* file = TFile::Open(path);
+    if (file == nullptr || file->IsZombie()) {
+      fprintf(stderr, "compare_vis_libs ERROR: Unable to open %s\n", path.Data());
+      delete file;
+      return false;
+    }
+    TTree* tree = file->Get<TTree>(vis_tree::LIB_TREE);
+    bool ok = (tree != nullptr);
+    if (ok == false) fprintf(stderr, "compare_vis_libs ERROR: No %s tree in %s\n", vis_tree::LIB_TREE, path.Data());
+    vis_tree::VisRowReader row;
+    // the group branches are checked, but only the point branches are read
+    if (ok) ok = row.Init(tree, group_mask);
+    if (ok) {
+      for (int ig = 0; ig < vis_tree::N_GROUP; ig++) {
+        if (row.HasGroup(ig)) table.groups.push_back(ig);
+      }
+      row.Init(tree, 0);
+      table.has_events = row.HasEventCounts();
+      for (Long64_t i = 0; i < tree->GetEntries(); i++) {
+        row.Read(i);
+        table.coords.insert(table.coords.end(), row.GetCoords(), row.GetCoords()+3);
+        if (table.has_events) table.events.push_back(row.GetNEvents());
+      }
+      tree->ResetBranchAddresses();
+    }
+    file->Close();
+    delete file;
+    return ok;
+  };
+  PointTable points_a, points_b;
+  printf("compare_vis_libs: indexing %s...\n", reference_path.Data());
+  if (read_points(reference_path, points_a) == false) return 1;
+  printf("compare_vis_libs: indexing %s...\n", candidate_path.Data());
+  if (read_points(candidate_path, points_b) == false) return 1;
+  const size_t n_points_a = points_a.coords.size() / 3;
+  const size_t n_points_b = points_b.coords.size() / 3;
+
+  // 2. Match the points on x/y/z, pairs in reference entry order
+  std::map<PointKey, size_t> index_a;
+  for (size_t i = 0; i < n_points_a; i++) {
+    const float* p = &points_a.coords[3*i];
+    index_a[{p[0], p[1], p[2]}] = i;
+  }
+  std::vector<std::pair<size_t, size_t>> pairs;
+  for (size_t i = 0; i < n_points_b; i++) {
+    const float* p = &points_b.coords[3*i];
+    auto it = index_a.find({p[0], p[1], p[2]});
+    if (it != index_a.end()) pairs.push_back( {it->second, i} );
+  }
+  index_a.clear();
+  if (pairs.empty()) {
+    fprintf(stderr, "compare_vis_libs ERROR: no common point between the two libraries\n");
+    return 1;
+  }
+  std::sort(pairs.begin(), pairs.end());
+  const bool with_pull = points_a.has_events && points_b.has_events;
+
+  std::vector<int> groups;
+  for (const auto& ig : points_a.groups) {
+    if (std::find(points_b.groups.begin(), points_b.groups.end(), ig) != points_b.groups.end()) {
+      groups.push_back(ig);
+    }
+  }
+  unsigned common_mask = 0;
+  for (const auto& ig : groups) common_mask |= (1u << ig);
+  const double t_index = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+  // 3. Parallel passes over contiguous ranges of matched pairs
+  const int n_workers = std::max(1, std::min<int>(num_threads, pairs.size()));
+  std::vector<std::vector<ChannelStats>> worker_stats(n_workers,
+      std::vector<ChannelStats>(groups.size()));
+  std::vector<int> worker_status(n_workers, 0);
+  auto worker = [&](const int& iw) {
+    auto& stats = worker_stats[iw];
+    for (size_t g = 0; g < groups.size(); g++) stats[g].Init( vis_tree::get_group_size(groups[g]) );
+    const size_t lo = pairs.size() * iw / n_workers;
+    const size_t hi = pairs.size() * (iw+1) / n_workers;
+
+    TFile* file_a = TFile::Open(reference_path);
+    TFile* file_b = TFile::Open(candidate_path);
+    TTree* tree_a = file_a ? file_a->Get<TTree>(vis_tree::LIB_TREE) : nullptr;
+    TTree* tree_b = file_b ? file_b->Get<TTree>(vis_tree::LIB_TREE) : nullptr;
+    vis_tree::VisRowReader row_a, row_b;
+    if (tree_a == nullptr || tree_b == nullptr ||
+        row_a.Init(tree_a, common_mask) == false || row_b.Init(tree_b, common_mask) == false) {
+      worker_status[iw] = 1;
+    }
+    else {
+      for (size_t ipair = lo; ipair < hi; ipair++) {
+        const size_t ia = pairs[ipair].first;
+        const size_t ib = pairs[ipair].second;
+        row_a.Read(ia);
+        row_b.Read(ib);
+        float wa = 0, wb = 0;
+        if (with_pull) {
+          wa = 1.0 / (std::max(1u, points_a.events[ia]) * (double)vis_tree::NUM_PHOTONS);
+          wb = 1.0 / (std::max(1u, points_b.events[ib]) * (double)vis_tree::NUM_PHOTONS);
+        }
+        for (size_t g = 0; g < groups.size(); g++) {
+          const int ig = groups[g];
+          compare_point(row_a.Get(ig), row_b.Get(ig), vis_tree::get_group_size(ig),
+              floor, wa, wb, with_pull && ig != vis_tree::kGroupTileTime, ipair, stats[g]);
+        }
+      }
+    }
+    for (TFile* file : {file_a, file_b}) {
+      if (file == nullptr) continue;
+      file->Close();
+      delete file;
+    }
+  };
+  const auto t1 = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int iw = 0; iw < n_workers; iw++) threads.emplace_back(worker, iw);
+  for (auto& t : threads) t.join();
+  if (std::accumulate(worker_status.begin(), worker_status.end(), 0) != 0) {
+    fprintf(stderr, "compare_vis_libs ERROR: Unable to read the libraries\n");
+    return 1;
+  }
+  std::vector<ChannelStats> stats = worker_stats[0];
+  for (int iw = 1; iw < n_workers; iw++) {
+    for (size_t g = 0; g < groups.size(); g++) stats[g].Merge(worker_stats[iw][g]);
+  }
+  const double t_compare = std::chrono::duration<double>(std::chrono::steady_clock::now() - t1).count();
+
+  // 4. Report
+  FILE* out = stdout;
+  if (report_path.IsNull() == false) {
+    out = fopen(report_path.Data(), "w");
+    if (out == nullptr) {
+      fprintf(stderr, "compare_vis_libs ERROR: Unable to write %s\n", report_path.Data());
+      return 1;
+    }
+  }
+
+  auto point_str = [&](const size_t& ipair) {
+    const float* p = &points_a.coords[3*pairs[ipair].first];
+    return TString(Form("(%g, %g, %g)", p[0], p[1], p[2]));
+  };
+
+  fprintf(out, "compare_vis_libs report\n");
+  fprintf(out, "  reference : %s (%zu points)\n", reference_path.Data(), n_points_a);
+  fprintf(out, "  candidate : %s (%zu points)\n", candidate_path.Data(), n_points_b);
+  fprintf(out, "  matched   : %zu points, %zu only in reference, %zu only in candidate\n",
+      pairs.size(), n_points_a - pairs.size(), n_points_b - pairs.size());
+  fprintf(out, "  floor     : %g (relative deviations)\n", floor);
+  fprintf(out, "  pulls     : %s\n", with_pull ? "Poisson, from n_events_per_point" : "not available (no n_events_per_point)");
+  fprintf(out, "  timing    : index %.1f s, compare %.2f s on %i threads\n\n", t_index, t_compare, n_workers);
+
+  fprintf(out, "%-22s %6s %10s %10s %10s %10s %10s  %s\n", "branch", "nch",
+      "max_rel", "mean_rel", "mean_pull", "rms_pull", "max|pull|", "worst channel @ point");
+  std::vector<TString> worst_lines;
+  for (size_t g = 0; g < groups.size(); g++) {
+    const int ig = groups[g];
+    const auto& st = stats[g];
+    const bool pull = with_pull && ig != vis_tree::kGroupTileTime;
+    const int quant = (ig == vis_tree::kGroupTileTime) ? vis_timing::N_QUANT : 1;
+    const auto branches = vis_tree::get_group_branches(ig);
+    int offset = 0;
+    for (size_t ia = 0; ia < branches.size(); ia++) {
+      const TString& br_name = branches[ia];
+      int nch = 1;
+      if (ig == vis_tree::kGroupSiPM) nch = vis_tree::NSIPM[ia];
+      else if (ig > vis_tree::kGroupVisWls) nch = vis_tree::NTILE[ia]*quant;
+      double sum_rel = 0, n_rel = 0, sum_pull = 0, sum_pull2 = 0;
+      int worst_ch = offset;
+      for (int c = offset; c < offset + nch; c++) {
+        sum_rel += st.sum_rel[c];
+        n_rel += st.n_rel[c];
+        sum_pull += st.sum_pull[c];
+        sum_pull2 += st.sum_pull2[c];
+        if (st.max_rel[c] > st.max_rel[worst_ch]) worst_ch = c;
+      }
+      const double n_tot = double(nch) * pairs.size();
+      const double mean_pull = sum_pull / n_tot;
+      const double rms_pull = std::sqrt(sum_pull2 / n_tot);
+      const float max_pull = *std::max_element(&st.max_pull[offset], &st.max_pull[offset] + nch);
+      if (pull) {
+        fprintf(out, "%-22s %6i %10.3g %10.3g %10.3f %10.3f %10.2f  %i @ %s\n", br_name.Data(), nch,
+            st.max_rel[worst_ch], n_rel > 0 ? sum_rel/n_rel : 0.0, mean_pull, rms_pull, max_pull,
+            worst_ch - offset, point_str(st.worst_rel[worst_ch]).Data());
+      }
+      else {
+        fprintf(out, "%-22s %6i %10.3g %10.3g %10s %10s %10s  %i @ %s\n", br_name.Data(), nch,
+            st.max_rel[worst_ch], n_rel > 0 ? sum_rel/n_rel : 0.0, "-", "-", "-",
+            worst_ch - offset, point_str(st.worst_rel[worst_ch]).Data());
+      }
+
+      // worst channels of the branch, by rms pull or maximum deviation
+      if (nch > 1 && n_worst > 0) {
+        std::vector<int> order(nch);
+        std::iota(order.begin(), order.end(), offset);
+        auto rank = [&](const int& c) {
+          return pull ? st.sum_pull2[c] : (double)st.max_rel[c];
+        };
+        const int n_show = std::min(nch, n_worst);
+        std::partial_sort(order.begin(), order.begin() + n_show, order.end(),
+            [&](const int& c1, const int& c2) {return rank(c1) > rank(c2);});
+        worst_lines.push_back( Form("worst channels of %s:", br_name.Data()) );
+        for (int k = 0; k < n_show; k++) {
+          const int c = order[k];
+          if (pull) {
+            worst_lines.push_back( Form("  %6i  max_rel %9.3g  rms_pull %7.3f  max|pull| %7.2f @ %s",
+                  c - offset, st.max_rel[c], std::sqrt(st.sum_pull2[c] / pairs.size()), st.max_pull[c],
+                  point_str(st.worst_pull[c]).Data()) );
+          }
+          else {
+            worst_lines.push_back( Form("  %6i  max_rel %9.3g @ %s",
+                  c - offset, st.max_rel[c], point_str(st.worst_rel[c]).Data()) );
+          }
+        }
+      }
+      offset += nch;
+    }
+  }
+  fprintf(out, "\n");
+  for (const auto& line : worst_lines) fprintf(out, "%s\n", line.Data());
+
+  if (out != stdout) {
+    fclose(out);
+    printf("Report written to: %s\n", report_path.Data());
+  }
+  return 0;
+}
+
+void print_usage() {
+  printf("compare_vis_libs usage:\n");
+  printf("\t-a | --reference\treference library\n");
+  printf("\t-b | --candidate\tlibrary to validate\n");
+  printf("\t-o | --output\treport file (default: stdout)\n");
+  printf("\t-j | --threads\tnumber of worker threads (default: hardware concurrency)\n");
+  printf("\t-f | --floor\tvisibility floor of the relative deviations (default: 1e-6)\n");
+  printf("\t-w | --worst\tworst channels listed per branch (default: 5)\n");
+  printf("\t-n | --no-sipm\tdo not compare the SiPM arrays\n");
+
+  return;
+}
+
+int main (int argc, char *argv[]) {
+  const char* short_opts = "a:b:o:j:f:w:nh";
+  static struct option long_opts[9] =
+  {
+    {"reference", required_argument, 0, 'a'},
+    {"candidate", required_argument, 0, 'b'},
+    {"output", required_argument, 0, 'o'},
+    {"threads", required_argument, 0, 'j'},
+    {"floor", required_argument, 0, 'f'},
+    {"worst", required_argument, 0, 'w'},
+    {"no-sipm", no_argument, 0, 'n'},
+    {"help", no_argument, 0, 'h'},
+    {nullptr, no_argument, nullptr, 0}
+  };
+
+  int c, option_index;
+
+  TString reference_path = "";
+  TString candidate_path = "";
+  TString report_path = "";
+  int num_threads = std::max(1u, std::thread::hardware_concurrency());
+  float floor = 1e-6;
+  int n_worst = 5;
+  unsigned group_mask = vis_tree::ALL_GROUPS;
+
+  while ( (c = getopt_long(argc, argv, short_opts, long_opts, &option_index)) != -1) {
+    switch(c) {
+      case 'a' :
+        reference_path = optarg;
+        break;
+      case 'b' :
+        candidate_path = optarg;
+        break;
+      case 'o' :
+        report_path = optarg;
+        break;
+      case 'j' :
+        num_threads = std::max(1, atoi(optarg));
+        break;
+      case 'f' :
+        floor = std::atof(optarg);
+        break;
+      case 'w' :
+        n_worst = std::max(0, atoi(optarg));
+        break;
+      case 'n' :
+        group_mask &= ~(1u << vis_tree::kGroupSiPM);
+        break;
+      case 'h' :
+        print_usage();
+        exit( EXIT_SUCCESS );
+        break;
+      case '?' :
+        printf("compare_vis_libs error: unknown flag %c\n", optopt);
+        print_usage();
+        exit( EXIT_FAILURE );
+        break;
+    }
+  }
+
+  if (reference_path.IsNull() || candidate_path.IsNull()) {
+    printf("compare_vis_libs error: both a reference and a candidate library are required\n");
+    print_usage();
+    exit( EXIT_FAILURE );
+  }
+
+  return compare_vis_libs(reference_path, candidate_path, report_path,
+      group_mask, floor, num_threads, n_worst);
+}
@@ -0,0 +1,161 @@
+/**
+ * @file        : export_vis_npy.cc
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <getopt.h>
+
+#include "vis_export.h"
+
+/**
+ * Export the photonLib columns of a library to NumPy .npy files, one per
+ * column (<prefix>_<branch>.npy), with shape (n_points,) or (n_points,
+ * width). The library is streamed through the vis_export C interface and
+ * each chunk is written straight from the exported buffers, so memory use
+ * is bounded by the chunk size.
+ */
+
+const char* NPY_DESCR[3] = {"<f4", "<u4", "<i4"};
+
+// NPY format 1.0 header, padded so that the data starts 64-byte aligned
+bool write_npy_header(FILE* out, const VisExportColumn& col, const int64_t& n_rows) {
+  std::string shape = (col.width == 1) ?
+    "(" + std::to_string(n_rows) + ",)" :
+    "(" + std::to_string(n_rows) + ", " + std::to_string(col.width) + ")";
+  std::string dict = "{'descr': '" + std::string(NPY_DESCR[col.type]) +
+    "', 'fortran_order': False, 'shape': " + shape + ", }";
+  const size_t preamble = 10;  // magic, version, header length
+  const size_t total = ((preamble + dict.size() + 1 + 63) / 64) * 64;
+  dict.append(total - preamble - dict.size() - 1, ' ');
+  dict.push_back('\n');
+
+  const unsigned char magic[8] = {0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0};
+  const uint16_t header_len = dict.size();
+  const unsigned char len_le[2] = {(unsigned char)(header_len & 0xff), (unsigned char)(header_len >> 8)};
+  return fwrite(magic, 1, 8, out) == 8 && fwrite(len_le, 1, 2, out) == 2 &&
+    fwrite(dict.data(), 1, dict.size(), out) == dict.size();
+}
+
+int export_vis_npy(const char* input_path, const std::string& prefix,
+    const char* columns, const int64_t& chunk_rows)
+{
+  VisExportReader* reader = vis_export_open(input_path, columns, chunk_rows);
+  if (reader == nullptr) {
+    fprintf(stderr, "export_vis_npy ERROR: %s\n", vis_export_last_error());
+    return 1;
+  }
+  const int64_t n_rows = vis_export_num_rows(reader);
+  const int32_t n_cols = vis_export_num_columns(reader);
+  std::vector<VisExportColumn> cols(n_cols);
+  std::vector<FILE*> outputs(n_cols, nullptr);
+  std::vector<std::string> paths(n_cols);
+
+  bool ok = true;
+  for (int32_t icol = 0; icol < n_cols && ok; icol++) {
+    vis_export_column(reader, icol, &cols[icol]);
+    paths[icol] = prefix + "_" + cols[icol].name + ".npy";
+    outputs[icol] = fopen(paths[icol].c_str(), "wb");
+    if (outputs[icol] == nullptr || write_npy_header(outputs[icol], cols[icol], n_rows) == false) {
+      fprintf(stderr, "export_vis_npy ERROR: Unable to write %s\n", paths[icol].c_str());
+      ok = false;
+    }
+  }
+
+  int64_t n_done = 0;
+  while (ok) {
+    const int64_t n = vis_export_next(reader, cols.data());
+    if (n < 0) {
+      fprintf(stderr, "export_vis_npy ERROR: %s\n", vis_export_last_error());
+      ok = false;
+    }
+    if (n <= 0) break;
+    for (int32_t icol = 0; icol < n_cols && ok; icol++) {
+      const size_t n_bytes = n*cols[icol].row_stride;
+      if (fwrite(cols[icol].data, 1, n_bytes, outputs[icol]) != n_bytes) {
+        fprintf(stderr, "export_vis_npy ERROR: Unable to write %s\n", paths[icol].c_str());
+        ok = false;
+      }
+    }
+    n_done += n;
+    printf("\rexport_vis_npy: %lld / %lld points", (long long)n_done, (long long)n_rows);
+    fflush(stdout);
+  }
+  printf("\n");
+
+  for (auto& out : outputs) {
+    if (out) fclose(out);
+  }
+  vis_export_close(reader);
+  if (ok == false) return 1;
+
+  for (const auto& path : paths) printf("Output written to: %s\n", path.c_str());
+  return 0;
+}
+
+void print_usage() {
+  printf("export_vis_npy usage:\n");
+  printf("\t-i | --input\tmake_vis_map library file\n");
+  printf("\t-o | --output\toutput prefix, one <prefix>_<branch>.npy file per column\n");
+  printf("\t-c | --columns\tcomma-separated list of branches (default: all)\n");
+  printf("\t-n | --chunk\trows per chunk (default: 4096)\n");
+
+  return;
+}
+
+int main (int argc, char *argv[]) {
+  const char* short_opts = "i:o:c:n:h";
+  static struct option long_opts[6] =
+  {
+    {"input", required_argument, 0, 'i'},
+    {"output", required_argument, 0, 'o'},
+    {"columns", required_argument, 0, 'c'},
+    {"chunk", required_argument, 0, 'n'},
+    {"help", no_argument, 0, 'h'},
+    {nullptr, no_argument, nullptr, 0}
+  };
+
+  int c, option_index;
+
+  std::string input_path = "";
+  std::string prefix = "";
+  std::string columns = "";
+  int64_t chunk_rows = 0;
+
+  while ( (c = getopt_long(argc, argv, short_opts, long_opts, &option_index)) != -1) {
+    switch(c) {
+      case 'i' :
+        input_path = optarg;
+        break;
+      case 'o' :
+        prefix = optarg;
+        break;
+      case 'c' :
+        columns = optarg;
+        break;
+      case 'n' :
+        chunk_rows = atoll(optarg);
+        break;
+      case 'h' :
+        print_usage();
+        exit( EXIT_SUCCESS );
+        break;
+      case '?' :
+        printf("export_vis_npy error: unknown flag %c\n", optopt);
+        print_usage();
+        exit( EXIT_FAILURE );
+        break;
+    }
+  }
+
+  if (input_path.empty() || prefix.empty()) {
+    printf("export_vis_npy error: an input library and an output prefix are required\n");
+    print_usage();
+    exit( EXIT_FAILURE );
+  }
+
+  return export_vis_npy(input_path.c_str(), prefix, columns.c_str(), chunk_rows);
+}
@@ -0,0 +1,173 @@
+/**
+ * @file        : make_hit_skim.cc
+ */
+
+#include <iostream>
+#include <getopt.h>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "TFile.h"
+#include "TTree.h"
+#include "TTreeReader.h"
+#include "TTreeReaderValue.h"
+
+#include "event/SLArGenRecords.hh"
+#include "event/SLArEventAnode.hh"
+
+#include "vis_tree_io.hh"
+
+/**
+ * One-time skim of a SoLAr-sim output file into a flat SiPM hit table
+ * (hitSkim tree, see vis_tree::HitSkimEvent). The nested anode, megatile,
+ * tile, SiPM and backtracker maps are deserialised once here; make_vis_tree
+ * can then run directly on the skim, which only holds split arrays of
+ * plain types. The hit times are stored binned (vis_timing bins per SiPM)
+ * for the arrival-time profiles of make_vis_tree --timing.
+ */
+int make_hit_skim(
+    const TString& input_file_path,
+    TString output_file_path = "")
+{
+  TFile* input_file = TFile::Open(input_file_path);
+  if (input_file == nullptr || input_file->IsZombie()) {
+    fprintf(stderr, "make_hit_skim ERROR: Unable to open input file %s\n",
+        input_file_path.Data());
+    exit(EXIT_FAILURE);
+  }
+
+  TTree* tree_event = input_file->Get<TTree>("EventTree");
+  TTree* tree_gen = input_file->Get<TTree>("GenTree");
+  tree_event->AddFriend(tree_gen, "GenTree");
+
+  // only the anode and generator branches are read
+  TTreeReader reader(tree_event);
+  TTreeReaderValue<SLArListEventAnode> evAnodeList(reader, "EventAnode");
+  TTreeReaderValue<SLArGenRecordsVector> genRecords(reader, "GenTree.GenRecords");
+
+  if (output_file_path.IsNull()) {
+    output_file_path = input_file_path;
+    output_file_path.Resize( output_file_path.Index(".root") );
+    output_file_path.Append("_skim.root");
+  }
+  TFile* output_file = new TFile(output_file_path, "recreate");
+
+  TTree* skim = new TTree(vis_tree::SKIM_TREE, "SoLAr@ProtoDUNE3 SiPM hit skim");
+  auto ev = std::make_unique<vis_tree::HitSkimEvent>();
+  ev->Book(skim);
+
+  std::vector<std::function<int(const int&, const int&, const int&)>> sipm_mapper = {
+    vis_tree::get_sipm_index_main,
+    vis_tree::get_sipm_index_lat,
+    vis_tree::get_sipm_index_lat
+  };
+
+  while (reader.Next()) {
+    const auto& genStatus = genRecords->GetRecordsVector().at(0).GetGenStatus();
+    ev->event_id = reader.GetCurrentEntry();
+    ev->coords[0] = genStatus.at(0);
+    ev->coords[1] = genStatus.at(1);
+    ev->coords[2] = genStatus.at(2);
+    ev->n_sipm = 0;
+    ev->n_tbin = 0;
+
+    for (const auto& evAnode_itr : evAnodeList->GetConstAnodeMap()) {
+      const int anode_idx = vis_tree::get_anode_idx( evAnode_itr.first );
+      if (anode_idx < 0) continue; // Skip top TPC
+
+      for (const auto& evMT_itr : evAnode_itr.second.GetConstMegaTilesMap()) {
+        for (const auto& evT_itr : evMT_itr.second.GetConstTileMap()) {
+          for (const auto& evSiPM_itr : evT_itr.second.GetConstSiPMEvents()) {
+            const auto& evSiPM = evSiPM_itr.second;
+            if (evSiPM.GetNhits() == 0) continue;
+
+            const int isipm = ev->n_sipm;
+            ev->sipm_anode[isipm] = anode_idx;
+            ev->sipm_idx[isipm] =
+              sipm_mapper[anode_idx](evMT_itr.first, evT_itr.first, evSiPM_itr.first);
+
+            UInt_t* nHitsPerProc = ev->hit_counts[isipm];
+            std::fill(nHitsPerProc, nHitsPerProc + vis_tree::N_PROC, 0);
+            UInt_t thist[vis_timing::N_TBIN] = {0};
+            const auto& backtrackerColl = evSiPM.GetBacktrackerRecordCollection();
+            const double clock_unit = evSiPM.GetClockUnit();
+            for (const auto& hit : evSiPM.GetConstHits()) {
+              const auto& bktrkProc = backtrackerColl.at(hit.first).GetConstRecords().at(0);
+              for (const auto& proc : bktrkProc.GetConstCounter()) {
+                nHitsPerProc[proc.first] += proc.second;
+              }
+              // hits are keyed on their time in clock units
+              thist[vis_timing::get_time_bin(hit.first*clock_unit)] += hit.second;
+            }
+            nHitsPerProc[0] = evSiPM.GetNhits();
+
+            for (int ib = 0; ib < vis_timing::N_TBIN; ib++) {
+              if (thist[ib] == 0) continue;
+              ev->tbin_sipm[ev->n_tbin] = isipm;
+              ev->tbin[ev->n_tbin] = ib;
+              ev->tbin_hits[ev->n_tbin] = thist[ib];
+              ev->n_tbin++;
+            }
+            ev->n_sipm++;
+          }
+        }
+      }
+    }
+
+    skim->Fill();
+  }
+
+  printf("make_hit_skim: %lld events written to %s\n", skim->GetEntries(), output_file_path.Data());
+
+  output_file->cd();
+  skim->Write();
+  output_file->Close();
+
+  return 0;
+}
+
+void print_usage() {
+  printf("make_hit_skim usage:\n");
+  printf("\t-i | --input\tinput_file_path\n");
+  printf("\t-o | --output\toutput_file_path (optional, default: <input>_skim.root)\n");
+
+  return;
+}
+
+int main (int argc, char *argv[]) {
+  const char* short_opts = "i:o:h";
+  static struct option long_opts[4] =
+  {
+    {"input", required_argument, 0, 'i'},
+    {"output", required_argument, 0, 'o'},
+    {"help", no_argument, 0, 'h'},
+    {nullptr, no_argument, nullptr, 0}
+  };
+
+  int c, option_index;
+
+  TString input_file_path = "";
+  TString output_file_path = "";
+
+  while ( (c = getopt_long(argc, argv, short_opts, long_opts, &option_index)) != -1) {
+    switch(c) {
+      case 'i' :
+        input_file_path = optarg;
+        break;
+      case 'o' :
+        output_file_path = optarg;
+        break;
+      case 'h' :
+        print_usage();
+        exit( EXIT_SUCCESS );
+        break;
+      case '?' :
+        printf("make_hit_skim error: unknown flag %c\n", optopt);
+        print_usage();
+        exit( EXIT_FAILURE );
+        break;
+    }
+  }
+
+  return make_hit_skim(input_file_path, output_file_path);
+}
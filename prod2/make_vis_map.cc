@@ -7,6 +7,9 @@
 #include <iostream>
 #include <cstdio>
 #include <list>
+#include <vector>
+#include <numeric>
+#include <algorithm>
 #include <getopt.h>
 #include "TFile.h"
 #include "TTree.h"
@@ -15,6 +18,10 @@
 #include "rapidjson/document.h"
 #include "rapidjson/filereadstream.h"
 
+#include "vis_quant.hh"
+#include "vis_compress.hh"
+#include "vis_spatial_index.hh"
+
 
 class LRUFileCache {
   private:
@@ -103,10 +110,72 @@ void print_usage() {
   printf("make_vis_map usage:\n");
   printf("  --json-filemap <file>   JSON file containing the file map\n");
   printf("  --output <file>         Output ROOT file name (default: vis_map.root)\n");
+  printf("  --quantise <rule>       <branch wildcard>=<float|f16:nbits|f16:xmin:xmax:nbits|log:nbits:vmin:vmax>\n");
+  printf("                          quantised storage of the tile/SiPM arrays (repeatable, last match wins)\n");
+  printf("  --compression <rule>    [<branch wildcard>=]<zlib|lzma|lz4|zstd>:<level>[:shuffle] | none\n");
+  printf("                          per-branch codec (repeatable, last match wins, no wildcard: file default,\n");
+  printf("                          default lzma:1); shuffle byte-transposes the float arrays\n");
+  printf("  --order <lex|morton|hilbert>  entry ordering along the grid (default: lex)\n");
+  printf("  --cluster <n>           entries per TTree cluster (default: 64 with a curve order, ROOT default otherwise)\n");
   return;
 }
 
-int make_vis_map(const TString &json_filemap, const TString &output_file_path) {
+/**
+ * Output branch re-encoded with a quantisation rule or byte-shuffled. The
+ * source branch is read into a float buffer (decoding it if it was
+ * log-coded by make_vis_tree) and then stored according to the output
+ * spec.
+ */
+struct QuantBranch {
+  TString name;
+  int size = 0;
+  bool shuffle = false;
+  vis_quant::QuantSpec in_spec;
+  vis_quant::QuantSpec out_spec;
+  std::vector<float> data;
+  std::vector<float> out_data;
+  std::vector<UShort_t> in_codes;
+  std::vector<UShort_t> out_codes;
+  vis_quant::QuantStats stats;
+
+  void* GetOutputAddress() {
+    if (out_spec.mode == vis_quant::kLogCode) return out_codes.data();
+    if (shuffle) return out_data.data();
+    return data.data();
+  }
+
+  void Connect(TTree* source_tree) {
+    in_spec = vis_quant::get_branch_spec(source_tree, name);
+    if (in_spec.mode == vis_quant::kLogCode) {
+      in_codes.resize(size, 0);
+      source_tree->SetBranchAddress(name, in_codes.data());
+    }
+    else {
+      source_tree->SetBranchAddress(name, data.data());
+    }
+  }
+
+  void Encode() {
+    if (in_spec.mode == vis_quant::kLogCode) {
+      vis_quant::decode(in_codes.data(), data.data(), size, in_spec);
+    }
+    stats.Fill(data.data(), size, out_spec);
+    if (out_spec.mode == vis_quant::kLogCode) {
+      vis_quant::encode(data.data(), out_codes.data(), size, out_spec);
+    }
+    else if (shuffle) {
+      vis_compress::byte_shuffle(data.data(), out_data.data(), size, sizeof(float));
+    }
+  }
+};
+
+int make_vis_map(
+    const TString &json_filemap, 
+    const TString &output_file_path, 
+    const vis_quant::QuantPolicy& quant_policy,
+    const vis_compress::CompressionPolicy& compression_policy,
+    const int curve_order,
+    const Long64_t cluster_size) {
   
   FILE* json_fp = fopen(json_filemap.Data(), "r");
   if (json_fp == nullptr) {
@@ -127,6 +196,42 @@ int make_vis_map(const TString &json_filemap, const TString &output_file_path) {
   LRUFileCache cache(maxCacheSize, treeName.Data());
   const auto& first_entry = d[0];
 
+  // Node of each source point on the production grid and its curve key
+  const rapidjson::SizeType n_json = d.Size();
+  std::vector<float> json_coords(3*n_json);
+  std::vector<float> axis[3];
+  const char* axis_name[3] = {"x", "y", "z"};
+  for (rapidjson::SizeType i = 0; i < n_json; i++) {
+    for (int k = 0; k < 3; k++) {
+      json_coords[3*i+k] = d[i][axis_name[k]].GetFloat();
+      axis[k].push_back(json_coords[3*i+k]);
+    }
+  }
+  size_t n_nodes[3] = {0, 0, 0};
+  for (int k = 0; k < 3; k++) {
+    std::sort(axis[k].begin(), axis[k].end());
+    axis[k].erase(std::unique(axis[k].begin(), axis[k].end()), axis[k].end());
+    n_nodes[k] = axis[k].size();
+  }
+  const int curve_bits = vis_tree::get_curve_bits( *std::max_element(n_nodes, n_nodes+3) );
+  std::vector<ULong64_t> json_keys(n_json);
+  for (rapidjson::SizeType i = 0; i < n_json; i++) {
+    UInt_t inode[3] = {0, 0, 0};
+    for (int k = 0; k < 3; k++) {
+      inode[k] = std::lower_bound(axis[k].begin(), axis[k].end(), json_coords[3*i+k]) - axis[k].begin();
+    }
+    json_keys[i] = vis_tree::get_curve_key(curve_order, inode, n_nodes, curve_bits);
+  }
+
+  std::vector<rapidjson::SizeType> entry_order(n_json);
+  std::iota(entry_order.begin(), entry_order.end(), 0);
+  if (curve_order != vis_tree::kOrderLex) {
+    std::stable_sort(entry_order.begin(), entry_order.end(),
+        [&json_keys](const rapidjson::SizeType& a, const rapidjson::SizeType& b) {
+          return json_keys[a] < json_keys[b];
+        });
+  }
+
   // Open the first file to get the tree structure
   TString first_entry_path = first_entry["filepath"].GetString();
   first_entry_path.Insert( first_entry_path.Index(".root"), "_vtree");
@@ -139,17 +244,75 @@ int make_vis_map(const TString &json_filemap, const TString &output_file_path) {
   }
 
   // Create output file and clone tree structure
-  TFile* outFile = TFile::Open(output_file_path, "RECREATE", "SoLAr photon library - ProtoDUNE-Run3", ROOT::CompressionSettings(ROOT::kLZMA, 1));
+  const int file_compression = compression_policy.GetFileSettings( ROOT::CompressionSettings(ROOT::kLZMA, 1) );
+  TFile* outFile = TFile::Open(output_file_path, "RECREATE", "SoLAr photon library - ProtoDUNE-Run3", file_compression);
   if (!outFile || outFile->IsZombie()) {
     std::cerr << "Error: Cannot create output file: " << output_file_path << std::endl;
     return 1;
   }
 
+  // Visibility arrays with a quantisation rule or byte shuffle are excluded
+  // from the clone and booked again with the requested storage
+  std::vector<QuantBranch> quant_branches;
+  for (TObject* obj : *firstTree->GetListOfBranches()) {
+    TBranch* br = (TBranch*)obj;
+    const TString br_name = br->GetName();
+    const vis_quant::QuantSpec spec = quant_policy.GetSpec(br_name);
+    const bool shuffle = compression_policy.GetSpec(br_name).shuffle;
+    TLeaf* leaf = (TLeaf*)br->GetListOfLeaves()->At(0);
+    if (spec.mode == vis_quant::kFloat && shuffle == false) continue;
+    if (br_name.BeginsWith("vis_") == false || leaf->GetLenStatic() < 2) {
+      std::cerr << "Warning: quantisation and shuffle only apply to tile/SiPM arrays, skipping " 
+        << br_name << std::endl;
+      continue;
+    }
+    QuantBranch qbr;
+    qbr.name = br_name;
+    qbr.size = leaf->GetLenStatic();
+    qbr.out_spec = spec;
+    qbr.shuffle = shuffle && (spec.mode == vis_quant::kFloat);
+    if (shuffle && qbr.shuffle == false) {
+      std::cerr << "Warning: byte shuffle only applies to float arrays, not to " 
+        << br_name << " (" << spec.Encode() << ")" << std::endl;
+    }
+    qbr.data.resize(qbr.size, 0.0);
+    if (qbr.shuffle) qbr.out_data.resize(qbr.size, 0.0);
+    qbr.out_codes.resize(qbr.size, 0);
+    quant_branches.push_back( std::move(qbr) );
+    firstTree->SetBranchStatus(br_name, 0);
+  }
+
   TTree* outTree = firstTree->CloneTree(0);
   outTree->SetDirectory(outFile);
+  if (cluster_size > 0) outTree->SetAutoFlush(cluster_size);
+
+  for (auto& qbr : quant_branches) {
+    firstTree->SetBranchStatus(qbr.name, 1);
+    outTree->Branch(qbr.name, qbr.GetOutputAddress(), 
+        Form("%s[%i]/%s", qbr.name.Data(), qbr.size, qbr.out_spec.LeafType().Data()));
+    qbr.Connect(firstTree);
+  }
+  compression_policy.Apply(outTree, file_compression);
+
+  for (TObject* obj : *outTree->GetListOfBranches()) {
+    const TString br_name = obj->GetName();
+    vis_quant::QuantSpec spec = vis_quant::get_branch_spec(firstTree, br_name);
+    bool shuffled = false;
+    for (const auto& qbr : quant_branches) {
+      if (qbr.name == br_name) {
+        spec = qbr.out_spec;
+        shuffled = qbr.shuffle;
+      }
+    }
+    vis_quant::set_branch_spec(outTree, br_name, spec);
+    vis_compress::set_shuffled(outTree, br_name, shuffled);
+  }
 
   Long64_t num_entries = 0;
-  for (const auto& jval : d.GetArray()) {
+  std::vector<float> entry_coords;
+  std::vector<ULong64_t> entry_keys;
+  for (const auto& ijson : entry_order) {
+    const auto& jval = d[ijson];
     assert(jval.IsObject());
 
     Long64_t entry_nr = jval["entry"].GetInt();
@@ -167,11 +330,15 @@ int make_vis_map(const TString &json_filemap, const TString &output_file_path) {
     }
     if (filename != filename_tmp) {
       outTree->CopyAddresses(sourceTree);
+      for (auto& qbr : quant_branches) qbr.Connect(sourceTree);
       filename_tmp = filename;
     }
 
     sourceTree->GetEntry(entry_nr);
+    for (auto& qbr : quant_branches) qbr.Encode();
     outTree->Fill();
+    entry_coords.insert(entry_coords.end(), &json_coords[3*ijson], &json_coords[3*ijson+3]);
+    entry_keys.push_back(json_keys[ijson]);
 
     num_entries++;
   }
@@ -180,10 +347,26 @@ int make_vis_map(const TString &json_filemap, const TString &output_file_path) {
 
   outFile->cd();
   outTree->Write();
+
+  const auto cluster_table = vis_tree::build_cluster_table(outTree, entry_coords, entry_keys);
+  vis_tree::write_cluster_table(cluster_table, curve_order);
+  printf("Spatial index: %s order, %zu clusters for %lld entries\n",
+      vis_tree::CURVE_LABEL[curve_order], cluster_table.size(), num_entries);
+
   outFile->Close();
   delete outFile;
 
-  std::cout << "Output written to: " << outFile << std::endl;
+  std::cout << "Output written to: " << output_file_path << std::endl;
+
+  if (quant_branches.empty() == false) {
+    std::vector<TString> names;
+    std::vector<vis_quant::QuantSpec> specs;
+    std::vector<vis_quant::QuantStats> stats;
+    for (const auto& qbr : quant_branches) {
+      names.push_back(qbr.name); specs.push_back(qbr.out_spec); stats.push_back(qbr.stats);
+    }
+    vis_quant::print_report(names, specs, stats);
+  }
 
   return 0; 
 }
@@ -191,22 +374,55 @@ int make_vis_map(const TString &json_filemap, const TString &output_file_path) {
 int main (int argc, char *argv[]) {
   TString json_filemap = "";
   TString output_file = "vis_map.root";
+  vis_quant::QuantPolicy quant_policy;
+  vis_compress::CompressionPolicy compression_policy;
+  int curve_order = vis_tree::kOrderLex;
+  Long64_t cluster_size = -1;
 
   static struct option long_options[] = {
     {"json-filemap", required_argument, 0, 'j'},
     {"output", required_argument, 0, 'o'},
+    {"quantise", required_argument, 0, 'q'},
+    {"compression", required_argument, 0, 'z'},
+    {"order", required_argument, 0, 's'},
+    {"cluster", required_argument, 0, 'c'},
     {"help", no_argument, 0, 'h'},
     {0, 0, 0, 0}
   };
 
   int opt;
   int long_index =0;
-  while ((opt = getopt_long(argc, argv,"j:o:h", long_options, &long_index )) != -1) {
+  while ((opt = getopt_long(argc, argv,"j:o:q:z:s:c:h", long_options, &long_index )) != -1) {
     switch (opt) {
       case 'j' : json_filemap = TString(optarg);
         break;
       case 'o' : output_file = TString(optarg);
         break;
+      case 'q' : 
+        if (quant_policy.AddRule(optarg) == false) {
+          std::cerr << "Error: invalid quantisation rule " << optarg << std::endl;
+          print_usage();
+          return 1;
+        }
+        break;
+      case 'z' :
+        if (compression_policy.AddRule(optarg) == false) {
+          std::cerr << "Error: invalid compression rule " << optarg << std::endl;
+          print_usage();
+          return 1;
+        }
+        break;
+      case 's' :
+        curve_order = vis_tree::parse_curve_order(optarg);
+        if (curve_order < 0) {
+          std::cerr << "Error: unknown entry order " << optarg << std::endl;
+          print_usage();
+          return 1;
+        }
+        break;
+      case 'c' :
+        cluster_size = std::atoll(optarg);
+        break;
       case 'h' : 
         print_usage();
         return 0;
@@ -222,7 +438,10 @@ int main (int argc, char *argv[]) {
     return 1;
   }
 
-  int status = make_vis_map(json_filemap, output_file);
+  if (cluster_size < 0) cluster_size = (curve_order == vis_tree::kOrderLex) ? 0 : 64;
+
+  int status = make_vis_map(json_filemap, output_file, quant_policy, compression_policy,
+      curve_order, cluster_size);
 
   return status;
 }
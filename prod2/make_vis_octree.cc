@@ -0,0 +1,177 @@
+/**
+ * @file        : make_vis_octree.cc
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <getopt.h>
+#include "TFile.h"
+
+#include "vis_tree_io.hh"
+#include "vis_library.hh"
+#include "vis_octree.hh"
+
+/**
+ * Build the multi-resolution (octree) storage of a make_vis_map library,
+ * one octree per group (see vis_octree.hh). For each group the tool
+ * checks the octree against all the library points, measures the lookup
+ * time on random positions and compares the memory with the full grid.
+ */
+
+int make_vis_octree(const TString& input_file_path, const TString& output_file_path,
+    const unsigned& group_mask, const float& tolerance, const float& floor, const int& n_lookups)
+{
+  vis_tree::VisLibrary lib;
+  printf("make_vis_octree: loading %s...\n", input_file_path.Data());
+  if (lib.Load(input_file_path, group_mask) == false) return 1;
+
+  TFile* output_file = new TFile(output_file_path, "recreate");
+  bool axes_written = false;
+  size_t mem_full = 0, mem_octree = 0;
+
+  printf("%-10s %8s %10s %10s %10s %10s %12s %10s\n", "group", "depth", "nodes", "leaves",
+      "samples", "max_dev", "memory [MB]", "lookup");
+  for (int ig = 0; ig < vis_tree::N_GROUP; ig++) {
+    if (lib.HasGroup(ig) == false) continue;
+    vis_tree::VisOctree octree;
+    if (octree.Build(lib, ig, tolerance, floor) == false) {
+      output_file->Close();
+      delete output_file;
+      return 1;
+    }
+
+    // deviation at the library points, in units of the tolerance criterion
+    std::vector<float> vis(octree.GetNChannels());
+    double max_dev = 0;
+    for (size_t i = 0; i < lib.GetNPoints(); i++) {
+      const float* xyz = lib.GetCoords(i);
+      if (octree.Interpolate(xyz[0], xyz[1], xyz[2], vis.data()) == false) continue;
+      const float* ref = lib.Get(ig, i);
+      for (int c = 0; c < octree.GetNChannels(); c++) {
+        max_dev = std::max(max_dev, std::fabs(vis[c] - ref[c]) / (double)std::max(std::fabs(ref[c]), floor));
+      }
+    }
+
+    // lookup time on random positions inside the grid
+    std::mt19937 rng(ig);
+    std::vector<float> pos(3*std::max(n_lookups, 1));
+    for (int k = 0; k < 3; k++) {
+      std::uniform_real_distribution<float> uni(lib.GetAxis(k).front(), lib.GetAxis(k).back());
+      for (int i = 0; i < n_lookups; i++) pos[3*i+k] = uni(rng);
+    }
+    const auto t0 = std::chrono::steady_clock::now();
+    int n_found = 0;
+    for (int i = 0; i < n_lookups; i++) {
+      n_found += octree.Interpolate(pos[3*i], pos[3*i+1], pos[3*i+2], vis.data());
+    }
+    const double t_lookup = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+
+    const size_t mem_group = lib.GetNPoints() * vis_tree::get_group_size(ig) * sizeof(float);
+    mem_full += mem_group;
+    mem_octree += octree.GetMemory();
+    printf("%-10s %8i %10zu %10zu %10zu %10.2e %5.1f/%6.1f %7.2f us\n", vis_tree::GROUP_LABEL[ig],
+        octree.GetDepth(), octree.GetNNodes(), octree.GetNLeaves(), octree.GetNSamples(),
+        max_dev, octree.GetMemory() / 1048576.0, mem_group / 1048576.0,
+        n_lookups > 0 ? t_lookup / n_lookups : 0.0);
+    if (n_found < n_lookups) {
+      printf("           %i/%i random positions fall in cells without data\n", n_lookups - n_found, n_lookups);
+    }
+
+    output_file->cd();
+    if (axes_written == false) {
+      octree.WriteAxes();
+      axes_written = true;
+    }
+    octree.Write();
+  }
+
+  output_file->Close();
+  delete output_file;
+
+  printf("make_vis_octree: %.1f MB in memory instead of %.1f MB (%.1f%%), tolerance %g, floor %g\n",
+      mem_octree / 1048576.0, mem_full / 1048576.0, 100.0 * mem_octree / std::max<size_t>(mem_full, 1),
+      tolerance, floor);
+  printf("Output written to: %s\n", output_file_path.Data());
+  return 0;
+}
+
+void print_usage() {
+  printf("make_vis_octree usage:\n");
+  printf("\t-i | --input\tmake_vis_map library file\n");
+  printf("\t-o | --output\toutput octree file\n");
+  printf("\t-e | --tolerance\trelative interpolation tolerance (default: 0.02)\n");
+  printf("\t-f | --floor\tvisibility floor of the tolerance (default: 1e-6)\n");
+  printf("\t-b | --bench\tnumber of random lookups timed per group (default: 100000)\n");
+  printf("\t-n | --no-sipm\tdo not build the SiPM octree\n");
+
+  return;
+}
+
+int main (int argc, char *argv[]) {
+  const char* short_opts = "i:o:e:f:b:nh";
+  static struct option long_opts[8] =
+  {
+    {"input", required_argument, 0, 'i'},
+    {"output", required_argument, 0, 'o'},
+    {"tolerance", required_argument, 0, 'e'},
+    {"floor", required_argument, 0, 'f'},
+    {"bench", required_argument, 0, 'b'},
+    {"no-sipm", no_argument, 0, 'n'},
+    {"help", no_argument, 0, 'h'},
+    {nullptr, no_argument, nullptr, 0}
+  };
+
+  int c, option_index;
+
+  TString input_file_path = "";
+  TString output_file_path = "";
+  float tolerance = 0.02;
+  float floor = 1e-6;
+  int n_lookups = 100000;
+  unsigned group_mask = vis_tree::ALL_GROUPS;
+
+  while ( (c = getopt_long(argc, argv, short_opts, long_opts, &option_index)) != -1) {
+    switch(c) {
+      case 'i' :
+        input_file_path = optarg;
+        break;
+      case 'o' :
+        output_file_path = optarg;
+        break;
+      case 'e' :
+        tolerance = std::atof(optarg);
+        break;
+      case 'f' :
+        floor = std::atof(optarg);
+        break;
+      case 'b' :
+        n_lookups = std::max(0, atoi(optarg));
+        break;
+      case 'n' :
+        group_mask &= ~(1u << vis_tree::kGroupSiPM);
+        break;
+      case 'h' :
+        print_usage();
+        exit( EXIT_SUCCESS );
+        break;
+      case '?' :
+        printf("make_vis_octree error: unknown flag %c\n", optopt);
+        print_usage();
+        exit( EXIT_FAILURE );
+        break;
+    }
+  }
+
+  if (input_file_path.IsNull() || output_file_path.IsNull()) {
+    printf("make_vis_octree error: input and output files are required\n");
+    print_usage();
+    exit( EXIT_FAILURE );
+  }
+
+  return make_vis_octree(input_file_path, output_file_path, group_mask, tolerance, floor, n_lookups);
+}
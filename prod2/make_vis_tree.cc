@@ -9,7 +9,12 @@
 #include <functional>
 #include <vector>
 #include <fstream>
+#include <memory>
+#include <map>
+#include <set>
+#include <algorithm>
 #include "TFile.h"
+#include "TSystem.h"
 #include "TChain.h"
 #include "TTree.h"
 #include "TTreeReader.h"
@@ -19,345 +24,358 @@
 #include "event/SLArEventAnode.hh"
 #include "event/SLArEventSuperCellArray.hh"
 
-const int N_CRU = 2;
-const int N_CRU_TILE = 30;
-const int N_CRU_SIPM = 160;
-
-const int N_CRU_EDGE = 1;
-const int N_EDGE_TILE = 10;
-const int N_EDGE_SIPM = 60;
-
-int get_sipm_index_main(const int& mt_idx, const int& t_idx, const int& sipm_idx) 
-{
-  int idx = sipm_idx + N_CRU_SIPM*(t_idx + N_CRU_TILE*(mt_idx)); 
-  return idx;
-}
-
-int get_sipm_index_lat(const int& mt_idx, const int& t_idx, const int& sipm_idx) 
-{
-  int idx = sipm_idx + N_EDGE_SIPM*(t_idx + N_EDGE_TILE*(mt_idx)); 
-  return idx;
-}
-
-int get_tile_index_main(const int& mt_idx, const int& t_idx) {
-  return t_idx + N_CRU_TILE*(mt_idx);
-}
-
-int get_tile_index_lat(const int& mt_idx, const int& t_idx) {
-  return t_idx + N_EDGE_TILE*(mt_idx);
-}
+#include "vis_quant.hh"
+#include "vis_compress.hh"
+#include "vis_tree_io.hh"
 
 int make_vis_tree(
-    const TString& input_file_path, 
-    TString output_file_path = "")
+    const TString& input_file_path,
+    TString output_file_path = "",
+    const vis_quant::QuantPolicy& quant_policy = vis_quant::QuantPolicy(),
+    const bool raw_counts = false,
+    const Long64_t first_entry = 0,
+    const Long64_t num_entries = -1,
+    const bool with_timing = false,
+    const vis_compress::CompressionPolicy& compression_policy = vis_compress::CompressionPolicy(),
+    const bool follow = false,
+    const double poll_interval = 10.0,
+    const double idle_timeout = 600.0)
 {
-  TFile* input_file = TFile::Open(input_file_path); 
-  if (input_file == nullptr || input_file->IsZombie()) {
-    fprintf(stderr, "make_photonlibrary ERROR: Unable to open input file %s\b", 
-        input_file_path.Data());
-    exit(EXIT_FAILURE);
-  }
-
-  TTree* tree_event = input_file->Get<TTree>("EventTree");
-  TTree* tree_gen = input_file->Get<TTree>("GenTree");
-  tree_event->AddFriend(tree_gen, "GenTree");
-  
-  TTreeReader reader(tree_event);
-  TTreeReaderValue<SLArListEventAnode> evAnodeList(reader, "EventAnode");
-  TTreeReaderValue<SLArListEventPDS> evPDSList(reader, "EventPDS");
-  TTreeReaderValue<SLArGenRecordsVector> genRecords(reader, "GenTree.GenRecords");
-
-  const float num_photons = 1e7; 
-  float coords[3] = {0.0, 0.0, 0.0};
-  UInt_t n_events_per_point = 0;
+  // process only the requested slice of the input file
+  const Long64_t last_entry = (num_entries < 0) ? -1 : first_entry + num_entries;
 
   if (output_file_path.IsNull()) {
+    if (input_file_path.Index(".root") < 0) {
+      fprintf(stderr, "make_vis_tree ERROR: an output file is required for input %s\n",
+          input_file_path.Data());
+      exit(EXIT_FAILURE);
+    }
     output_file_path = input_file_path;
-    output_file_path.Resize( output_file_path.Index(".root") ); 
-    output_file_path.Append("_ntuple.root"); 
+    output_file_path.Resize( output_file_path.Index(".root") );
+    output_file_path.Append("_ntuple.root");
   }
   TFile* output_file = new TFile(
-      output_file_path, 
+      output_file_path,
       "recreate");
-
-  TTree* plib = new TTree("photonLib", "SoLAr@ProtoDUNE3 Photon Library"); 
-
-  float  vis_tot = 0.0; 
-  float  vis_dir = 0.0; 
-  float  vis_wls = 0.0; 
-
-  const Int_t NTILE_MAIN = 60;
-  const Int_t NTILE_LAT  = 10; 
-  float  vis_tot_tile_main[NTILE_MAIN] = {0.0};
-  float  vis_tot_tile_lat0[NTILE_LAT ] = {0.0};
-  float  vis_tot_tile_lat1[NTILE_LAT ] = {0.0};
-  
-  float  vis_dir_tile_main[NTILE_MAIN] = {0.0};
-  float  vis_dir_tile_lat0[NTILE_LAT ] = {0.0};
-  float  vis_dir_tile_lat1[NTILE_LAT ] = {0.0};
-  
-  float  vis_wls_tile_main[NTILE_MAIN] = {0.0};
-  float  vis_wls_tile_lat0[NTILE_LAT ] = {0.0};
-  float  vis_wls_tile_lat1[NTILE_LAT ] = {0.0};
-  
-  const Int_t NSIPM_MAIN = 9600; 
-  const Int_t NSIPM_LAT  =  600; 
-  float  vis_sipm_main[NSIPM_MAIN] = {0.0}; 
-  float  vis_sipm_lat0[NSIPM_LAT ] = {0.0};
-  float  vis_sipm_lat1[NSIPM_LAT ] = {0.0};
-  
-  plib->Branch("x", &coords[0]);
-  plib->Branch("y", &coords[1]);
-  plib->Branch("z", &coords[2]); 
-
-  plib->Branch("vis_tot", &vis_tot); 
-  plib->Branch("vis_dir", &vis_dir); 
-  plib->Branch("vis_wls", &vis_wls);
-  
-  plib->Branch("vis_tot_tile_main" , &vis_tot_tile_main, Form("vis_tot_tile_main[%i]/F" , NTILE_MAIN));
-  plib->Branch("vis_tot_tile_edge0", &vis_tot_tile_lat0, Form("vis_tot_tile_edge0[%i]/F", NTILE_LAT));
-  plib->Branch("vis_tot_tile_edge1", &vis_tot_tile_lat1, Form("vis_tot_tile_edge1[%i]/F", NTILE_LAT));
-  
-  plib->Branch("vis_dir_tile_main" , &vis_dir_tile_main, Form("vis_dir_tile_main[%i]/F" , NTILE_MAIN));
-  plib->Branch("vis_dir_tile_edge0", &vis_dir_tile_lat0, Form("vis_dir_tile_edge0[%i]/F", NTILE_LAT ));
-  plib->Branch("vis_dir_tile_edge1", &vis_dir_tile_lat1, Form("vis_dir_tile_edge1[%i]/F", NTILE_LAT ));
-  
-  plib->Branch("vis_wls_tile_main" , &vis_wls_tile_main, Form("vis_wls_tile_main[%i]/F" , NTILE_MAIN));
-  plib->Branch("vis_wls_tile_edge0", &vis_wls_tile_lat0, Form("vis_wls_tile_edge0[%i]/F", NTILE_LAT ));
-  plib->Branch("vis_wls_tile_edge1", &vis_wls_tile_lat1, Form("vis_wls_tile_edge1[%i]/F", NTILE_LAT ));
-  
-  plib->Branch("vis_sipm_main"  , &vis_sipm_main, Form("vis_sipm_main[%i]/F" , NSIPM_MAIN));
-  plib->Branch("vis_sipm_edge00", &vis_sipm_lat1, Form("vis_sipm_edge0[%i]/F", NSIPM_LAT ));
-  plib->Branch("vis_sipm_edge11", &vis_sipm_lat1, Form("vis_sipm_edge1[%i]/F", NSIPM_LAT ));
-
-  float* vis_tot_tile[3] = {vis_tot_tile_main, vis_tot_tile_lat0, vis_tot_tile_lat1};
-  float* vis_dir_tile[3] = {vis_dir_tile_main, vis_dir_tile_lat0, vis_dir_tile_lat1};
-  float* vis_wls_tile[3] = {vis_wls_tile_main, vis_wls_tile_lat0, vis_wls_tile_lat1};
-  float* vis_sipm    [3] = {vis_sipm_main, vis_sipm_lat0, vis_sipm_lat1};
+  output_file->SetCompressionSettings(
+      compression_policy.GetFileSettings(output_file->GetCompressionSettings()) );
+
+  // hit counts are accumulated as integers and normalised when the point
+  // is complete, unless the raw counts are requested (see reduce_vis_tree)
+  auto counts = std::make_unique<vis_tree::VisCounts>();
+  auto vis = std::make_unique<vis_tree::VisBuffer>();
+
+  TTree* plib = nullptr;
+  if (raw_counts) {
+    plib = new TTree(vis_tree::COUNTS_TREE, "SoLAr@ProtoDUNE3 Photon Library (raw hit counts)");
+    counts->Book(plib, with_timing);
+  }
+  else {
+    plib = new TTree(vis_tree::LIB_TREE, "SoLAr@ProtoDUNE3 Photon Library");
+    vis->Book(plib, quant_policy, with_timing);
+  }
+  compression_policy.Apply(plib, output_file->GetCompressionSettings());
 
   std::vector<std::function<int(const int&, const int&, const int&)>> sipm_mapper = {
-    get_sipm_index_main,
-    get_sipm_index_lat,
-    get_sipm_index_lat
+    vis_tree::get_sipm_index_main,
+    vis_tree::get_sipm_index_lat,
+    vis_tree::get_sipm_index_lat
   };
 
-  std::vector<std::function<int(const int&, const int&)>> tile_mapper = {
-    get_tile_index_main,
-    get_tile_index_lat,
-    get_tile_index_lat
-  };
-
-  auto get_anode_idx = [](const Int_t& tpc_id) {
-    if (tpc_id == 11) return 0;
-    else if (tpc_id == 12) return 1;
-    else if (tpc_id == 13) return 2;
-    else return -1;
+  Long64_t current_entry = 0;
+  auto fill_point = [&]() {
+    printf("[%lld] Reset variables and fill tree...\n", current_entry);
+    printf("       %u events per point\n", counts->n_events_per_point);
+    if (raw_counts == false) {
+      // apply proper visibility scaling
+      vis->Normalise(*counts);
+      vis->Quantise();
+    }
+    plib->Fill();
   };
 
-  while (reader.Next()) {
-    // 1. Access generator information
-    const auto& genRecord = genRecords->GetRecordsVector().at(0);
-    const auto& genStatus = genRecord.GetGenStatus();
-
-    if (genStatus.at(0) != coords[0] || 
-        genStatus.at(1) != coords[1] ||
-        genStatus.at(2) != coords[2]
+  bool first_point = true;
+  auto begin_event = [&](const float* point) {
+    if (first_point ||
+        point[0] != counts->coords[0] ||
+        point[1] != counts->coords[1] ||
+        point[2] != counts->coords[2]
        )
     {
-      // Point is new. 
-      // check if reader is at the first TTree entry 
-      if (reader.GetCurrentEntry() != 0) {
-        printf("[%lld] Reset variables and fill tree...\n", reader.GetCurrentEntry()); 
-        printf("       %u events per point\n", n_events_per_point); 
-        // apply proper visibility scaling 
-        const float scaling = (n_events_per_point * num_photons);
-        vis_tot /= scaling; 
-        vis_dir /= scaling; 
-        vis_wls /= scaling; 
-
-        for (size_t itile=0; itile < NTILE_LAT; itile++) {
-          vis_tot_tile_lat0[itile] /= scaling; 
-          vis_dir_tile_lat0[itile] /= scaling;
-          vis_wls_tile_lat0[itile] /= scaling; 
-        }
+      // Point is new. Fill the tree with the previous one
+      if (first_point == false) fill_point();
+
+      // set the new coordinates and reset the counters
+      counts->coords[0] = point[0];
+      counts->coords[1] = point[1];
+      counts->coords[2] = point[2];
+      counts->Reset();
+      first_point = false;
+    }
 
-        for (size_t itile=0; itile < NTILE_LAT; itile++) {
-          vis_tot_tile_lat1[itile] /= scaling; 
-          vis_dir_tile_lat1[itile] /= scaling;
-          vis_wls_tile_lat1[itile] /= scaling; 
-        }
+    counts->n_events_per_point++;
+  };
 
-        for (size_t itile=0; itile < NTILE_MAIN; itile++) {
-          vis_tot_tile_main[itile] /= scaling; 
-          vis_dir_tile_main[itile] /= scaling;
-          vis_wls_tile_main[itile] /= scaling; 
-        }
+  /**
+   * Process the entries [first, last) of an input (last < 0: up to the
+   * last readable entry). The accumulators of the current point are kept
+   * across calls, so a point can span several files or increments.
+   * Returns the first entry not processed, -1 if the input is not usable.
+   */
+  auto process_input = [&](TFile* input_file, const Long64_t& first, const Long64_t& last) -> Long64_t {
+    // a make_hit_skim output is read directly, without the SoLAr-sim event classes
+    TTree* tree_skim = input_file->Get<TTree>(vis_tree::SKIM_TREE);
+
+    if (tree_skim) {
+      auto ev = std::make_unique<vis_tree::HitSkimEvent>();
+      if (ev->SetAddresses(tree_skim) == false && with_timing) {
+        fprintf(stderr, "make_vis_tree ERROR: no hit times in skim %s (re-run make_hit_skim)\n",
+            input_file->GetName());
+        return -1;
+      }
+      const Long64_t n_entries = tree_skim->GetEntries();
+      const Long64_t end_entry = (last < 0 || last > n_entries) ? n_entries : last;
 
-        for (size_t isipm=0; isipm < NSIPM_MAIN; isipm++) {
-          vis_sipm_main[isipm] /= scaling;
-        }
+      for (current_entry = first; current_entry < end_entry; current_entry++) {
+        tree_skim->GetEntry(current_entry);
+        begin_event(ev->coords);
 
-        for (size_t isipm=0; isipm < NSIPM_LAT; isipm++) {
-          vis_sipm_lat0[isipm] /= scaling;
+        for (int i = 0; i < ev->n_sipm; i++) {
+          int nHitsPerProc[vis_tree::N_PROC];
+          std::copy(ev->hit_counts[i], ev->hit_counts[i] + vis_tree::N_PROC, nHitsPerProc);
+          counts->AddSiPMHits(ev->sipm_anode[i], ev->sipm_idx[i], nHitsPerProc);
         }
-
-        for (size_t isipm=0; isipm < NSIPM_LAT; isipm++) {
-          vis_sipm_lat1[isipm] /= scaling;
+        if (with_timing) {
+          for (int i = 0; i < ev->n_tbin; i++) {
+            const int isipm = ev->tbin_sipm[i];
+            counts->AddHitTimeBin(ev->sipm_anode[isipm], ev->sipm_idx[isipm], ev->tbin[i], ev->tbin_hits[i]);
+          }
         }
-
-        // Fill the output tree
-        plib->Fill();
       }
-
-      // set the new coordinates
-      coords[0] = genStatus.at(0);
-      coords[1] = genStatus.at(1); 
-      coords[2] = genStatus.at(2); 
-
-      // Reset variables
-      n_events_per_point = 0;
-      vis_tot = 0.0; 
-      vis_dir = 0.0; 
-      vis_wls = 0.0; 
-      std::memset(vis_sipm_main, 0.0, NSIPM_MAIN);
-      std::memset(vis_sipm_lat0, 0.0, NSIPM_LAT );
-      std::memset(vis_sipm_lat1, 0.0, NSIPM_LAT );
-
-      std::memset(vis_tot_tile_main, 0.0, NTILE_MAIN);
-      std::memset(vis_tot_tile_lat0, 0.0, NTILE_LAT );
-      std::memset(vis_tot_tile_lat1, 0.0, NTILE_LAT );
-
-      std::memset(vis_dir_tile_main, 0.0, NTILE_MAIN);
-      std::memset(vis_dir_tile_lat0, 0.0, NTILE_LAT );
-      std::memset(vis_dir_tile_lat1, 0.0, NTILE_LAT );
-
-      std::memset(vis_wls_tile_main, 0.0, NTILE_MAIN);
-      std::memset(vis_wls_tile_lat0, 0.0, NTILE_LAT );
-      std::memset(vis_wls_tile_lat1, 0.0, NTILE_LAT );
+      return std::max(first, end_entry);
     }
-
-    n_events_per_point++;
-
-    // 3. Process anode events (skip the top TPC)
-    for (const auto& evAnode_itr : evAnodeList->GetConstAnodeMap()) {
-      if (evAnode_itr.first == 10) continue; // Skip top TPC
-
-      //printf("---------------------------------------------------------------------------\n");
-      //printf("Processing Anode %i\n", evAnode_itr.first);
-
-      const int anode_idx = get_anode_idx( evAnode_itr.first ); 
-
-      for (const auto& evMT_itr : evAnode_itr.second.GetConstMegaTilesMap()) {
-        //printf("  MegaTile %i\n", evMT_itr.first);
-
-        for (const auto& evT_itr : evMT_itr.second.GetConstTileMap()) {
-          //printf("    Tile %i\n", evT_itr.first);
-          const int tile_idx = tile_mapper[anode_idx](evMT_itr.first, evT_itr.first);
-          auto& vtot_tile = vis_tot_tile[anode_idx][tile_idx];
-          auto& vdir_tile = vis_dir_tile[anode_idx][tile_idx];
-          auto& vwls_tile = vis_wls_tile[anode_idx][tile_idx];
-        
-          for (const auto& evSiPM_itr : evT_itr.second.GetConstSiPMEvents()) {
-            //printf("      SiPM %i: %i hits\n", evSiPM_itr.first, evSiPM_itr.second.GetNhits());
-
-            const int sipm_idx = 
-              sipm_mapper[anode_idx](evMT_itr.first, evT_itr.first, evSiPM_itr.first);
-          
-            const auto& evSiPM = evSiPM_itr.second;
-            const auto& backtrackerColl = evSiPM.GetBacktrackerRecordCollection(); 
-            int nHitsPerProc[6] = {0, 0, 0, 0, 0, 0};
-
-            for (const auto& hit : evSiPM.GetConstHits()) {
-              const auto& backtrackers = backtrackerColl.at(hit.first);
-              const auto& bktrkProc = backtrackers.GetConstRecords().at(0); 
-              for (const auto& proc : bktrkProc.GetConstCounter()) {
-                nHitsPerProc[proc.first] += proc.second;
+    else {
+      TTree* tree_event = input_file->Get<TTree>("EventTree");
+      TTree* tree_gen = input_file->Get<TTree>("GenTree");
+      if (tree_event == nullptr || tree_gen == nullptr) {
+        fprintf(stderr, "make_vis_tree ERROR: No EventTree/GenTree in %s\n", input_file->GetName());
+        return -1;
+      }
+      // a growing file can hold more saved entries in one of the two trees
+      const Long64_t n_entries = std::min(tree_event->GetEntries(), tree_gen->GetEntries());
+      const Long64_t end_entry = (last < 0 || last > n_entries) ? n_entries : last;
+      if (first >= end_entry) return first;
+      tree_event->AddFriend(tree_gen, "GenTree");
+
+      TTreeReader reader(tree_event);
+      TTreeReaderValue<SLArListEventAnode> evAnodeList(reader, "EventAnode");
+      TTreeReaderValue<SLArGenRecordsVector> genRecords(reader, "GenTree.GenRecords");
+      reader.SetEntriesRange(first, end_entry);
+
+      while (reader.Next()) {
+        current_entry = reader.GetCurrentEntry();
+
+        // 1. Access generator information
+        const auto& genRecord = genRecords->GetRecordsVector().at(0);
+        const auto& genStatus = genRecord.GetGenStatus();
+        const float point[3] = {
+          static_cast<float>(genStatus.at(0)),
+          static_cast<float>(genStatus.at(1)),
+          static_cast<float>(genStatus.at(2))
+        };
+
+        // 2. Start a new point if the source position changed
+        begin_event(point);
+
+        // 3. Process anode events (skip the top TPC)
+        for (const auto& evAnode_itr : evAnodeList->GetConstAnodeMap()) {
+          if (evAnode_itr.first == 10) continue; // Skip top TPC
+
+          const int anode_idx = vis_tree::get_anode_idx( evAnode_itr.first );
+
+          for (const auto& evMT_itr : evAnode_itr.second.GetConstMegaTilesMap()) {
+            for (const auto& evT_itr : evMT_itr.second.GetConstTileMap()) {
+              for (const auto& evSiPM_itr : evT_itr.second.GetConstSiPMEvents()) {
+                const int sipm_idx =
+                  sipm_mapper[anode_idx](evMT_itr.first, evT_itr.first, evSiPM_itr.first);
+
+                const auto& evSiPM = evSiPM_itr.second;
+                const auto& backtrackerColl = evSiPM.GetBacktrackerRecordCollection();
+                const double clock_unit = evSiPM.GetClockUnit();
+                int nHitsPerProc[6] = {0, 0, 0, 0, 0, 0};
+
+                for (const auto& hit : evSiPM.GetConstHits()) {
+                  const auto& backtrackers = backtrackerColl.at(hit.first);
+                  const auto& bktrkProc = backtrackers.GetConstRecords().at(0);
+                  for (const auto& proc : bktrkProc.GetConstCounter()) {
+                    nHitsPerProc[proc.first] += proc.second;
+                  }
+                  // hits are keyed on their time in clock units
+                  if (with_timing) {
+                    counts->AddHitTime(anode_idx, sipm_idx, hit.first*clock_unit, hit.second);
+                  }
+                }
+
+                nHitsPerProc[0] = evSiPM.GetNhits();
+                counts->AddSiPMHits(anode_idx, sipm_idx, nHitsPerProc);
               }
             }
-
-            nHitsPerProc[0] = evSiPM.GetNhits();
-            vis_tot += nHitsPerProc[0];
-            vis_dir += nHitsPerProc[4];
-            vis_wls += nHitsPerProc[3];
-            vtot_tile += nHitsPerProc[0];
-            vdir_tile += nHitsPerProc[4];
-            vwls_tile += nHitsPerProc[3];
-            vis_sipm[anode_idx][sipm_idx] += nHitsPerProc[0];
           }
         }
       }
+      return end_entry;
     }
-  }
-
-  // close the last point
-  const float scaling = (n_events_per_point * num_photons);
-  vis_tot /= scaling; 
-  vis_dir /= scaling; 
-  vis_wls /= scaling; 
-
-  for (UInt_t itile=0; itile < NTILE_LAT; itile++) {
-    vis_tot_tile_lat0[itile] /= scaling; 
-    vis_dir_tile_lat0[itile] /= scaling;
-    vis_wls_tile_lat0[itile] /= scaling; 
-  }
-
-  for (UInt_t itile=0; itile < NTILE_LAT; itile++) {
-    vis_tot_tile_lat1[itile] /= scaling; 
-    vis_dir_tile_lat1[itile] /= scaling;
-    vis_wls_tile_lat1[itile] /= scaling; 
-  }
-
-  for (UInt_t itile=0; itile < NTILE_MAIN; itile++) {
-    vis_tot_tile_main[itile] /= scaling; 
-    vis_dir_tile_main[itile] /= scaling;
-    vis_wls_tile_main[itile] /= scaling; 
-  }
+  };
 
-  for (UInt_t isipm=0; isipm < NSIPM_MAIN; isipm++) {
-    vis_sipm_main[isipm] /= scaling;
+  if (follow == false) {
+    TFile* input_file = TFile::Open(input_file_path);
+    if (input_file == nullptr || input_file->IsZombie()) {
+      fprintf(stderr, "make_photonlibrary ERROR: Unable to open input file %s\b",
+          input_file_path.Data());
+      exit(EXIT_FAILURE);
+    }
+    if (process_input(input_file, first_entry, last_entry) < 0) exit(EXIT_FAILURE);
+    input_file->Close();
+    delete input_file;
   }
+  else {
+    /**
+     * Follow mode: the input is a growing file, reopened at every poll to
+     * pick up the entries saved since (AutoSave by the writer), or a
+     * directory where finished .root files appear (written under another
+     * name and renamed when complete), processed once each in name order.
+     * The completed points are saved to the output after every increment.
+     * Stops at the <input>.done marker or after idle_timeout seconds
+     * without new entries.
+     */
+    FileStat_t input_stat;
+    const bool input_is_dir = (gSystem->GetPathInfo(input_file_path, input_stat) == 0) &&
+      R_ISDIR(input_stat.fMode);
+    const TString done_marker = input_file_path + ".done";
+    std::map<TString, Long64_t> progress;
+    std::set<TString> finished;
+    double idle = 0;
+    printf("make_vis_tree: following %s %s (poll %g s, stop at %s or after %g s idle)\n",
+        input_is_dir ? "directory" : "file", input_file_path.Data(),
+        poll_interval, done_marker.Data(), idle_timeout);
+
+    while (true) {
+      const bool stop = (gSystem->AccessPathName(done_marker) == false);
+
+      std::vector<TString> inputs;
+      if (input_is_dir) {
+        void* dir = gSystem->OpenDirectory(input_file_path);
+        const char* entry = nullptr;
+        while ( dir && (entry = gSystem->GetDirEntry(dir)) ) {
+          const TString name = entry;
+          if (name.EndsWith(".root") && finished.count(name) == 0) inputs.push_back(name);
+        }
+        if (dir) gSystem->FreeDirectory(dir);
+        std::sort(inputs.begin(), inputs.end());
+      }
+      else {
+        inputs.push_back(input_file_path);
+      }
 
-  for (UInt_t isipm=0; isipm < NSIPM_LAT; isipm++) {
-    vis_sipm_lat0[isipm] /= scaling;
-  }
+      Long64_t n_new = 0;
+      for (const auto& name : inputs) {
+        const TString path = input_is_dir ? input_file_path + "/" + name : name;
+        if (gSystem->AccessPathName(path)) continue;  // not created yet
+        TFile* input_file = TFile::Open(path);
+        if (input_file == nullptr || input_file->IsZombie()) {
+          delete input_file;
+          continue;  // not readable yet
+        }
+        const Long64_t done = progress[name];
+        const Long64_t end = process_input(input_file, done, -1);
+        input_file->Close();
+        delete input_file;
+        if (end < 0) continue;
+        n_new += end - done;
+        progress[name] = end;
+        if (input_is_dir) {
+          finished.insert(name);
+          printf("make_vis_tree: %s done (%lld entries)\n", name.Data(), end);
+        }
+      }
 
-  for (UInt_t isipm=0; isipm < NSIPM_LAT; isipm++) {
-    vis_sipm_lat1[isipm] /= scaling;
+      if (n_new > 0) {
+        plib->AutoSave("SaveSelf");
+        printf("make_vis_tree: +%lld entries, %lld points saved\n", n_new, plib->GetEntries());
+        idle = 0;
+      }
+      else {
+        idle += poll_interval;
+      }
+      if (stop || idle >= idle_timeout) break;
+      gSystem->Sleep( UInt_t(poll_interval*1000) );
+    }
   }
 
-  // Fill the output tree
-  plib->Fill();
-
+  // close the last point
+  if (first_point == false) fill_point();
 
   output_file->cd();
-  plib->Write(); 
+  plib->Write();
   output_file->Close();
 
+  if (raw_counts == false && vis->IsQuantised()) vis->PrintQuantReport();
+
   return 0;
 }
 
 void print_usage() {
-  printf("make_vis_tree usage:\n"); 
-  printf("\t-i | --input\tinput_file_path\n"); 
-  printf("\t-o | --output\toutput_file_path (optional)\n"); 
+  printf("make_vis_tree usage:\n");
+  printf("\t-i | --input\tinput_file_path (SoLAr-sim output or make_hit_skim output)\n");
+  printf("\t-o | --output\toutput_file_path (optional)\n");
+  printf("\t-q | --quantise\t<branch wildcard>=<float|f16:nbits|f16:xmin:xmax:nbits|log:nbits:vmin:vmax>\n");
+  printf("\t             \tquantised storage of the tile/SiPM arrays (repeatable, last match wins)\n");
+  printf("\t-r | --raw\tstore raw hit counts and events per point (photonLibCounts tree)\n");
+  printf("\t-f | --first-entry\tfirst EventTree entry to process (default: 0)\n");
+  printf("\t-n | --num-entries\tnumber of EventTree entries to process (default: all)\n");
+  printf("\t-t | --timing\taccumulate the tile arrival-time profiles\n");
+  printf("\t-z | --compression\t[<branch wildcard>=]<zlib|lzma|lz4|zstd>:<level> | none\n");
+  printf("\t             \tper-branch codec (repeatable, last match wins, no wildcard: file default)\n");
+  printf("\t-F | --follow\tfollow a growing input file or a directory of input files\n");
+  printf("\t             \t(stops at <input>.done or when idle, the output is saved at every increment)\n");
+  printf("\t-p | --poll\tpolling interval in seconds in follow mode (default: 10)\n");
+  printf("\t-T | --idle-timeout\tstop following after this many seconds without new entries (default: 600)\n");
 
   return;
 }
 
 int main (int argc, char *argv[]) {
-  const char* short_opts = "i:o:h";
-  static struct option long_opts[4] = 
+  const char* short_opts = "i:o:q:rf:n:tz:Fp:T:h";
+  static struct option long_opts[13] =
   {
-    {"input", required_argument, 0, 'i'}, 
-    {"output", required_argument, 0, 'o'}, 
-    {"help", no_argument, 0, 'h'}, 
+    {"input", required_argument, 0, 'i'},
+    {"output", required_argument, 0, 'o'},
+    {"quantise", required_argument, 0, 'q'},
+    {"raw", no_argument, 0, 'r'},
+    {"first-entry", required_argument, 0, 'f'},
+    {"num-entries", required_argument, 0, 'n'},
+    {"timing", no_argument, 0, 't'},
+    {"compression", required_argument, 0, 'z'},
+    {"follow", no_argument, 0, 'F'},
+    {"poll", required_argument, 0, 'p'},
+    {"idle-timeout", required_argument, 0, 'T'},
+    {"help", no_argument, 0, 'h'},
     {nullptr, no_argument, nullptr, 0}
   };
 
-  int c, option_index; 
+  int c, option_index;
 
-  TString input_file_path = ""; 
-  TString output_file_path = ""; 
+  TString input_file_path = "";
+  TString output_file_path = "";
+  vis_quant::QuantPolicy quant_policy;
+  bool raw_counts = false;
+  Long64_t first_entry = 0;
+  Long64_t num_entries = -1;
+  bool with_timing = false;
+  vis_compress::CompressionPolicy compression_policy;
+  bool follow = false;
+  double poll_interval = 10.0;
+  double idle_timeout = 600.0;
 
   while ( (c = getopt_long(argc, argv, short_opts, long_opts, &option_index)) != -1) {
     switch(c) {
@@ -367,21 +385,67 @@ int main (int argc, char *argv[]) {
       case 'o' :
         output_file_path = optarg;
         break;
-      case 'h' : 
-        print_usage(); 
-        exit( EXIT_SUCCESS ); 
+      case 'q' :
+        if (quant_policy.AddRule(optarg) == false) {
+          printf("make_vis_tree error: invalid quantisation rule %s\n", optarg);
+          print_usage();
+          exit( EXIT_FAILURE );
+        }
+        break;
+      case 'r' :
+        raw_counts = true;
+        break;
+      case 'f' :
+        first_entry = std::atoll(optarg);
+        break;
+      case 'n' :
+        num_entries = std::atoll(optarg);
+        break;
+      case 't' :
+        with_timing = true;
+        break;
+      case 'z' :
+        if (compression_policy.AddRule(optarg) == false) {
+          printf("make_vis_tree error: invalid compression rule %s\n", optarg);
+          print_usage();
+          exit( EXIT_FAILURE );
+        }
+        break;
+      case 'F' :
+        follow = true;
+        break;
+      case 'p' :
+        poll_interval = std::max(0.1, std::atof(optarg));
+        break;
+      case 'T' :
+        idle_timeout = std::atof(optarg);
+        break;
+      case 'h' :
+        print_usage();
+        exit( EXIT_SUCCESS );
         break;
-      case '?' : 
+      case '?' :
         printf("make_vis_tree error: unknown flag %c\n", optopt);
-        print_usage(); 
-        exit( EXIT_FAILURE ); 
+        print_usage();
+        exit( EXIT_FAILURE );
         break;
     }
   }
   printf("Monte Carlo input file: %s\n", input_file_path.Data());
   printf("vis tree output file: %s\n", output_file_path.Data());
+  if (raw_counts && quant_policy.IsEmpty() == false) {
+    printf("make_vis_tree warning: quantisation rules are ignored in raw count mode\n");
+  }
+  if (compression_policy.HasShuffle()) {
+    printf("make_vis_tree warning: byte shuffle is applied by make_vis_map only, ignored\n");
+  }
+  if (follow && (first_entry > 0 || num_entries >= 0)) {
+    printf("make_vis_tree warning: the entry range is ignored in follow mode\n");
+  }
+
+  make_vis_tree(input_file_path, output_file_path, quant_policy,
+      raw_counts, first_entry, num_entries, with_timing, compression_policy,
+      follow, poll_interval, idle_timeout);
 
-  make_vis_tree(input_file_path, output_file_path);
- 
   return 0;
 }
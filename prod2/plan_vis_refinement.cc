@@ -0,0 +1,413 @@
+/**
+ * @file        : plan_vis_refinement.cc
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <array>
+#include <set>
+#include <vector>
+#include <algorithm>
+#include <getopt.h>
+
+#include "vis_tree_io.hh"
+#include "vis_library.hh"
+
+/**
+ * Adaptive refinement planner for the source-point grid.
+ *
+ * For every grid node and axis, with h- and h+ the distances to its two
+ * neighbours, the error made by dropping the node and interpolating
+ * linearly between the neighbours is
+ *
+ *    e_drop = |w- v(i-1) + w+ v(i+1) - v(i)|,  w- = h+/(h- + h+), w+ = h-/(h- + h+)
+ *
+ * i.e. h- h+ f''/2, and the error of linear interpolation at the mid-point
+ * of a cell of width h is e_mid = h^2 f''/8 (e_drop/4 on a uniform grid).
+ * Both are evaluated for every channel of the selected groups, reduced by
+ * n_sigma times the statistical fluctuation of the difference (each point
+ * has the Poisson error of n_events_per_point * N_photons emitted photons)
+ * and compared with the tolerance rel_tol * max(v, floor), the floor being
+ * a fraction of the channel maximum so that the dark regions of a channel
+ * do not drive the plan. The worst channel sets the score of the node.
+ * The axes need not be uniform, so a refined library can be planned again.
+ *
+ *  - a grid cell is refined (split in 2x2x2, 19 new points) if one of its
+ *    corners has e_mid above tolerance along any axis;
+ *  - a node with odd index along some axes is dropped if the sum of its
+ *    e_drop scores along those axes is below tolerance and none of the
+ *    cells around it is refined. Nodes on the grid boundary are always kept.
+ *
+ * The plan is written as a CSV with the full point set (keep, add, drop)
+ * and as SQL inserting the new points in the job table and setting the
+ * status of the dropped ones, so that export_filemap.sql (status 'done')
+ * leaves them out of the next library.
+ *
+ * The refined point set is not a regular grid: VisLibrary::Locate (and
+ * the consumers based on it) falls back to the closest existing point,
+ * while make_vis_octree requires a uniform grid and rejects it.
+ */
+
+// Coordinate tolerance (mm) matching the dropped points in the job table
+const double SQL_COORD_TOL = 1e-3;
+
+typedef std::array<float, 3> PointKey;
+
+int plan_vis_refinement(
+    const TString& library_path,
+    const TString& output_prefix,
+    const unsigned& group_mask,
+    const double& rel_tol,
+    const double& floor_frac,
+    const double& n_sigma,
+    const TString& job_table,
+    const TString& job_status,
+    const TString& drop_status)
+{
+  vis_tree::VisLibrary vislib;
+  if (vislib.Load(library_path, group_mask) == false) return 1;
+
+  std::vector<int> groups;
+  for (int ig = 0; ig < vis_tree::N_GROUP; ig++) {
+    if (ig != vis_tree::kGroupTileTime && vislib.HasGroup(ig)) groups.push_back(ig);
+  }
+
+  // visibility floor of each channel
+  const size_t n_points = vislib.GetNPoints();
+  std::vector<std::vector<float>> vis_floor;
+  for (const auto& ig : groups) {
+    const int nch = vis_tree::get_group_size(ig);
+    std::vector<float> vmax(nch, 0.0);
+    for (size_t ip = 0; ip < n_points; ip++) {
+      const float* v = vislib.Get(ig, ip);
+      for (int c = 0; c < nch; c++) vmax[c] = std::max(vmax[c], v[c]);
+    }
+    for (auto& f : vmax) f *= floor_frac;
+    vis_floor.push_back(vmax);
+  }
+
+  // photons emitted from each point
+  if (vislib.HasEventCounts() == false) {
+    printf("plan_vis_refinement WARNING: no n_events_per_point in %s, assuming 1 event per point\n",
+        library_path.Data());
+  }
+  auto n_emitted = [&vislib](const Long64_t& ip) {
+    return std::max(1u, vislib.GetNEvents(ip)) * double(vis_tree::NUM_PHOTONS);
+  };
+
+  // normalised drop error of node ic between im and ip (worst channel),
+  // wm and wp the linear interpolation weights of the neighbours
+  auto drop_score = [&](const Long64_t& im, const Long64_t& ic, const Long64_t& ip,
+      const double& wm, const double& wp) {
+    const double nm = n_emitted(im), nc = n_emitted(ic), np = n_emitted(ip);
+    double score = 0;
+    for (size_t g = 0; g < groups.size(); g++) {
+      const int nch = vis_tree::get_group_size(groups[g]);
+      const float* vm = vislib.Get(groups[g], im);
+      const float* vc = vislib.Get(groups[g], ic);
+      const float* vp = vislib.Get(groups[g], ip);
+      const float* fl = vis_floor[g].data();
+      for (int c = 0; c < nch; c++) {
+        const double vref = std::max(vc[c], fl[c]);
+        if (vref <= 0) continue;
+        const double err = std::fabs(wm*vm[c] + wp*vp[c] - vc[c]);
+        const double var = wm*wm*std::max(vm[c], fl[c]) / nm + vref / nc
+          + wp*wp*std::max(vp[c], fl[c]) / np;
+        const double noise = n_sigma*std::sqrt(var);
+        score = std::max(score, (err - noise) / (rel_tol*vref));
+      }
+    }
+    return score;
+  };
+
+  const std::vector<float>* axis[3] = {&vislib.GetAxis(0), &vislib.GetAxis(1), &vislib.GetAxis(2)};
+  const int n[3] = {(int)axis[0]->size(), (int)axis[1]->size(), (int)axis[2]->size()};
+  auto node_index = [&n](const int* i) {return (size_t(i[0])*n[1] + i[1])*n[2] + i[2];};
+  auto locate = [&vislib](const int* i) {return vislib.FindNode(i);};
+  if (vislib.IsUniform() == false) {
+    printf("plan_vis_refinement: non-uniform grid axes, %zu nodes without point\n",
+        vislib.GetNMissingNodes());
+  }
+
+  // 1. Drop scores of the nodes along each axis (-1 when not available), and
+  //    the scores per unit of h-*h+/2 (curvature) to scale e_mid to a cell
+  const size_t n_nodes = size_t(n[0])*n[1]*n[2];
+  std::vector<float> score(3*n_nodes, -1.0);
+  std::vector<float> curvature(3*n_nodes, -1.0);
+  int i[3];
+  for (i[0] = 0; i[0] < n[0]; i[0]++) {
+    for (i[1] = 0; i[1] < n[1]; i[1]++) {
+      for (i[2] = 0; i[2] < n[2]; i[2]++) {
+        const Long64_t ic = locate(i);
+        if (ic < 0) continue;
+        for (int k = 0; k < 3; k++) {
+          if (i[k] == 0 || i[k] == n[k]-1) continue;
+          int im[3] = {i[0], i[1], i[2]}; im[k]--;
+          int ip[3] = {i[0], i[1], i[2]}; ip[k]++;
+          const Long64_t pm = locate(im);
+          const Long64_t pp = locate(ip);
+          if (pm < 0 || pp < 0) continue;
+          const double hm = (*axis[k])[i[k]] - (*axis[k])[i[k]-1];
+          const double hp = (*axis[k])[i[k]+1] - (*axis[k])[i[k]];
+          const double s = drop_score(pm, ic, pp, hp/(hm + hp), hm/(hm + hp));
+          score[3*node_index(i)+k] = s;
+          curvature[3*node_index(i)+k] = 2*s / (hm*hp);
+        }
+      }
+    }
+  }
+  // boundary nodes take the score of their inner neighbour
+  for (i[0] = 0; i[0] < n[0]; i[0]++) {
+    for (i[1] = 0; i[1] < n[1]; i[1]++) {
+      for (i[2] = 0; i[2] < n[2]; i[2]++) {
+        for (int k = 0; k < 3; k++) {
+          if (n[k] < 3 || (i[k] != 0 && i[k] != n[k]-1)) continue;
+          int in[3] = {i[0], i[1], i[2]};
+          in[k] = (i[k] == 0) ? 1 : n[k]-2;
+          score[3*node_index(i)+k] = score[3*node_index(in)+k];
+          curvature[3*node_index(i)+k] = curvature[3*node_index(in)+k];
+        }
+      }
+    }
+  }
+
+  // 2. Cells to refine, e_mid = h^2 f''/8 with the width h of the cell
+  auto needs_refinement = [&](const int* node, const int* cell) {
+    for (int k = 0; k < 3; k++) {
+      const double h = (*axis[k])[cell[k]+1] - (*axis[k])[cell[k]];
+      if (curvature[3*node_index(node)+k] * h*h / 8 > 1.0) return true;
+    }
+    return false;
+  };
+
+  std::set<PointKey> added;
+  std::vector<char> refined_cell(n_nodes, 0);
+  size_t n_cells = 0, n_refined = 0;
+  for (i[0] = 0; i[0] < n[0]-1; i[0]++) {
+    for (i[1] = 0; i[1] < n[1]-1; i[1]++) {
+      for (i[2] = 0; i[2] < n[2]-1; i[2]++) {
+        bool refine = false;
+        bool has_corner = false;
+        for (int corner = 0; corner < 8; corner++) {
+          const int c[3] = {i[0] + (corner & 1), i[1] + ((corner >> 1) & 1), i[2] + ((corner >> 2) & 1)};
+          if (locate(c) < 0) continue;
+          has_corner = true;
+          if (needs_refinement(c, i)) refine = true;
+        }
+        if (has_corner == false) continue;
+        n_cells++;
+        if (refine == false) continue;
+        n_refined++;
+        refined_cell[node_index(i)] = 1;
+        // 3x3x3 sub-grid of the cell minus its 8 corners
+        for (int sx = 0; sx < 3; sx++) {
+          for (int sy = 0; sy < 3; sy++) {
+            for (int sz = 0; sz < 3; sz++) {
+              if (sx != 1 && sy != 1 && sz != 1) continue;
+              const int s[3] = {sx, sy, sz};
+              PointKey p;
+              for (int k = 0; k < 3; k++) {
+                const float lo = (*axis[k])[i[k]];
+                const float hi = (*axis[k])[i[k]+1];
+                p[k] = (s[k] == 0) ? lo : (s[k] == 2) ? hi : 0.5f*(lo + hi);
+              }
+              added.insert(p);
+            }
+          }
+        }
+      }
+    }
+  }
+  // the corners of a cell are existing nodes, nothing else to remove
+
+  // 3. Nodes to drop
+  auto touches_refined_cell = [&](const int* node) {
+    for (int corner = 0; corner < 8; corner++) {
+      int c[3] = {node[0] - (corner & 1), node[1] - ((corner >> 1) & 1), node[2] - ((corner >> 2) & 1)};
+      bool valid = true;
+      for (int k = 0; k < 3; k++) if (c[k] < 0 || c[k] >= n[k]-1) valid = false;
+      if (valid && refined_cell[node_index(c)]) return true;
+    }
+    return false;
+  };
+
+  TString csv_path = output_prefix + "_points.csv";
+  TString sql_path = output_prefix + "_jobs.sql";
+  FILE* csv = fopen(csv_path.Data(), "w");
+  if (csv == nullptr) {
+    fprintf(stderr, "plan_vis_refinement ERROR: Unable to write %s\n", csv_path.Data());
+    return 1;
+  }
+  fprintf(csv, "x,y,z,action,score\n");
+
+  std::vector<PointKey> dropped;
+  size_t n_keep = 0;
+  for (i[0] = 0; i[0] < n[0]; i[0]++) {
+    for (i[1] = 0; i[1] < n[1]; i[1]++) {
+      for (i[2] = 0; i[2] < n[2]; i[2]++) {
+        const Long64_t ip = locate(i);
+        if (ip < 0) continue;
+        const float* xyz = vislib.GetCoords(ip);
+        // the boundary nodes carry the score of their inner neighbour and
+        // set the library extent, they are never dropped
+        bool on_boundary = false;
+        for (int k = 0; k < 3; k++) on_boundary |= (i[k] == 0 || i[k] == n[k]-1);
+        double drop = 0;
+        bool droppable = false;
+        for (int k = 0; k < 3 && on_boundary == false; k++) {
+          if (i[k] % 2 == 0) continue;
+          const float s = score[3*node_index(i)+k];
+          droppable = true;
+          drop += (s < 0) ? 1e9 : std::max(0.0f, s);
+        }
+        double node_score = 0;
+        for (int k = 0; k < 3; k++) node_score = std::max(node_score, (double)score[3*node_index(i)+k]);
+        const bool to_drop = droppable && drop < 1.0 && touches_refined_cell(i) == false;
+        if (to_drop) dropped.push_back( {xyz[0], xyz[1], xyz[2]} );
+        else n_keep++;
+        fprintf(csv, "%g,%g,%g,%s,%.3f\n", xyz[0], xyz[1], xyz[2], to_drop ? "drop" : "keep", node_score);
+      }
+    }
+  }
+  for (const auto& p : added) {
+    fprintf(csv, "%g,%g,%g,add,\n", p[0], p[1], p[2]);
+  }
+  fclose(csv);
+
+  FILE* sql = fopen(sql_path.Data(), "w");
+  if (sql == nullptr) {
+    fprintf(stderr, "plan_vis_refinement ERROR: Unable to write %s\n", sql_path.Data());
+    return 1;
+  }
+  fprintf(sql, "-- refinement plan of %s: %zu new source points, %zu dropped\n",
+      library_path.Data(), added.size(), dropped.size());
+  if (added.empty() == false || dropped.empty() == false) fprintf(sql, "BEGIN;\n");
+  if (added.empty() == false) {
+    fprintf(sql, "INSERT INTO %s (x, y, z, status) VALUES\n", job_table.Data());
+    size_t ia = 0;
+    for (const auto& p : added) {
+      fprintf(sql, "  (%.9g, %.9g, %.9g, '%s')%s\n", p[0], p[1], p[2], job_status.Data(),
+          (++ia < added.size()) ? "," : ";");
+    }
+  }
+  if (dropped.empty() == false) {
+    fprintf(sql, "UPDATE %s AS j SET status = '%s' FROM (VALUES\n", job_table.Data(), drop_status.Data());
+    for (size_t id = 0; id < dropped.size(); id++) {
+      const auto& p = dropped[id];
+      fprintf(sql, "  (%.9g, %.9g, %.9g)%s\n", p[0], p[1], p[2], (id+1 < dropped.size()) ? "," : "");
+    }
+    fprintf(sql, ") AS d (x, y, z)\n");
+    fprintf(sql, "WHERE abs(j.x - d.x) < %g AND abs(j.y - d.y) < %g AND abs(j.z - d.z) < %g;\n",
+        SQL_COORD_TOL, SQL_COORD_TOL, SQL_COORD_TOL);
+  }
+  if (added.empty() == false || dropped.empty() == false) fprintf(sql, "COMMIT;\n");
+  fclose(sql);
+
+  printf("plan_vis_refinement: %zu points on a %i x %i x %i grid, tolerance %g\n",
+      n_points, n[0], n[1], n[2], rel_tol);
+  printf("  cells refined : %zu / %zu\n", n_refined, n_cells);
+  printf("  points kept   : %zu\n", n_keep);
+  printf("  points added  : %zu\n", added.size());
+  printf("  points dropped: %zu\n", dropped.size());
+  printf("  new point set : %zu (%+.1f%%)\n", n_keep + added.size(),
+      100.0*(double(n_keep + added.size()) / n_points - 1.0));
+  printf("Output written to: %s, %s\n", csv_path.Data(), sql_path.Data());
+
+  return 0;
+}
+
+void print_usage() {
+  printf("plan_vis_refinement usage:\n");
+  printf("\t-i | --input\tmake_vis_map library file\n");
+  printf("\t-o | --output\toutput prefix (default: refine_plan)\n");
+  printf("\t-e | --tolerance\trelative interpolation tolerance (default: 0.02)\n");
+  printf("\t-f | --floor\tvisibility floor, fraction of the channel maximum (default: 1e-3)\n");
+  printf("\t-n | --n-sigma\tstatistical fluctuations subtracted from the error (default: 3)\n");
+  printf("\t-s | --sipm\tinclude the SiPM arrays in the error estimate\n");
+  printf("\t-t | --table\tjob table of the SQL output (default: protodune3_phbomb_2)\n");
+  printf("\t-S | --status\tstatus of the new jobs (default: new)\n");
+  printf("\t-D | --drop-status\tstatus set on the jobs of the dropped points (default: dropped)\n");
+
+  return;
+}
+
+int main (int argc, char *argv[]) {
+  const char* short_opts = "i:o:e:f:n:st:S:D:h";
+  static struct option long_opts[11] =
+  {
+    {"input", required_argument, 0, 'i'},
+    {"output", required_argument, 0, 'o'},
+    {"tolerance", required_argument, 0, 'e'},
+    {"floor", required_argument, 0, 'f'},
+    {"n-sigma", required_argument, 0, 'n'},
+    {"sipm", no_argument, 0, 's'},
+    {"table", required_argument, 0, 't'},
+    {"status", required_argument, 0, 'S'},
+    {"drop-status", required_argument, 0, 'D'},
+    {"help", no_argument, 0, 'h'},
+    {nullptr, no_argument, nullptr, 0}
+  };
+
+  int c, option_index;
+
+  TString library_path = "";
+  TString output_prefix = "refine_plan";
+  double rel_tol = 0.02;
+  double floor_frac = 1e-3;
+  double n_sigma = 3.0;
+  unsigned group_mask = (1u << vis_tree::kGroupVisTot) | (1u << vis_tree::kGroupTileTot);
+  TString job_table = "protodune3_phbomb_2";
+  TString job_status = "new";
+  TString drop_status = "dropped";
+
+  while ( (c = getopt_long(argc, argv, short_opts, long_opts, &option_index)) != -1) {
+    switch(c) {
+      case 'i' :
+        library_path = optarg;
+        break;
+      case 'o' :
+        output_prefix = optarg;
+        break;
+      case 'e' :
+        rel_tol = std::atof(optarg);
+        break;
+      case 'f' :
+        floor_frac = std::atof(optarg);
+        break;
+      case 'n' :
+        n_sigma = std::atof(optarg);
+        break;
+      case 's' :
+        group_mask |= (1u << vis_tree::kGroupSiPM);
+        break;
+      case 't' :
+        job_table = optarg;
+        break;
+      case 'S' :
+        job_status = optarg;
+        break;
+      case 'D' :
+        drop_status = optarg;
+        break;
+      case 'h' :
+        print_usage();
+        exit( EXIT_SUCCESS );
+        break;
+      case '?' :
+        printf("plan_vis_refinement error: unknown flag %c\n", optopt);
+        print_usage();
+        exit( EXIT_FAILURE );
+        break;
+    }
+  }
+
+  if (library_path.IsNull() || rel_tol <= 0) {
+    printf("plan_vis_refinement error: an input library and a positive tolerance are required\n");
+    print_usage();
+    exit( EXIT_FAILURE );
+  }
+
+  return plan_vis_refinement(library_path, output_prefix, group_mask,
+      rel_tol, floor_frac, n_sigma, job_table, job_status, drop_status);
+}
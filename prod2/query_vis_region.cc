@@ -0,0 +1,137 @@
+/**
+ * @file        : query_vis_region.cc
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <getopt.h>
+#include "TFile.h"
+#include "TTree.h"
+#include "TObjArray.h"
+#include "TObjString.h"
+
+#include "vis_quant.hh"
+#include "vis_compress.hh"
+#include "vis_tree_io.hh"
+#include "vis_spatial_index.hh"
+
+/**
+ * Extract the library points inside an axis-aligned box using the spatial
+ * index written by make_vis_map. Reports the clusters touched and the
+ * bytes read, and optionally writes the selected entries (all branches)
+ * to a region library with the same layout.
+ */
+
+bool parse_box(const TString& str, float* box) {
+  TObjArray* tokens = str.Tokenize(":");
+  const bool ok = (tokens->GetEntries() == 6);
+  for (int k = 0; ok && k < 6; k++) {
+    box[k] = ((TObjString*)tokens->At(k))->GetString().Atof();
+  }
+  delete tokens;
+  return ok && box[0] <= box[1] && box[2] <= box[3] && box[4] <= box[5];
+}
+
+int query_vis_region(const TString& input_file_path, const float* box,
+    const TString& output_file_path)
+{
+  vis_tree::VisRegionQuery query;
+  if (query.Open(input_file_path) == false) return 1;
+
+  const auto clusters = query.FindClusters(box);
+  const auto entries = query.Select(box);
+  printf("query_vis_region: box x [%g, %g], y [%g, %g], z [%g, %g] (%s order)\n",
+      box[0], box[1], box[2], box[3], box[4], box[5], vis_tree::CURVE_LABEL[query.GetOrder()]);
+  printf("  clusters : %zu / %zu\n", clusters.size(), query.GetClusters().size());
+  printf("  points   : %zu / %lld\n", entries.size(), query.GetTree()->GetEntries());
+  printf("  selection read %.3f MB of %.3f MB\n",
+      query.GetBytesRead() / 1048576.0, query.GetFileSize() / 1048576.0);
+
+  if (output_file_path.IsNull()) return 0;
+
+  TTree* lib = query.GetTree();
+  TFile* output_file = new TFile(output_file_path, "recreate");
+  TTree* region = lib->CloneTree(0);
+  region->SetDirectory(output_file);
+  for (TObject* obj : *region->GetListOfBranches()) {
+    const TString br_name = obj->GetName();
+    vis_quant::set_branch_spec(region, br_name, vis_quant::get_branch_spec(lib, br_name));
+    vis_compress::set_shuffled(region, br_name, vis_compress::is_shuffled(lib, br_name));
+  }
+  for (const auto& entry : entries) {
+    lib->GetEntry(entry);
+    region->Fill();
+  }
+  output_file->cd();
+  region->Write();
+  output_file->Close();
+  delete output_file;
+
+  printf("  region library read %.3f MB in total\n", query.GetBytesRead() / 1048576.0);
+  printf("Output written to: %s\n", output_file_path.Data());
+  return 0;
+}
+
+void print_usage() {
+  printf("query_vis_region usage:\n");
+  printf("\t-i | --input\tmake_vis_map library file\n");
+  printf("\t-b | --box\tregion xmin:xmax:ymin:ymax:zmin:zmax\n");
+  printf("\t-o | --output\twrite the selected points to a region library\n");
+
+  return;
+}
+
+int main (int argc, char *argv[]) {
+  const char* short_opts = "i:b:o:h";
+  static struct option long_opts[5] =
+  {
+    {"input", required_argument, 0, 'i'},
+    {"box", required_argument, 0, 'b'},
+    {"output", required_argument, 0, 'o'},
+    {"help", no_argument, 0, 'h'},
+    {nullptr, no_argument, nullptr, 0}
+  };
+
+  int c, option_index;
+
+  TString input_file_path = "";
+  TString output_file_path = "";
+  float box[6] = {0, 0, 0, 0, 0, 0};
+  bool has_box = false;
+
+  while ( (c = getopt_long(argc, argv, short_opts, long_opts, &option_index)) != -1) {
+    switch(c) {
+      case 'i' :
+        input_file_path = optarg;
+        break;
+      case 'b' :
+        has_box = parse_box(optarg, box);
+        if (has_box == false) {
+          printf("query_vis_region error: invalid box %s\n", optarg);
+          exit( EXIT_FAILURE );
+        }
+        break;
+      case 'o' :
+        output_file_path = optarg;
+        break;
+      case 'h' :
+        print_usage();
+        exit( EXIT_SUCCESS );
+        break;
+      case '?' :
+        printf("query_vis_region error: unknown flag %c\n", optopt);
+        print_usage();
+        exit( EXIT_FAILURE );
+        break;
+    }
+  }
+
+  if (input_file_path.IsNull() || has_box == false) {
+    printf("query_vis_region error: an input library and a box are required\n");
+    print_usage();
+    exit( EXIT_FAILURE );
+  }
+
+  return query_vis_region(input_file_path, box, output_file_path);
+}
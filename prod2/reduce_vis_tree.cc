@@ -0,0 +1,355 @@
+/**
+ * @file        : reduce_vis_tree.cc
+ */
+
+#include <iostream>
+#include <getopt.h>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <array>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include "TROOT.h"
+#include "TFile.h"
+#include "TTree.h"
+
+#include "vis_quant.hh"
+#include "vis_tree_io.hh"
+
+/**
+ * Sum the raw hit counts of make_vis_tree shards (`--raw` mode) and write
+ * the normalised photon library. Shards are matched on the x/y/z of the
+ * source point, so a point split across input slices or files is
+ * recombined exactly before the normalisation.
+ *
+ * The points are reduced in blocks of consecutive points (x, y, z order),
+ * only the accumulators of the current block are kept in memory. Each
+ * block is split across the workers by point, and every worker keeps a
+ * bounded number of shards open, read forward in point order.
+ */
+
+typedef std::array<float, 3> PointKey;
+
+// Entry of a shard and the index of its source point
+struct ShardEntry {
+  size_t ipoint;
+  Long64_t entry;
+};
+
+int reduce_vis_tree(
+    const std::vector<TString>& shard_paths,
+    const TString& output_file_path,
+    const vis_quant::QuantPolicy& quant_policy,
+    const int& num_threads,
+    const size_t& block_points)
+{
+  ROOT::EnableThreadSafety();
+
+  // 1. Build the list of points from the coordinates of all shards.
+  //    The std::map keeps the x, y, z ordering of export_filemap.sql
+  std::map<PointKey, size_t> point_map;
+  std::vector<std::vector<PointKey>> shard_keys(shard_paths.size());
+  bool has_timing = true;
+  for (size_t ishard = 0; ishard < shard_paths.size(); ishard++) {
+    const TString& path = shard_paths[ishard];
+    TFile* shard = TFile::Open(path);
+    if (shard == nullptr || shard->IsZombie()) {
+      fprintf(stderr, "reduce_vis_tree ERROR: Unable to open shard %s\n", path.Data());
+      return 1;
+    }
+    TTree* tree = shard->Get<TTree>(vis_tree::COUNTS_TREE);
+    if (tree == nullptr) {
+      fprintf(stderr, "reduce_vis_tree ERROR: No %s tree in %s (not a --raw output?)\n",
+          vis_tree::COUNTS_TREE, path.Data());
+      return 1;
+    }
+    if (tree->GetBranch("t_hist_tile_main") == nullptr) has_timing = false;
+    PointKey key = {0, 0, 0};
+    tree->SetBranchStatus("*", 0);
+    tree->SetBranchStatus("x", 1);
+    tree->SetBranchStatus("y", 1);
+    tree->SetBranchStatus("z", 1);
+    tree->SetBranchAddress("x", &key[0]);
+    tree->SetBranchAddress("y", &key[1]);
+    tree->SetBranchAddress("z", &key[2]);
+    shard_keys[ishard].reserve(tree->GetEntries());
+    for (Long64_t i = 0; i < tree->GetEntries(); i++) {
+      tree->GetEntry(i);
+      point_map.emplace(key, 0);
+      shard_keys[ishard].push_back(key);
+    }
+    shard->Close();
+    delete shard;
+  }
+
+  std::vector<PointKey> point_coords;
+  point_coords.reserve(point_map.size());
+  for (auto& p : point_map) {
+    p.second = point_coords.size();
+    point_coords.push_back(p.first);
+  }
+  const size_t n_points = point_coords.size();
+  printf("reduce_vis_tree: %zu shards, %zu source points\n", shard_paths.size(), n_points);
+
+  // entries of each shard in point order (a no-op for ordered shards)
+  std::vector<std::vector<ShardEntry>> shard_entries(shard_paths.size());
+  for (size_t ishard = 0; ishard < shard_paths.size(); ishard++) {
+    auto& entries = shard_entries[ishard];
+    entries.reserve(shard_keys[ishard].size());
+    for (size_t i = 0; i < shard_keys[ishard].size(); i++) {
+      entries.push_back( {point_map.at(shard_keys[ishard][i]), Long64_t(i)} );
+    }
+    std::stable_sort(entries.begin(), entries.end(),
+        [](const ShardEntry& a, const ShardEntry& b) {return a.ipoint < b.ipoint;});
+    std::vector<PointKey>().swap(shard_keys[ishard]);
+  }
+  point_map.clear();
+
+  // 2. Output library
+  TFile* output_file = new TFile(output_file_path, "recreate");
+  TTree* plib = new TTree(vis_tree::LIB_TREE, "SoLAr@ProtoDUNE3 Photon Library");
+  auto vis = std::make_unique<vis_tree::VisBuffer>();
+  // arrival-time profiles are carried only if all the shards have them
+  vis->Book(plib, quant_policy, has_timing);
+
+  // 3. Sum the shards block by block. The points of a block are split in
+  //    contiguous ranges, one per worker, so the accumulators are never
+  //    shared. Each worker keeps a few shards open across the blocks
+  //    (bounded by MAX_OPEN_SHARDS) and reads them in point order.
+  const size_t MAX_OPEN_SHARDS = 4;
+  std::vector<std::unique_ptr<vis_tree::VisCounts>> points(std::min(block_points, n_points));
+  for (auto& p : points) p = std::make_unique<vis_tree::VisCounts>();
+  // photons emitted per point, summed over the shards (n_photons*n_events)
+  std::vector<double> point_photons(points.size());
+
+  // range of points covered by each shard
+  std::vector<std::pair<size_t, size_t>> shard_range(shard_paths.size(), {n_points, 0});
+  for (size_t ishard = 0; ishard < shard_paths.size(); ishard++) {
+    const auto& entries = shard_entries[ishard];
+    if (entries.empty()) continue;
+    shard_range[ishard] = {entries.front().ipoint, entries.back().ipoint + 1};
+  }
+
+  struct OpenShard {
+    size_t ishard;
+    TFile* file;
+    TTree* tree;
+  };
+
+  struct Worker {
+    std::unique_ptr<vis_tree::VisCounts> buffer = std::make_unique<vis_tree::VisCounts>();
+    std::vector<OpenShard> open_shards; // most recently used last
+  };
+
+  const int n_workers = std::max(num_threads, 1);
+  std::vector<Worker> workers_state(n_workers);
+  std::atomic<int> status(0);
+  std::atomic<size_t> n_mixed_photons(0);
+
+  auto get_shard = [&](Worker& w, size_t ishard) -> TTree* {
+    for (size_t i = 0; i < w.open_shards.size(); i++) {
+      if (w.open_shards[i].ishard != ishard) continue;
+      OpenShard shard = w.open_shards[i];
+      w.open_shards.erase(w.open_shards.begin() + i);
+      w.open_shards.push_back(shard);
+      return shard.tree;
+    }
+    if (w.open_shards.size() == MAX_OPEN_SHARDS) {
+      w.open_shards.front().file->Close();
+      delete w.open_shards.front().file;
+      w.open_shards.erase(w.open_shards.begin());
+    }
+    TFile* file = TFile::Open(shard_paths[ishard]);
+    if (file == nullptr || file->IsZombie()) {
+      delete file;
+      return nullptr;
+    }
+    TTree* tree = file->Get<TTree>(vis_tree::COUNTS_TREE);
+    if (tree == nullptr) {
+      file->Close();
+      delete file;
+      return nullptr;
+    }
+    w.buffer->SetAddresses(tree);
+    w.open_shards.push_back( {ishard, file, tree} );
+    return tree;
+  };
+
+  for (size_t block_begin = 0; block_begin < n_points; block_begin += block_points) {
+    const size_t block_end = std::min(block_begin + block_points, n_points);
+    const size_t block_size = block_end - block_begin;
+    for (size_t ip = block_begin; ip < block_end; ip++) {
+      auto& point = points[ip - block_begin];
+      point->Reset();
+      std::copy(point_coords[ip].begin(), point_coords[ip].end(), point->coords);
+      point_photons[ip - block_begin] = 0;
+    }
+
+    auto worker = [&](int iw) {
+      Worker& w = workers_state[iw];
+      const size_t lo = block_begin + block_size * iw / n_workers;
+      const size_t hi = block_begin + block_size * (iw + 1) / n_workers;
+      if (lo == hi) return;
+      for (size_t ishard = 0; ishard < shard_paths.size() && status == 0; ishard++) {
+        if (shard_range[ishard].first >= hi || shard_range[ishard].second <= lo) continue;
+        const auto& entries = shard_entries[ishard];
+        auto it = std::lower_bound(entries.begin(), entries.end(), lo,
+            [](const ShardEntry& e, size_t ip) {return e.ipoint < ip;});
+        if (it == entries.end() || it->ipoint >= hi) continue;
+
+        TTree* tree = get_shard(w, ishard);
+        if (tree == nullptr) {
+          fprintf(stderr, "reduce_vis_tree ERROR: Unable to read shard %s\n",
+              shard_paths[ishard].Data());
+          status = 1;
+          return;
+        }
+        const auto& buffer = w.buffer;
+        for (; it != entries.end() && it->ipoint < hi; ++it) {
+          tree->GetEntry(it->entry);
+          auto& point = points[it->ipoint - block_begin];
+          if (point->n_events_per_point > 0 && point->n_photons != buffer->n_photons) {
+            n_mixed_photons++;
+          }
+          point->n_photons = buffer->n_photons;
+          point_photons[it->ipoint - block_begin] +=
+            buffer->n_photons * (double)buffer->n_events_per_point;
+          point->Add(*buffer);
+        }
+      }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < n_workers; i++) workers.emplace_back(worker, i);
+    for (auto& w : workers) w.join();
+    if (status != 0) break;
+
+    // normalise and write the points of the block. Shards may have been
+    // produced with different photon budgets: the effective n_photons is
+    // the total number of photons emitted over the events of the point
+    for (size_t ip = block_begin; ip < block_end; ip++) {
+      const auto& point = points[ip - block_begin];
+      if (point->n_events_per_point == 0) continue;
+      point->n_photons = point_photons[ip - block_begin] / point->n_events_per_point;
+      vis->Normalise(*point);
+      vis->Quantise();
+      plib->Fill();
+    }
+  }
+
+  for (auto& w : workers_state) {
+    for (auto& shard : w.open_shards) {
+      shard.file->Close();
+      delete shard.file;
+    }
+  }
+  if (status != 0) {
+    fprintf(stderr, "reduce_vis_tree ERROR: Unable to read all the shards\n");
+    output_file->Close();
+    delete output_file;
+    return 1;
+  }
+  if (n_mixed_photons > 0) {
+    printf("reduce_vis_tree: %zu shard entries with a different n_photons, "
+        "normalised to the photons emitted per point\n", n_mixed_photons.load());
+  }
+
+  output_file->cd();
+  plib->Write();
+  output_file->Close();
+
+  if (vis->IsQuantised()) vis->PrintQuantReport();
+  printf("Output written to: %s\n", output_file_path.Data());
+
+  return 0;
+}
+
+void print_usage() {
+  printf("reduce_vis_tree usage:\n");
+  printf("\treduce_vis_tree [options] shard_0.root [shard_1.root ...]\n");
+  printf("\t-l | --list\ttext file with the list of shards (one per line)\n");
+  printf("\t-o | --output\toutput_file_path (default: vis_tree_reduced.root)\n");
+  printf("\t-j | --threads\tnumber of worker threads (default: 4)\n");
+  printf("\t-b | --block\tsource points reduced per pass (default: 1024)\n");
+  printf("\t-q | --quantise\t<branch wildcard>=<float|f16:nbits|f16:xmin:xmax:nbits|log:nbits:vmin:vmax>\n");
+
+  return;
+}
+
+int main (int argc, char *argv[]) {
+  const char* short_opts = "l:o:j:b:q:h";
+  static struct option long_opts[7] =
+  {
+    {"list", required_argument, 0, 'l'},
+    {"output", required_argument, 0, 'o'},
+    {"threads", required_argument, 0, 'j'},
+    {"block", required_argument, 0, 'b'},
+    {"quantise", required_argument, 0, 'q'},
+    {"help", no_argument, 0, 'h'},
+    {nullptr, no_argument, nullptr, 0}
+  };
+
+  int c, option_index;
+
+  std::vector<TString> shard_paths;
+  TString output_file_path = "vis_tree_reduced.root";
+  vis_quant::QuantPolicy quant_policy;
+  int num_threads = 4;
+  size_t block_points = 1024;
+
+  while ( (c = getopt_long(argc, argv, short_opts, long_opts, &option_index)) != -1) {
+    switch(c) {
+      case 'l' :
+        {
+          std::ifstream file_list(optarg);
+          if (file_list.is_open() == false) {
+            printf("reduce_vis_tree error: unable to open input list %s\n", optarg);
+            exit( EXIT_FAILURE );
+          }
+          std::string line;
+          while (std::getline(file_list, line)) {
+            if (line.empty() == false) shard_paths.push_back(line);
+          }
+        }
+        break;
+      case 'o' :
+        output_file_path = optarg;
+        break;
+      case 'j' :
+        num_threads = std::max(1, atoi(optarg));
+        break;
+      case 'b' :
+        block_points = std::max(1LL, atoll(optarg));
+        break;
+      case 'q' :
+        if (quant_policy.AddRule(optarg) == false) {
+          printf("reduce_vis_tree error: invalid quantisation rule %s\n", optarg);
+          print_usage();
+          exit( EXIT_FAILURE );
+        }
+        break;
+      case 'h' :
+        print_usage();
+        exit( EXIT_SUCCESS );
+        break;
+      case '?' :
+        printf("reduce_vis_tree error: unknown flag %c\n", optopt);
+        print_usage();
+        exit( EXIT_FAILURE );
+        break;
+    }
+  }
+
+  for (int i = optind; i < argc; i++) shard_paths.push_back(argv[i]);
+
+  if (shard_paths.empty()) {
+    printf("reduce_vis_tree error: no input shards\n");
+    print_usage();
+    exit( EXIT_FAILURE );
+  }
+
+  return reduce_vis_tree(shard_paths, output_file_path, quant_policy, num_threads, block_points);
+}
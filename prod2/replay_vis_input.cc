@@ -0,0 +1,178 @@
+/**
+ * @file        : replay_vis_input.cc
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <vector>
+#include <getopt.h>
+#include "TFile.h"
+#include "TTree.h"
+#include "TSystem.h"
+
+#include "vis_tree_io.hh"
+
+/**
+ * Replay an existing simulation output (SoLAr-sim EventTree/GenTree or
+ * make_hit_skim output) as if it was being produced, to test
+ * make_vis_tree --follow locally. The entries are written in chunks with
+ * a delay between them, either
+ *  - appended to a single growing file, saved (AutoSave) after every chunk;
+ *  - or as a sequence of files <output>/part_NNNNN.root, each written
+ *    under a .part name and renamed when complete.
+ * The <output>.done marker is created at the end.
+ */
+
+int replay_vis_input(const TString& input_file_path, const TString& output_path,
+    const Long64_t& chunk_entries, const double& delay, const bool& to_dir)
+{
+  TFile* input_file = TFile::Open(input_file_path);
+  if (input_file == nullptr || input_file->IsZombie()) {
+    fprintf(stderr, "replay_vis_input ERROR: Unable to open input file %s\n", input_file_path.Data());
+    return 1;
+  }
+  std::vector<TTree*> trees;
+  if (TTree* skim = input_file->Get<TTree>(vis_tree::SKIM_TREE)) {
+    trees.push_back(skim);
+  }
+  else {
+    TTree* tree_event = input_file->Get<TTree>("EventTree");
+    TTree* tree_gen = input_file->Get<TTree>("GenTree");
+    if (tree_event == nullptr || tree_gen == nullptr) {
+      fprintf(stderr, "replay_vis_input ERROR: No %s or EventTree/GenTree in %s\n",
+          vis_tree::SKIM_TREE, input_file_path.Data());
+      return 1;
+    }
+    trees.push_back(tree_event);
+    trees.push_back(tree_gen);
+  }
+  const Long64_t n_entries = trees[0]->GetEntries();
+
+  if (to_dir) gSystem->mkdir(output_path, kTRUE);
+
+  TFile* output_file = nullptr;
+  std::vector<TTree*> out_trees;
+  auto open_output = [&](const TString& path) {
+    output_file = new TFile(path, "recreate");
+    out_trees.clear();
+    for (auto& t : trees) {
+      out_trees.push_back( t->CloneTree(0) );
+      out_trees.back()->SetDirectory(output_file);
+    }
+  };
+  auto close_output = [&]() {
+    output_file->cd();
+    for (auto& t : out_trees) t->Write();
+    output_file->Close();
+    delete output_file;
+    output_file = nullptr;
+  };
+
+  if (to_dir == false) open_output(output_path);
+
+  int ichunk = 0;
+  for (Long64_t first = 0; first < n_entries; first += chunk_entries, ichunk++) {
+    const Long64_t last = std::min(first + chunk_entries, n_entries);
+    const TString part_path = Form("%s/part_%05i.root", output_path.Data(), ichunk);
+    if (to_dir) open_output(part_path + ".part");
+
+    for (Long64_t entry = first; entry < last; entry++) {
+      for (size_t it = 0; it < trees.size(); it++) {
+        trees[it]->GetEntry(entry);
+        out_trees[it]->Fill();
+      }
+    }
+
+    if (to_dir) {
+      close_output();
+      gSystem->Rename(part_path + ".part", part_path);
+      printf("replay_vis_input: [%lld, %lld) -> %s\n", first, last, part_path.Data());
+    }
+    else {
+      for (auto& t : out_trees) t->AutoSave("SaveSelf");
+      printf("replay_vis_input: [%lld, %lld) appended to %s\n", first, last, output_path.Data());
+    }
+    fflush(stdout);
+    if (last < n_entries) gSystem->Sleep( UInt_t(delay*1000) );
+  }
+
+  if (to_dir == false) close_output();
+  input_file->Close();
+  delete input_file;
+
+  std::ofstream done_marker( (output_path + ".done").Data() );
+  done_marker.close();
+  printf("Output written to: %s\n", output_path.Data());
+  return 0;
+}
+
+void print_usage() {
+  printf("replay_vis_input usage:\n");
+  printf("\t-i | --input\tSoLAr-sim output or make_hit_skim output\n");
+  printf("\t-o | --output\tgrowing output file, or output directory with --dir\n");
+  printf("\t-c | --chunk\tentries per chunk (default: 1000)\n");
+  printf("\t-d | --delay\tseconds between chunks (default: 5)\n");
+  printf("\t-D | --dir\twrite one file per chunk in the output directory\n");
+
+  return;
+}
+
+int main (int argc, char *argv[]) {
+  const char* short_opts = "i:o:c:d:Dh";
+  static struct option long_opts[7] =
+  {
+    {"input", required_argument, 0, 'i'},
+    {"output", required_argument, 0, 'o'},
+    {"chunk", required_argument, 0, 'c'},
+    {"delay", required_argument, 0, 'd'},
+    {"dir", no_argument, 0, 'D'},
+    {"help", no_argument, 0, 'h'},
+    {nullptr, no_argument, nullptr, 0}
+  };
+
+  int c, option_index;
+
+  TString input_file_path = "";
+  TString output_path = "";
+  Long64_t chunk_entries = 1000;
+  double delay = 5.0;
+  bool to_dir = false;
+
+  while ( (c = getopt_long(argc, argv, short_opts, long_opts, &option_index)) != -1) {
+    switch(c) {
+      case 'i' :
+        input_file_path = optarg;
+        break;
+      case 'o' :
+        output_path = optarg;
+        break;
+      case 'c' :
+        chunk_entries = std::max(1LL, std::atoll(optarg));
+        break;
+      case 'd' :
+        delay = std::max(0.0, std::atof(optarg));
+        break;
+      case 'D' :
+        to_dir = true;
+        break;
+      case 'h' :
+        print_usage();
+        exit( EXIT_SUCCESS );
+        break;
+      case '?' :
+        printf("replay_vis_input error: unknown flag %c\n", optopt);
+        print_usage();
+        exit( EXIT_FAILURE );
+        break;
+    }
+  }
+
+  if (input_file_path.IsNull() || output_path.IsNull()) {
+    printf("replay_vis_input error: input and output paths are required\n");
+    print_usage();
+    exit( EXIT_FAILURE );
+  }
+
+  return replay_vis_input(input_file_path, output_path, chunk_entries, delay, to_dir);
+}
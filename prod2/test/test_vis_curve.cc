@@ -0,0 +1,86 @@
+/**
+ * @file        : test_vis_curve.cc
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "vis_spatial_index.hh"
+#include "test/vis_test.hh"
+
+/**
+ * Curve keys of the library entry ordering (vis_spatial_index.hh): on a
+ * 2^nbits cube the Morton and Hilbert keys are a bijection onto
+ * [0, 8^nbits), consecutive Hilbert keys are grid neighbours, and the
+ * lexicographic key follows the x, y, z order of export_filemap.sql.
+ */
+
+using namespace vis_tree;
+
+void test_curve(const int& order, const int& nbits) {
+  const UInt_t n = 1u << nbits;
+  const size_t n_nodes[3] = {n, n, n};
+  const size_t n_keys = size_t(n)*n*n;
+  std::vector<int> node_of_key(3*n_keys, -1);
+  int n_out_of_range = 0, n_duplicates = 0;
+  for (UInt_t i = 0; i < n; i++) {
+    for (UInt_t j = 0; j < n; j++) {
+      for (UInt_t k = 0; k < n; k++) {
+        const UInt_t inode[3] = {i, j, k};
+        const ULong64_t key = get_curve_key(order, inode, n_nodes, nbits);
+        if (key >= n_keys) { n_out_of_range++; continue; }
+        if (node_of_key[3*key] >= 0) n_duplicates++;
+        node_of_key[3*key+0] = i;
+        node_of_key[3*key+1] = j;
+        node_of_key[3*key+2] = k;
+      }
+    }
+  }
+  VIS_CHECK( n_out_of_range == 0 );
+  VIS_CHECK( n_duplicates == 0 );
+
+  int n_jumps = 0;
+  for (size_t key = 1; key < n_keys; key++) {
+    int dist = 0;
+    for (int c = 0; c < 3; c++) dist += std::abs(node_of_key[3*key+c] - node_of_key[3*(key-1)+c]);
+    if (dist != 1) n_jumps++;
+  }
+  if (order == kOrderHilbert) VIS_CHECK( n_jumps == 0 );
+
+  if (order == kOrderMorton) {
+    // the first 8 keys fill the 2x2x2 corner cube, x most significant
+    int n_outside = 0;
+    for (size_t key = 0; key < 8; key++) {
+      for (int c = 0; c < 3; c++) {
+        if (node_of_key[3*key+c] != int((key >> (2-c)) & 1)) n_outside++;
+      }
+    }
+    VIS_CHECK( n_outside == 0 );
+  }
+
+  if (order == kOrderLex) {
+    int n_unordered = 0;
+    for (size_t key = 0; key < n_keys; key++) {
+      const size_t lex = (size_t(node_of_key[3*key])*n + node_of_key[3*key+1])*n + node_of_key[3*key+2];
+      if (lex != key) n_unordered++;
+    }
+    VIS_CHECK( n_unordered == 0 );
+  }
+}
+
+int main() {
+  VIS_CHECK( get_curve_bits(1) == 1 );
+  VIS_CHECK( get_curve_bits(2) == 1 );
+  VIS_CHECK( get_curve_bits(3) == 2 );
+  VIS_CHECK( get_curve_bits(64) == 6 );
+  VIS_CHECK( get_curve_bits(65) == 7 );
+
+  for (int order = kOrderLex; order <= kOrderHilbert; order++) {
+    VIS_CHECK( parse_curve_order(CURVE_LABEL[order]) == order );
+    for (int nbits = 1; nbits <= 5; nbits++) test_curve(order, nbits);
+  }
+  VIS_CHECK( parse_curve_order("peano") == -1 );
+
+  return vis_test::summary("test_vis_curve");
+}
@@ -0,0 +1,185 @@
+/**
+ * @file        : test_vis_export.cc
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "TFile.h"
+#include "TTree.h"
+#include "TSystem.h"
+
+#include "vis_quant.hh"
+#include "vis_compress.hh"
+#include "vis_tree_io.hh"
+#include "vis_export.h"
+#include "test/vis_test.hh"
+
+/**
+ * Round trip of the library export (vis_export.h): a small photonLib tree
+ * with a scalar, an unsigned counter, a log-coded and a byte-shuffled
+ * array is read back through the strided chunks and through the Arrow C
+ * stream, the values must match the stored (decoded) ones.
+ */
+
+const int N_TILE = 60;
+const int N_SIPM = 600;
+const Long64_t N_ROWS = 20;
+const int64_t CHUNK_ROWS = 7;
+
+float value_x(const Long64_t& row) {return -500.0f + 25.0f*row;}
+UInt_t value_events(const Long64_t& row) {return 100 + row;}
+float value_tile(const Long64_t& row, const int& i) {return (i % 5 == 0) ? 0.0 : 1e-7 * (1 + row + 3*i);}
+float value_sipm(const Long64_t& row, const int& i) {return 1e-9 * (1 + (row*7 + i) % 131);}
+
+void write_library(const TString& path, const vis_quant::QuantSpec& spec) {
+  TFile file(path, "recreate");
+  TTree tree(vis_tree::LIB_TREE, "photonLib");
+  float x = 0;
+  UInt_t n_events = 0;
+  std::vector<UShort_t> tile(N_TILE);
+  std::vector<float> sipm(N_SIPM), data(N_SIPM);
+  tree.Branch("x", &x, "x/F");
+  tree.Branch("n_events_per_point", &n_events, "n_events_per_point/i");
+  tree.Branch("vis_tot_tile_main", tile.data(), Form("vis_tot_tile_main[%i]/s", N_TILE));
+  tree.Branch("vis_sipm_lat0", sipm.data(), Form("vis_sipm_lat0[%i]/F", N_SIPM));
+  vis_quant::set_branch_spec(&tree, "vis_tot_tile_main", spec);
+  vis_compress::set_shuffled(&tree, "vis_sipm_lat0", true);
+
+  for (Long64_t row = 0; row < N_ROWS; row++) {
+    x = value_x(row);
+    n_events = value_events(row);
+    for (int i = 0; i < N_TILE; i++) tile[i] = vis_quant::log_encode(value_tile(row, i), spec);
+    for (int i = 0; i < N_SIPM; i++) data[i] = value_sipm(row, i);
+    vis_compress::byte_shuffle(data.data(), sipm.data(), N_SIPM, sizeof(float));
+    tree.Fill();
+  }
+  tree.Write();
+  file.Close();
+}
+
+// Number of values of the columns (x, events, tile, sipm) of rows [first, first+n) that differ
+int check_rows(const Long64_t& first, const int64_t& n, const void* const* data,
+    const vis_quant::QuantSpec& spec)
+{
+  const float* x = static_cast<const float*>(data[0]);
+  const UInt_t* events = static_cast<const UInt_t*>(data[1]);
+  const float* tile = static_cast<const float*>(data[2]);
+  const float* sipm = static_cast<const float*>(data[3]);
+  int n_bad = 0;
+  for (int64_t r = 0; r < n; r++) {
+    const Long64_t row = first + r;
+    n_bad += (x[r] != value_x(row));
+    n_bad += (events[r] != value_events(row));
+    for (int i = 0; i < N_TILE; i++) {
+      n_bad += (tile[r*N_TILE + i] != vis_quant::round_trip(value_tile(row, i), spec));
+    }
+    for (int i = 0; i < N_SIPM; i++) n_bad += (sipm[r*N_SIPM + i] != value_sipm(row, i));
+  }
+  return n_bad;
+}
+
+void test_strided(const TString& path, const vis_quant::QuantSpec& spec) {
+  VisExportReader* reader = vis_export_open(path, "x,n_events_per_point,vis_tot_tile_main,vis_sipm_lat0", CHUNK_ROWS);
+  VIS_CHECK( reader != nullptr );
+  if (reader == nullptr) return;
+  VIS_CHECK( vis_export_num_rows(reader) == N_ROWS );
+  VIS_CHECK( vis_export_num_columns(reader) == 4 );
+
+  VisExportColumn columns[4];
+  const int32_t types[4] = {VIS_EXPORT_FLOAT32, VIS_EXPORT_UINT32, VIS_EXPORT_FLOAT32, VIS_EXPORT_FLOAT32};
+  const int32_t widths[4] = {1, 1, N_TILE, N_SIPM};
+  for (int icol = 0; icol < 4; icol++) {
+    VIS_CHECK( vis_export_column(reader, icol, &columns[icol]) == 0 );
+    VIS_CHECK( columns[icol].type == types[icol] && columns[icol].width == widths[icol] );
+    VIS_CHECK( columns[icol].row_stride == int64_t(widths[icol]*sizeof(float)) );
+  }
+
+  Long64_t first = 0;
+  int n_bad = 0;
+  int64_t n = 0;
+  while ( (n = vis_export_next(reader, columns)) > 0 ) {
+    const void* data[4] = {columns[0].data, columns[1].data, columns[2].data, columns[3].data};
+    n_bad += check_rows(first, n, data, spec);
+    first += n;
+  }
+  VIS_CHECK( n == 0 );
+  VIS_CHECK( first == N_ROWS );
+  VIS_CHECK( n_bad == 0 );
+
+  // restart from a row in the middle
+  VIS_CHECK( vis_export_seek(reader, 9) == 0 );
+  n = vis_export_next(reader, columns);
+  VIS_CHECK( n == CHUNK_ROWS );
+  const void* data[4] = {columns[0].data, columns[1].data, columns[2].data, columns[3].data};
+  VIS_CHECK( check_rows(9, n, data, spec) == 0 );
+
+  vis_export_close(reader);
+
+  VIS_CHECK( vis_export_open(path, "vis_tot_tile_lat0", 0) == nullptr );
+  VIS_CHECK( std::strlen(vis_export_last_error()) > 0 );
+}
+
+void test_arrow(const TString& path, const vis_quant::QuantSpec& spec) {
+  VisExportReader* reader = vis_export_open(path, "x,n_events_per_point,vis_tot_tile_main,vis_sipm_lat0", CHUNK_ROWS);
+  VIS_CHECK( reader != nullptr );
+  if (reader == nullptr) return;
+  ArrowArrayStream stream;
+  VIS_CHECK( vis_export_arrow_stream(reader, &stream) == 0 );
+
+  ArrowSchema schema;
+  VIS_CHECK( stream.get_schema(&stream, &schema) == 0 );
+  VIS_CHECK( std::strcmp(schema.format, "+s") == 0 && schema.n_children == 4 );
+  if (schema.n_children == 4) {
+    VIS_CHECK( std::strcmp(schema.children[0]->name, "x") == 0 );
+    VIS_CHECK( std::strcmp(schema.children[0]->format, "f") == 0 );
+    VIS_CHECK( std::strcmp(schema.children[1]->format, "I") == 0 );
+    VIS_CHECK( std::strcmp(schema.children[2]->format, "+w:60") == 0 );
+    VIS_CHECK( schema.children[2]->n_children == 1 );
+    VIS_CHECK( std::strcmp(schema.children[3]->name, "vis_sipm_lat0") == 0 );
+    VIS_CHECK( std::strcmp(schema.children[3]->format, "+w:600") == 0 );
+  }
+  schema.release(&schema);
+  VIS_CHECK( schema.release == nullptr );
+
+  // the batches own their buffers: keep them all until the stream is released
+  std::vector<ArrowArray> batches;
+  while (true) {
+    ArrowArray batch;
+    VIS_CHECK( stream.get_next(&stream, &batch) == 0 );
+    if (batch.release == nullptr) break;
+    batches.push_back(batch);
+  }
+  stream.release(&stream);
+
+  Long64_t first = 0;
+  int n_bad = 0;
+  for (auto& batch : batches) {
+    VIS_CHECK( batch.n_children == 4 && batch.length <= CHUNK_ROWS );
+    const void* data[4] = {
+      batch.children[0]->buffers[1],
+      batch.children[1]->buffers[1],
+      batch.children[2]->children[0]->buffers[1],
+      batch.children[3]->children[0]->buffers[1]};
+    VIS_CHECK( batch.children[3]->children[0]->length == batch.length*N_SIPM );
+    n_bad += check_rows(first, batch.length, data, spec);
+    first += batch.length;
+    batch.release(&batch);
+  }
+  VIS_CHECK( first == N_ROWS );
+  VIS_CHECK( n_bad == 0 );
+}
+
+int main() {
+  const TString path = "test_vis_export.root";
+  vis_quant::QuantSpec spec;
+  vis_quant::parse_spec("log:12:1e-09:1", spec);
+  write_library(path, spec);
+
+  test_strided(path, spec);
+  test_arrow(path, spec);
+
+  gSystem->Unlink(path);
+  return vis_test::summary("test_vis_export");
+}
@@ -0,0 +1,143 @@
+/**
+ * @file        : test_vis_octree.cc
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "TFile.h"
+#include "TTree.h"
+#include "TSystem.h"
+
+#include "vis_tree_io.hh"
+#include "vis_library.hh"
+#include "vis_octree.hh"
+#include "test/vis_test.hh"
+
+/**
+ * Checks of the octree storage (vis_octree.hh) on a synthetic vis_tot
+ * library: a 13x11x7 grid (not a power of 2, the cubes are clipped at the
+ * grid end), linear for x <= X_CURVED and quadratic in x above it. The
+ * curved region must be refined to single cells, every grid point must be
+ * reproduced within tolerance, and Write/Load must give the same octree.
+ */
+
+const int N_NODE[3] = {13, 11, 7};
+const float STEP = 10.0;      // mm
+const float X_CURVED = 60.0;  // mm
+const float CURVATURE = 1e-3; // mm^-2
+const float TOLERANCE = 1e-3;
+const float FLOOR = 1e-6;
+
+float value_vis(const float& x, const float& y, const float& z) {
+  const float dx = std::max(0.0f, x - X_CURVED);
+  return 1.0f + 0.01f*x + 0.02f*y + 0.03f*z + CURVATURE*dx*dx;
+}
+
+void write_library(const TString& path) {
+  TFile file(path, "recreate");
+  TTree tree(vis_tree::LIB_TREE, "photonLib");
+  float xyz[3] = {0, 0, 0};
+  float vis = 0;
+  const char* axis_name[3] = {"x", "y", "z"};
+  for (int k = 0; k < 3; k++) tree.Branch(axis_name[k], &xyz[k], Form("%s/F", axis_name[k]));
+  tree.Branch("vis_tot", &vis, "vis_tot/F");
+  for (int ix = 0; ix < N_NODE[0]; ix++) {
+    for (int iy = 0; iy < N_NODE[1]; iy++) {
+      for (int iz = 0; iz < N_NODE[2]; iz++) {
+        xyz[0] = ix*STEP; xyz[1] = iy*STEP; xyz[2] = iz*STEP;
+        vis = value_vis(xyz[0], xyz[1], xyz[2]);
+        tree.Fill();
+      }
+    }
+  }
+  tree.Write();
+  file.Close();
+}
+
+// Number of grid points not reproduced within tolerance
+int check_grid(const vis_tree::VisOctree& octree) {
+  int n_bad = 0;
+  for (int ix = 0; ix < N_NODE[0]; ix++) {
+    for (int iy = 0; iy < N_NODE[1]; iy++) {
+      for (int iz = 0; iz < N_NODE[2]; iz++) {
+        const float x = ix*STEP, y = iy*STEP, z = iz*STEP;
+        const float v = value_vis(x, y, z);
+        float out = 0;
+        const bool ok = octree.Interpolate(x, y, z, &out);
+        n_bad += (ok == false || std::fabs(out - v) > TOLERANCE*std::max(std::fabs(v), FLOOR));
+      }
+    }
+  }
+  return n_bad;
+}
+
+int main() {
+  const TString lib_path = "test_vis_octree_lib.root";
+  const TString oct_path = "test_vis_octree.root";
+  write_library(lib_path);
+
+  vis_tree::VisLibrary lib;
+  VIS_CHECK( lib.Load(lib_path, 1u << vis_tree::kGroupVisTot) );
+  const size_t n_points = lib.GetNPoints();
+  VIS_CHECK( n_points == size_t(N_NODE[0]*N_NODE[1]*N_NODE[2]) );
+
+  vis_tree::VisOctree octree;
+  VIS_CHECK( octree.Build(lib, vis_tree::kGroupVisTot, TOLERANCE, FLOOR) );
+  VIS_CHECK( octree.GetDepth() == 4 );
+  VIS_CHECK( check_grid(octree) == 0 );
+
+  // the linear region is stored with few samples
+  VIS_CHECK( octree.GetNLeaves() > 1 );
+  VIS_CHECK( octree.GetNSamples() < n_points );
+
+  // curved region: at the cell centres only single-cell leaves keep the
+  // error at CURVATURE*STEP^2/4 (a leaf of two cells would be 4 times that)
+  float err_curved = 0;
+  for (int ix = X_CURVED/STEP; ix < N_NODE[0]-1; ix++) {
+    for (int iy = 0; iy < N_NODE[1]-1; iy++) {
+      for (int iz = 0; iz < N_NODE[2]-1; iz++) {
+        const float x = (ix + 0.5)*STEP, y = (iy + 0.5)*STEP, z = (iz + 0.5)*STEP;
+        float out = 0;
+        VIS_CHECK( octree.Interpolate(x, y, z, &out) );
+        err_curved = std::max(err_curved, std::fabs(out - value_vis(x, y, z)));
+      }
+    }
+  }
+  VIS_CHECK( err_curved < 1.2f*CURVATURE*STEP*STEP/4 );
+
+  // outside the grid
+  float out = 0;
+  VIS_CHECK( octree.Interpolate(-1.0, 0.0, 0.0, &out) == false );
+  VIS_CHECK( octree.Interpolate(0.0, 0.0, (N_NODE[2]-1)*STEP + 1.0, &out) == false );
+
+  // Write/Load round trip
+  TFile* file = new TFile(oct_path, "recreate");
+  octree.WriteAxes();
+  octree.Write();
+  file->Close();
+  delete file;
+
+  vis_tree::VisOctree loaded;
+  VIS_CHECK( loaded.Load(oct_path, vis_tree::kGroupVisTot) );
+  VIS_CHECK( loaded.GetDepth() == octree.GetDepth() );
+  VIS_CHECK( loaded.GetNNodes() == octree.GetNNodes() );
+  VIS_CHECK( loaded.GetNLeaves() == octree.GetNLeaves() );
+  VIS_CHECK( loaded.GetNSamples() == octree.GetNSamples() );
+  VIS_CHECK( check_grid(loaded) == 0 );
+  int n_diff = 0;
+  for (int i = 0; i < 1000; i++) {
+    const float x = std::fmod(7.3f*i, (N_NODE[0]-1)*STEP);
+    const float y = std::fmod(3.1f*i, (N_NODE[1]-1)*STEP);
+    const float z = std::fmod(1.7f*i, (N_NODE[2]-1)*STEP);
+    float a = 0, b = 0;
+    const bool ok_a = octree.Interpolate(x, y, z, &a);
+    const bool ok_b = loaded.Interpolate(x, y, z, &b);
+    n_diff += (ok_a != ok_b || a != b);
+  }
+  VIS_CHECK( n_diff == 0 );
+
+  gSystem->Unlink(lib_path);
+  gSystem->Unlink(oct_path);
+  return vis_test::summary("test_vis_octree");
+}
@@ -0,0 +1,132 @@
+/**
+ * @file        : test_vis_quant.cc
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "TFile.h"
+#include "TTree.h"
+#include "TSystem.h"
+
+#include "vis_quant.hh"
+#include "test/vis_test.hh"
+
+/**
+ * Round trip of the quantised storage modes (vis_quant.hh): spec parsing,
+ * log-code error bound, and write/read through a ROOT file of a log-coded
+ * and a Float16_t branch.
+ */
+
+using namespace vis_quant;
+
+void test_spec() {
+  const char* specs[] = {"float", "f16:10", "f16:0:1:16", "log:12:1e-09:1"};
+  for (const auto& str : specs) {
+    QuantSpec spec, spec_rt;
+    VIS_CHECK( parse_spec(str, spec) );
+    VIS_CHECK( parse_spec(spec.Encode(), spec_rt) );
+    VIS_CHECK( spec_rt.mode == spec.mode && spec_rt.nbits == spec.nbits );
+    VIS_CHECK( spec_rt.xmin == spec.xmin && spec_rt.xmax == spec.xmax );
+  }
+
+  QuantSpec spec;
+  VIS_CHECK( parse_spec("f16:1", spec) == false );
+  VIS_CHECK( parse_spec("log:12:0:1", spec) == false );
+  VIS_CHECK( parse_spec("log:17:1e-9:1", spec) == false );
+  VIS_CHECK( parse_spec("half", spec) == false );
+}
+
+void test_log_code() {
+  QuantSpec spec;
+  parse_spec("log:12:1e-09:1", spec);
+  const int kmax = (1 << spec.nbits) - 1;
+  const double dlog = (std::log(spec.xmax) - std::log(spec.xmin)) / (kmax - 1);
+  const double bound = std::exp(0.5*dlog) - 1 + 1e-6;
+
+  VIS_CHECK( log_encode(0.0, spec) == 0 );
+  VIS_CHECK( log_decode(0, spec) == 0.0 );
+  VIS_CHECK( log_encode(spec.xmin, spec) == 1 );
+  VIS_CHECK( log_encode(spec.xmax, spec) == kmax );
+  VIS_CHECK( log_encode(10*spec.xmax, spec) == kmax );
+
+  double max_rel_err = 0.0;
+  for (double v = spec.xmin; v <= spec.xmax; v *= 1.0137) {
+    const double rel_err = std::fabs(round_trip(v, spec) - float(v)) / float(v);
+    max_rel_err = std::max(max_rel_err, rel_err);
+  }
+  VIS_CHECK( max_rel_err <= bound );
+}
+
+void test_file_round_trip() {
+  const TString path = "test_vis_quant.root";
+  const int n = 64;
+  const Long64_t n_entries = 20;
+
+  QuantSpec spec_log, spec_f16;
+  parse_spec("log:12:1e-09:1", spec_log);
+  parse_spec("f16:10", spec_f16);
+
+  auto value = [](const Long64_t& entry, const int& i) -> float {
+    if ((entry + i) % 7 == 0) return 0.0;
+    return std::pow(10.0, -8.0 * ((entry*n + i) % 97) / 96.0);
+  };
+
+  {
+    TFile file(path, "recreate");
+    TTree tree("photonLib", "photonLib");
+    std::vector<UShort_t> codes(n);
+    std::vector<float> vis(n);
+    tree.Branch("vis_log", codes.data(), Form("vis_log[%i]/%s", n, spec_log.LeafType().Data()));
+    tree.Branch("vis_f16", vis.data(), Form("vis_f16[%i]/%s", n, spec_f16.LeafType().Data()));
+    set_branch_spec(&tree, "vis_log", spec_log);
+    set_branch_spec(&tree, "vis_f16", spec_f16);
+
+    std::vector<float> data(n);
+    for (Long64_t entry = 0; entry < n_entries; entry++) {
+      for (int i = 0; i < n; i++) data[i] = value(entry, i);
+      encode(data.data(), codes.data(), n, spec_log);
+      std::copy(data.begin(), data.end(), vis.begin());
+      tree.Fill();
+    }
+    tree.Write();
+    file.Close();
+  }
+
+  TFile file(path);
+  TTree* tree = file.Get<TTree>("photonLib");
+  VIS_CHECK( tree != nullptr );
+  if (tree == nullptr) return;
+  VIS_CHECK( tree->GetEntries() == n_entries );
+
+  const QuantSpec spec_log_rd = get_branch_spec(tree, "vis_log");
+  VIS_CHECK( spec_log_rd.Encode() == spec_log.Encode() );
+  VIS_CHECK( get_branch_spec(tree, "vis_f16").mode == kFloat );
+
+  std::vector<UShort_t> codes(n);
+  std::vector<float> vis(n), decoded(n);
+  tree->SetBranchAddress("vis_log", codes.data());
+  tree->SetBranchAddress("vis_f16", vis.data());
+  int n_bad_log = 0, n_bad_f16 = 0;
+  for (Long64_t entry = 0; entry < n_entries; entry++) {
+    tree->GetEntry(entry);
+    decode(codes.data(), decoded.data(), n, spec_log_rd);
+    for (int i = 0; i < n; i++) {
+      const float v = value(entry, i);
+      if (decoded[i] != round_trip(v, spec_log)) n_bad_log++;
+      if (vis[i] != f16_round_trip(v, spec_f16)) n_bad_f16++;
+    }
+  }
+  VIS_CHECK( n_bad_log == 0 );
+  VIS_CHECK( n_bad_f16 == 0 );
+
+  file.Close();
+  gSystem->Unlink(path);
+}
+
+int main() {
+  test_spec();
+  test_log_code();
+  test_file_round_trip();
+  return vis_test::summary("test_vis_quant");
+}
@@ -0,0 +1,137 @@
+/**
+ * @file        : test_vis_yield.cc
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "TFile.h"
+#include "TTree.h"
+#include "TSystem.h"
+
+#include "vis_tree_io.hh"
+#include "vis_library.hh"
+#include "vis_yield.hh"
+#include "test/vis_test.hh"
+
+/**
+ * Checks of the fast photon-yield estimate (vis_yield.hh): moments of the
+ * Poisson sampling below and above POISSON_NORMAL_MU, and the merging of
+ * the steps on the same point against a small library (3x3x3 grid, total
+ * tile visibilities only).
+ */
+
+const int N_NODE = 3;
+const float STEP = 10.0; // mm
+
+float value_tile(const int& ipoint, const int& itile) {return 1e-6 * (1 + ipoint) * (1 + itile % 7);}
+
+void write_library(const TString& path) {
+  TFile file(path, "recreate");
+  TTree tree(vis_tree::LIB_TREE, "photonLib");
+  float xyz[3] = {0, 0, 0};
+  std::vector<float> tile[vis_tree::N_ANODE];
+  const char* axis_name[3] = {"x", "y", "z"};
+  for (int k = 0; k < 3; k++) tree.Branch(axis_name[k], &xyz[k], Form("%s/F", axis_name[k]));
+  for (int ia = 0; ia < vis_tree::N_ANODE; ia++) {
+    tile[ia].resize(vis_tree::NTILE[ia]);
+    const TString name = Form("vis_tot_tile_%s", vis_tree::ANODE_LABEL[ia]);
+    tree.Branch(name, tile[ia].data(), Form("%s[%i]/F", name.Data(), vis_tree::NTILE[ia]));
+  }
+
+  int ipoint = 0;
+  for (int ix = 0; ix < N_NODE; ix++) {
+    for (int iy = 0; iy < N_NODE; iy++) {
+      for (int iz = 0; iz < N_NODE; iz++) {
+        xyz[0] = ix*STEP; xyz[1] = iy*STEP; xyz[2] = iz*STEP;
+        int itile = 0;
+        for (int ia = 0; ia < vis_tree::N_ANODE; ia++) {
+          for (auto& v : tile[ia]) v = value_tile(ipoint, itile++);
+        }
+        tree.Fill();
+        ipoint++;
+      }
+    }
+  }
+  tree.Write();
+  file.Close();
+}
+
+void test_poisson() {
+  const size_t n = 200000;
+  const float mu_values[4] = {0.5, 4.0, 25.0, 400.0};
+  vis_yield::LaneRng rng(12345);
+  std::vector<float> tmp;
+  for (const float& mu : mu_values) {
+    std::vector<float> means(n, mu);
+    std::vector<UInt_t> k(n);
+    vis_yield::sample_poisson(means.data(), k.data(), n, rng, tmp);
+    double sum = 0, sum2 = 0;
+    for (const auto& v : k) {
+      sum += v;
+      sum2 += double(v)*v;
+    }
+    const double mean = sum / n;
+    const double var = sum2 / n - mean*mean;
+    // 5 sigma on the mean, 5% on the variance
+    VIS_CHECK( std::fabs(mean - mu) < 5*std::sqrt(mu / n) );
+    VIS_CHECK( std::fabs(var - mu) < 0.05*mu );
+  }
+
+  // zero and negative means give no counts
+  const float zero[2] = {0.0, -1.0};
+  UInt_t k[2] = {1, 1};
+  vis_yield::sample_poisson(zero, k, 2, rng, tmp);
+  VIS_CHECK( k[0] == 0 && k[1] == 0 );
+}
+
+void test_merge(const TString& path) {
+  vis_tree::VisLibrary lib;
+  VIS_CHECK( lib.Load(path, 1u << vis_tree::kGroupTileTot) );
+  VIS_CHECK( lib.GetNPoints() == N_NODE*N_NODE*N_NODE );
+
+  const Long64_t ia = lib.Locate(10, 10, 10);
+  const Long64_t ib = lib.Locate(0, 20, 10);
+  VIS_CHECK( ia >= 0 && ib >= 0 && ia != ib );
+  if (ia < 0 || ib < 0) return;
+
+  // two steps on point a, one on point b, one outside the grid
+  const vis_yield::EDepStep steps[4] = {
+    {11.0, 9.0, 10.0, 0.5, 1000.0},
+    {0.0, 20.0, 10.0, 1.0, 2000.0},
+    {9.0, 12.0, 8.0, 0.25, 4000.0},
+    {100.0, 0.0, 0.0, 1.0, 1000.0}
+  };
+  vis_yield::YieldEngine engine(lib, 1);
+  engine.Process(steps, 4);
+  VIS_CHECK( engine.GetNLocated() == 3 );
+  VIS_CHECK( engine.GetNSources() == 2 );
+  VIS_CHECK( engine.GetSiPM().empty() );
+
+  const auto& pe = engine.GetTile();
+  VIS_CHECK( int(pe.size()) == vis_tree::get_group_size(vis_tree::kGroupTileTot) );
+  const float* vis_a = lib.Get(vis_tree::kGroupTileTot, ia);
+  const float* vis_b = lib.Get(vis_tree::kGroupTileTot, ib);
+  int n_bad = 0;
+  for (size_t c = 0; c < pe.size(); c++) {
+    const double expected = (500.0 + 1000.0)*vis_a[c] + 2000.0*vis_b[c];
+    n_bad += (std::fabs(pe[c] - expected) > 1e-5*expected);
+  }
+  VIS_CHECK( n_bad == 0 );
+
+  // a new batch replaces the previous one
+  engine.Process(steps + 1, 1);
+  VIS_CHECK( engine.GetNSources() == 1 );
+  VIS_CHECK( std::fabs(pe[0] - 2000.0*vis_b[0]) <= 1e-5*2000.0*vis_b[0] );
+}
+
+int main() {
+  const TString path = "test_vis_yield.root";
+  write_library(path);
+
+  test_poisson();
+  test_merge(path);
+
+  gSystem->Unlink(path);
+  return vis_test::summary("test_vis_yield");
+}
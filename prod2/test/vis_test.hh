@@ -0,0 +1,36 @@
+/**
+ * @file        : vis_test.hh
+ */
+
+#ifndef VIS_TEST_HH
+#define VIS_TEST_HH
+
+#include <cstdio>
+
+/**
+ * Minimal check helper of the prod2 tests. Failed checks are printed and
+ * counted, the test executable returns the number of failures (ctest).
+ */
+namespace vis_test {
+
+  inline int& n_failed() {
+    static int n = 0;
+    return n;
+  }
+
+  inline void check(const bool& ok, const char* what, const char* file, const int& line) {
+    if (ok) return;
+    fprintf(stderr, "%s:%i: check failed: %s\n", file, line, what);
+    n_failed()++;
+  }
+
+  inline int summary(const char* test_name) {
+    if (n_failed() == 0) printf("%s: all checks passed\n", test_name);
+    else printf("%s: %i checks failed\n", test_name, n_failed());
+    return n_failed();
+  }
+}
+
+#define VIS_CHECK(cond) vis_test::check((cond), #cond, __FILE__, __LINE__)
+
+#endif /* end of include guard VIS_TEST_HH */
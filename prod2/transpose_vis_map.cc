@@ -0,0 +1,322 @@
+/**
+ * @file        : transpose_vis_map.cc
+ */
+
+#include <iostream>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <getopt.h>
+#include "TFile.h"
+#include "TTree.h"
+#include "TBranch.h"
+#include "TLeaf.h"
+
+#include "vis_quant.hh"
+#include "vis_compress.hh"
+#include "vis_tree_io.hh"
+#include "vis_library.hh"
+#include "vis_channel_map.hh"
+
+/**
+ * Transpose a make_vis_map library (point-major photonLib tree) into the
+ * channel-major layout of vis_channel_map.hh with bounded memory.
+ *
+ * The channels of a group are processed in blocks sized on the memory
+ * budget. For each block the input is read cluster by cluster with only
+ * the branches covering the block enabled; the entries of a cluster are
+ * staged in a (points x channels) buffer that is transposed in square
+ * tiles into the channel-major block, which is written once complete.
+ * Libraries larger than the budget take several passes over the input.
+ */
+
+struct GroupBranch {
+  TString name;
+  int offset = 0;
+  int size = 0;
+  vis_quant::QuantSpec spec;
+  bool shuffled = false;
+  std::vector<float> data;
+  std::vector<UShort_t> codes;
+};
+
+// Blocked transpose of a (n_rows x n_cols) row-major array into the
+// columns of dst (row stride dst_stride), tile x tile at a time
+void transpose_tiled(const float* src, const size_t& n_rows, const size_t& n_cols,
+    float* dst, const size_t& dst_stride, const size_t& tile)
+{
+  for (size_t r0 = 0; r0 < n_rows; r0 += tile) {
+    const size_t r1 = std::min(n_rows, r0 + tile);
+    for (size_t c0 = 0; c0 < n_cols; c0 += tile) {
+      const size_t c1 = std::min(n_cols, c0 + tile);
+      for (size_t c = c0; c < c1; c++) {
+        float* out = dst + c*dst_stride;
+        for (size_t r = r0; r < r1; r++) out[r] = src[r*n_cols + c];
+      }
+    }
+  }
+  return;
+}
+
+int transpose_group(TTree* lib, TFile* output_file, const int& group,
+    const size_t& memory_budget, const size_t& tile)
+{
+  const Long64_t n_points = lib->GetEntries();
+  const int n_channels = vis_tree::get_group_size(group);
+
+  std::vector<GroupBranch> branches;
+  int offset = 0;
+  for (const auto& br_name : vis_tree::get_group_branches(group)) {
+    // the leaf name may differ from the branch name (vis_sipm_edge00/vis_sipm_edge0)
+    TBranch* branch = lib->GetBranch(br_name);
+    TLeaf* leaf = (branch && branch->GetListOfLeaves()->GetEntries() == 1) ?
+      (TLeaf*)branch->GetListOfLeaves()->At(0) : nullptr;
+    if (leaf == nullptr) {
+      fprintf(stderr, "transpose_vis_map ERROR: Missing branch %s of group %s%s\n",
+          br_name.Data(), vis_tree::GROUP_LABEL[group],
+          group == vis_tree::kGroupSiPM ? " (use --no-sipm to skip it)" : "");
+      return 1;
+    }
+    GroupBranch br;
+    br.name = br_name;
+    br.offset = offset;
+    br.size = leaf->GetLenStatic();
+    br.spec = vis_quant::get_branch_spec(lib, br_name);
+    br.shuffled = vis_compress::is_shuffled(lib, br_name);
+    br.data.resize(br.size, 0.0);
+    if (br.spec.mode == vis_quant::kLogCode) br.codes.resize(br.size, 0);
+    offset += br.size;
+    branches.push_back( std::move(br) );
+  }
+  if (offset != n_channels) {
+    fprintf(stderr, "transpose_vis_map ERROR: Unexpected size of group %s (%i)\n",
+        vis_tree::GROUP_LABEL[group], offset);
+    return 1;
+  }
+
+  // channels per pass: the staging buffer of a cluster is bounded by the
+  // largest cluster, the rest of the budget goes to the channel-major block
+  Long64_t max_cluster = 1;
+  {
+    auto clusters = lib->GetClusterIterator(0);
+    Long64_t start = 0;
+    while ( (start = clusters.Next()) < n_points ) {
+      max_cluster = std::max(max_cluster, clusters.GetNextEntry() - start);
+    }
+  }
+  const size_t point_bytes = sizeof(float) * n_points;
+  size_t block = memory_budget / (point_bytes + sizeof(float)*max_cluster);
+  block = std::max<size_t>(1, std::min<size_t>(block, n_channels));
+  const int n_pass = (n_channels + block - 1) / block;
+  printf("transpose_vis_map: group %s, %i channels x %lld points, %i pass(es) of %zu channels\n",
+      vis_tree::GROUP_LABEL[group], n_channels, n_points, n_pass, block);
+
+  output_file->cd();
+  TTree* out = new TTree(vis_tree::get_channel_tree_name(group),
+      Form("SoLAr@ProtoDUNE3 Photon Library, %s by channel", vis_tree::GROUP_LABEL[group]));
+  int channel = 0;
+  int n_points_out = n_points;
+  std::vector<float> vis_out(n_points, 0.0);
+  out->Branch("channel", &channel, "channel/I");
+  out->Branch("n_points", &n_points_out, "n_points/I");
+  out->Branch("vis", vis_out.data(), "vis[n_points]/F");
+  out->SetBasketSize("vis", point_bytes + 1024);
+  // one channel per cluster: a channel query reads one basket
+  out->SetAutoFlush(1);
+
+  std::vector<float> block_data;
+  std::vector<float> staging;
+  std::vector<unsigned char> shuffle_tmp;
+  for (int c0 = 0; c0 < n_channels; c0 += block) {
+    const int c1 = std::min<int>(n_channels, c0 + block);
+    const size_t nb = c1 - c0;
+    block_data.assign(nb*n_points, 0.0);
+
+    lib->SetBranchStatus("*", 0);
+    for (auto& br : branches) {
+      if (br.offset >= c1 || br.offset + br.size <= c0) continue;
+      lib->SetBranchStatus(br.name, 1);
+      if (br.spec.mode == vis_quant::kLogCode) lib->SetBranchAddress(br.name, br.codes.data());
+      else lib->SetBranchAddress(br.name, br.data.data());
+    }
+
+    auto clusters = lib->GetClusterIterator(0);
+    Long64_t start = 0;
+    while ( (start = clusters.Next()) < n_points ) {
+      const Long64_t end = std::min(clusters.GetNextEntry(), n_points);
+      const size_t n_rows = end - start;
+      staging.resize(n_rows*nb);
+      for (Long64_t i = start; i < end; i++) {
+        lib->GetEntry(i);
+        float* row = &staging[(i - start)*nb];
+        for (auto& br : branches) {
+          const int lo = std::max(c0, br.offset);
+          const int hi = std::min(c1, br.offset + br.size);
+          if (lo >= hi) continue;
+          if (br.spec.mode == vis_quant::kLogCode) {
+            vis_quant::decode(br.codes.data(), br.data.data(), br.size, br.spec);
+          }
+          else if (br.shuffled) {
+            vis_compress::byte_unshuffle(br.data.data(), br.size, sizeof(float), shuffle_tmp);
+          }
+          std::copy(&br.data[lo - br.offset], &br.data[hi - br.offset], row + (lo - c0));
+        }
+      }
+      transpose_tiled(staging.data(), n_rows, nb, &block_data[start], n_points, tile);
+      printf("\r  channels [%i, %i): point %lld/%lld", c0, c1, end, n_points);
+      fflush(stdout);
+    }
+    printf("\n");
+
+    for (size_t k = 0; k < nb; k++) {
+      channel = c0 + k;
+      std::copy(&block_data[k*n_points], &block_data[(k+1)*n_points], vis_out.begin());
+      out->Fill();
+    }
+  }
+  lib->ResetBranchAddresses();
+
+  output_file->cd();
+  out->Write();
+  return 0;
+}
+
+int transpose_vis_map(
+    const TString& input_file_path,
+    const TString& output_file_path,
+    const unsigned& group_mask,
+    const size_t& memory_budget,
+    const size_t& tile)
+{
+  TFile* input_file = TFile::Open(input_file_path);
+  if (input_file == nullptr || input_file->IsZombie()) {
+    fprintf(stderr, "transpose_vis_map ERROR: Unable to open %s\n", input_file_path.Data());
+    return 1;
+  }
+  TTree* lib = input_file->Get<TTree>(vis_tree::LIB_TREE);
+  if (lib == nullptr) {
+    fprintf(stderr, "transpose_vis_map ERROR: No %s tree in %s\n",
+        vis_tree::LIB_TREE, input_file_path.Data());
+    return 1;
+  }
+  lib->SetCacheSize(256*1024*1024);
+
+  TFile* output_file = new TFile(output_file_path, "recreate");
+
+  // 1. Source points, in the library order
+  TTree* points = new TTree(vis_tree::POINTS_TREE, "SoLAr@ProtoDUNE3 Photon Library points");
+  float xyz[3] = {0, 0, 0};
+  points->Branch("x", &xyz[0], "x/F");
+  points->Branch("y", &xyz[1], "y/F");
+  points->Branch("z", &xyz[2], "z/F");
+  lib->SetBranchStatus("*", 0);
+  const char* axis_name[3] = {"x", "y", "z"};
+  for (int k = 0; k < 3; k++) {
+    lib->SetBranchStatus(axis_name[k], 1);
+    lib->SetBranchAddress(axis_name[k], &xyz[k]);
+  }
+  for (Long64_t i = 0; i < lib->GetEntries(); i++) {
+    lib->GetEntry(i);
+    points->Fill();
+  }
+  lib->ResetBranchAddresses();
+  points->Write();
+
+  // 2. Channel-major trees, one per group
+  int status = 0;
+  for (int ig = 0; ig < vis_tree::N_GROUP; ig++) {
+    // the arrival-time tables are not a per-channel scalar map
+    if (ig == vis_tree::kGroupTileTime) continue;
+    if ( (group_mask & (1u << ig)) == 0 ) continue;
+    status = transpose_group(lib, output_file, ig, memory_budget, tile);
+    if (status) break;
+  }
+
+  output_file->Close();
+  delete output_file;
+  input_file->Close();
+  delete input_file;
+
+  if (status == 0) printf("Output written to: %s\n", output_file_path.Data());
+  return status;
+}
+
+void print_usage() {
+  printf("transpose_vis_map usage:\n");
+  printf("\t-i | --input\tmake_vis_map library file\n");
+  printf("\t-o | --output\toutput file (default: <input>_bychannel.root)\n");
+  printf("\t-m | --memory\tmemory budget of a pass in MB (default: 2048)\n");
+  printf("\t-t | --tile\tedge of the transpose tiles (default: 64)\n");
+  printf("\t-n | --no-sipm\tskip the SiPM arrays\n");
+
+  return;
+}
+
+int main (int argc, char *argv[]) {
+  const char* short_opts = "i:o:m:t:nh";
+  static struct option long_opts[7] =
+  {
+    {"input", required_argument, 0, 'i'},
+    {"output", required_argument, 0, 'o'},
+    {"memory", required_argument, 0, 'm'},
+    {"tile", required_argument, 0, 't'},
+    {"no-sipm", no_argument, 0, 'n'},
+    {"help", no_argument, 0, 'h'},
+    {nullptr, no_argument, nullptr, 0}
+  };
+
+  int c, option_index;
+
+  TString input_file_path = "";
+  TString output_file_path = "";
+  size_t memory_mb = 2048;
+  size_t tile = 64;
+  unsigned group_mask = vis_tree::ALL_GROUPS;
+
+  while ( (c = getopt_long(argc, argv, short_opts, long_opts, &option_index)) != -1) {
+    switch(c) {
+      case 'i' :
+        input_file_path = optarg;
+        break;
+      case 'o' :
+        output_file_path = optarg;
+        break;
+      case 'm' :
+        memory_mb = std::max(1, atoi(optarg));
+        break;
+      case 't' :
+        tile = std::max(1, atoi(optarg));
+        break;
+      case 'n' :
+        group_mask &= ~(1u << vis_tree::kGroupSiPM);
+        break;
+      case 'h' :
+        print_usage();
+        exit( EXIT_SUCCESS );
+        break;
+      case '?' :
+        printf("transpose_vis_map error: unknown flag %c\n", optopt);
+        print_usage();
+        exit( EXIT_FAILURE );
+        break;
+    }
+  }
+
+  if (input_file_path.IsNull()) {
+    printf("transpose_vis_map error: no input library\n");
+    print_usage();
+    exit( EXIT_FAILURE );
+  }
+
+  if (output_file_path.IsNull()) {
+    output_file_path = input_file_path;
+    output_file_path.ReplaceAll(".root", "_bychannel.root");
+  }
+  if (output_file_path == input_file_path) {
+    printf("transpose_vis_map error: the output would overwrite the input library\n");
+    exit( EXIT_FAILURE );
+  }
+
+  return transpose_vis_map(input_file_path, output_file_path, group_mask,
+      memory_mb*1024*1024, tile);
+}
@@ -0,0 +1,121 @@
+/**
+ * @file        : vis_channel_map.hh
+ */
+
+#ifndef VIS_CHANNEL_MAP_HH
+#define VIS_CHANNEL_MAP_HH
+
+#include <cstdio>
+#include <vector>
+#include "TFile.h"
+#include "TTree.h"
+
+#include "vis_tree_io.hh"
+#include "vis_library.hh"
+
+/**
+ * Channel-major copy of a make_vis_map library (see transpose_vis_map).
+ *
+ * The source points are stored once in the POINTS_TREE (x, y, z, one entry
+ * per library entry). Each group has its own tree with one entry per
+ * channel, holding the visibility of that channel at all the points in
+ * the library order. Every entry is flushed as a cluster of its own, so
+ * reading the spatial map of a channel costs n_points*4 bytes before
+ * compression instead of a pass over the whole library.
+ */
+namespace vis_tree {
+
+  const char* const POINTS_TREE = "photonLibPoints";
+
+  inline TString get_channel_tree_name(const int& group) {
+    return Form("%sT_%s", LIB_TREE, GROUP_LABEL[group]);
+  }
+
+  class VisChannelMap {
+    public:
+      VisChannelMap() {}
+      ~VisChannelMap() {Close();}
+      VisChannelMap(const VisChannelMap&) = delete;
+      VisChannelMap& operator=(const VisChannelMap&) = delete;
+
+      bool Open(const TString& file_path) {
+        Close();
+        fFile = TFile::Open(file_path);
+        if (fFile == nullptr || fFile->IsZombie()) {
+          fprintf(stderr, "VisChannelMap ERROR: Unable to open %s\n", file_path.Data());
+          Close();
+          return false;
+        }
+
+        TTree* points = fFile->Get<TTree>(POINTS_TREE);
+        if (points == nullptr) {
+          fprintf(stderr, "VisChannelMap ERROR: No %s tree in %s\n", POINTS_TREE, file_path.Data());
+          Close();
+          return false;
+        }
+        const Long64_t n_points = points->GetEntries();
+        float xyz[3] = {0, 0, 0};
+        points->SetBranchAddress("x", &xyz[0]);
+        points->SetBranchAddress("y", &xyz[1]);
+        points->SetBranchAddress("z", &xyz[2]);
+        fCoords.resize(3*n_points);
+        for (Long64_t i = 0; i < n_points; i++) {
+          points->GetEntry(i);
+          std::copy(xyz, xyz+3, &fCoords[3*i]);
+        }
+        points->ResetBranchAddresses();
+
+        for (int ig = 0; ig < N_GROUP; ig++) {
+          fTree[ig] = fFile->Get<TTree>(get_channel_tree_name(ig));
+        }
+        return true;
+      }
+
+      void Close() {
+        if (fFile) {
+          fFile->Close();
+          delete fFile;
+        }
+        fFile = nullptr;
+        for (auto& t : fTree) t = nullptr;
+        fCoords.clear();
+      }
+
+      size_t GetNPoints() const {return fCoords.size() / 3;}
+
+      const float* GetCoords(const size_t& ipoint) const {return &fCoords[3*ipoint];}
+
+      bool HasGroup(const int& group) const {return fTree[group] != nullptr;}
+
+      Long64_t GetNChannels(const int& group) const {
+        return fTree[group] ? fTree[group]->GetEntries() : 0;
+      }
+
+      /**
+       * Spatial map of a channel of the group (index in the concatenated
+       * main, edge0, edge1 list), vis[ipoint] follows the GetCoords order.
+       */
+      bool Get(const int& group, const Long64_t& channel, std::vector<float>& vis) {
+        if (HasGroup(group) == false || channel < 0 || channel >= GetNChannels(group)) {
+          return false;
+        }
+        vis.resize(GetNPoints());
+        TTree* tree = fTree[group];
+        int n_points = 0;
+        tree->SetBranchAddress("n_points", &n_points);
+        tree->SetBranchAddress("vis", vis.data());
+        tree->GetEntry(channel);
+        tree->ResetBranchAddresses();
+        return (size_t)n_points == GetNPoints();
+      }
+
+      Long64_t GetBytesRead() const {return fFile ? fFile->GetBytesRead() : 0;}
+
+    private:
+      TFile* fFile = nullptr;
+      TTree* fTree[N_GROUP] = {nullptr};
+      std::vector<float> fCoords;
+  };
+}
+
+#endif /* end of include guard VIS_CHANNEL_MAP_HH */
@@ -0,0 +1,132 @@
+/**
+ * @file        : vis_client.cc
+ */
+
+#include <cstdio>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "vis_client.hh"
+
+namespace vis_service {
+
+  bool read_full(int fd, void* buf, size_t len) {
+    char* ptr = static_cast<char*>(buf);
+    while (len > 0) {
+      const ssize_t n = ::recv(fd, ptr, len, 0);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      ptr += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  bool write_full(int fd, const void* buf, size_t len) {
+    const char* ptr = static_cast<const char*>(buf);
+    while (len > 0) {
+      const ssize_t n = ::send(fd, ptr, len, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      ptr += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  VisClient::~VisClient() {
+    Close();
+  }
+
+  bool VisClient::Connect(const std::string& socket_path) {
+    Close();
+
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+      fprintf(stderr, "VisClient ERROR: socket path too long: %s\n", socket_path.c_str());
+      return false;
+    }
+    std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path)-1);
+
+    fSocket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fSocket < 0) {
+      perror("VisClient ERROR: socket");
+      return false;
+    }
+    if (::connect(fSocket, (sockaddr*)&addr, sizeof(addr)) < 0) {
+      fprintf(stderr, "VisClient ERROR: Unable to connect to %s: %s\n",
+          socket_path.c_str(), strerror(errno));
+      Close();
+      return false;
+    }
+    return true;
+  }
+
+  void VisClient::Close() {
+    if (fSocket >= 0) ::close(fSocket);
+    fSocket = -1;
+  }
+
+  int VisClient::QueryBatch(const uint32_t& kind, const float* xyz, const uint32_t& n_points,
+      std::vector<float>& out, uint32_t& n_channels)
+  {
+    const RequestHeader req = {MAGIC, kind, n_points, 0};
+    if (write_full(fSocket, &req, sizeof(req)) == false ||
+        write_full(fSocket, xyz, 3*sizeof(float)*n_points) == false) {
+      Close();
+      return kBadRequest;
+    }
+
+    ReplyHeader rep;
+    if (read_full(fSocket, &rep, sizeof(rep)) == false || rep.magic != MAGIC) {
+      Close();
+      return kBadRequest;
+    }
+    n_channels = rep.n_channels;
+    if (rep.status != kOk) return rep.status;
+
+    const size_t offset = out.size();
+    out.resize( offset + size_t(rep.n_points) * rep.n_channels );
+    if (read_full(fSocket, out.data() + offset, sizeof(float)*(out.size() - offset)) == false) {
+      Close();
+      return kBadRequest;
+    }
+
+    return kOk;
+  }
+
+  int VisClient::Query(const uint32_t& kind, const float* xyz, const uint32_t& n_points,
+      std::vector<float>& out, uint32_t* n_channels)
+  {
+    if (fSocket < 0 || n_points > MAX_BATCH_POINTS) return kBadRequest;
+
+    uint32_t nch = 0;
+    out.clear();
+    int status = QueryBatch(kind, xyz, n_points, out, nch);
+
+    // reply over MAX_REPLY_FLOATS: the server gave the number of channels,
+    // split the points in batches that fit
+    if (status == kTooLarge && nch > 0) {
+      const uint32_t batch = std::max<size_t>(MAX_REPLY_FLOATS / nch, 1);
+      out.reserve( size_t(n_points) * nch );
+      status = kOk;
+      for (uint32_t i = 0; i < n_points && status == kOk; i += batch) {
+        status = QueryBatch(kind, xyz + 3*size_t(i), std::min(batch, n_points - i), out, nch);
+      }
+    }
+    if (status != kOk) return status;
+    if (n_channels) *n_channels = nch;
+
+    return kOk;
+  }
+
+  int VisClient::GetInfo(std::vector<float>& info) {
+    return Query(kInfo, nullptr, 0, info);
+  }
+}
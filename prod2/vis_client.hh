@@ -0,0 +1,100 @@
+/**
+ * @file        : vis_client.hh
+ */
+
+#ifndef VIS_CLIENT_HH
+#define VIS_CLIENT_HH
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Client of the local visibility query service (vis_server).
+ *
+ * The server loads a make_vis_map library once and answers batched
+ * queries over a Unix domain socket, so that many fast-simulation workers
+ * on the same node share a single copy of the library. The protocol is a
+ * fixed header followed by the payload, in native byte order:
+ *
+ *   request: RequestHeader + n_points * {x, y, z} (float, mm)
+ *   reply  : ReplyHeader   + n_points * n_channels (float)
+ *
+ * Points outside the library grid get zero visibility. A reply is limited
+ * to MAX_REPLY_FLOATS values: larger requests get kTooLarge, with the
+ * number of channels of the query in the reply header, and VisClient
+ * splits them in batches. This header does not depend on ROOT.
+ */
+namespace vis_service {
+
+  const uint32_t MAGIC = 0x53565153; // "SQVS"
+  const uint32_t MAX_BATCH_POINTS = 1u << 20;
+  const size_t MAX_REPLY_FLOATS = size_t(1) << 24; // 64 MB per reply
+  const char* const DEFAULT_SOCKET = "/tmp/solar_vis.sock";
+
+  // Query kinds, matching the vis_tree::EVisGroup of the library
+  enum EQueryKind : uint32_t {
+    kVisTot = 0, kVisDir = 1, kVisWls = 2,
+    kTileTot = 3, kTileDir = 4, kTileWls = 5,
+    kSiPM = 6,
+    kTileTime = 7, // N_QUANT arrival-time quantiles (ns) per tile
+    kInfo = 100  // library bounds: {xmin, xmax, ymin, ymax, zmin, zmax, n_points}
+  };
+
+  const uint32_t INFO_SIZE = 7;
+
+  enum EStatus : int32_t {
+    kOk = 0, kBadRequest = 1, kGroupNotLoaded = 2, kTooLarge = 3
+  };
+
+  struct RequestHeader {
+    uint32_t magic;
+    uint32_t kind;
+    uint32_t n_points;
+    uint32_t reserved;
+  };
+
+  struct ReplyHeader {
+    uint32_t magic;
+    int32_t  status;
+    uint32_t n_points;
+    uint32_t n_channels;
+  };
+
+  // Blocking full-length socket I/O, return false on error or closed peer
+  bool read_full(int fd, void* buf, size_t len);
+  bool write_full(int fd, const void* buf, size_t len);
+
+  class VisClient {
+    public:
+      VisClient() {}
+      ~VisClient();
+      VisClient(const VisClient&) = delete;
+      VisClient& operator=(const VisClient&) = delete;
+
+      bool Connect(const std::string& socket_path = DEFAULT_SOCKET);
+      void Close();
+      bool IsConnected() const {return fSocket >= 0;}
+
+      /**
+       * Query the visibility of n_points positions (xyz: 3*n_points floats).
+       * On success out holds n_points * n_channels values, point-major, and
+       * the return value is kOk. Queries with a reply larger than
+       * MAX_REPLY_FLOATS are sent in several batches.
+       */
+      int Query(const uint32_t& kind, const float* xyz, const uint32_t& n_points,
+          std::vector<float>& out, uint32_t* n_channels = nullptr);
+
+      // Library bounding box and number of points
+      int GetInfo(std::vector<float>& info);
+
+    private:
+      // Single request, the reply is appended to out
+      int QueryBatch(const uint32_t& kind, const float* xyz, const uint32_t& n_points,
+          std::vector<float>& out, uint32_t& n_channels);
+
+      int fSocket = -1;
+  };
+}
+
+#endif /* end of include guard VIS_CLIENT_HH */
@@ -0,0 +1,165 @@
+/**
+ * @file        : vis_client_bench.cc
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <getopt.h>
+
+#include "vis_client.hh"
+
+/**
+ * Load test of the visibility query service: a number of concurrent
+ * clients, each with its own connection, send batches of random points
+ * inside the library bounds for a fixed time. Reports the latency
+ * percentiles of the queries and the aggregated throughput.
+ */
+
+struct ClientResult {
+  std::vector<double> latency_us;
+  long n_points = 0;
+  int  n_errors = 0;
+};
+
+void run_client(const std::string& socket_path, const uint32_t kind,
+    const uint32_t batch_size, const double duration_s, const std::vector<float>& info,
+    const unsigned seed, ClientResult& result)
+{
+  vis_service::VisClient client;
+  if (client.Connect(socket_path) == false) {
+    result.n_errors++;
+    return;
+  }
+
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> ux(info[0], info[1]);
+  std::uniform_real_distribution<float> uy(info[2], info[3]);
+  std::uniform_real_distribution<float> uz(info[4], info[5]);
+  std::vector<float> points(3*batch_size);
+  std::vector<float> vis;
+
+  const auto t_end = std::chrono::steady_clock::now() + std::chrono::duration<double>(duration_s);
+  while (std::chrono::steady_clock::now() < t_end) {
+    for (uint32_t i = 0; i < batch_size; i++) {
+      points[3*i  ] = ux(rng);
+      points[3*i+1] = uy(rng);
+      points[3*i+2] = uz(rng);
+    }
+    const auto t0 = std::chrono::steady_clock::now();
+    const int status = client.Query(kind, points.data(), batch_size, vis);
+    const auto t1 = std::chrono::steady_clock::now();
+    if (status != vis_service::kOk) {
+      result.n_errors++;
+      if (client.IsConnected() == false) break;
+      continue;
+    }
+    result.latency_us.push_back( std::chrono::duration<double, std::micro>(t1 - t0).count() );
+    result.n_points += batch_size;
+  }
+
+  return;
+}
+
+void print_usage() {
+  printf("vis_client_bench usage:\n");
+  printf("\t-s | --socket\tUnix socket path (default: %s)\n", vis_service::DEFAULT_SOCKET);
+  printf("\t-c | --clients\tnumber of concurrent clients (default: 64)\n");
+  printf("\t-b | --batch\tpoints per query (default: 256)\n");
+  printf("\t-k | --kind\tquery kind: 0-2 vis tot/dir/wls, 3-5 tile tot/dir/wls, 6 SiPM, 7 tile time (default: 3)\n");
+  printf("\t-t | --time\tduration of the test in seconds (default: 10)\n");
+
+  return;
+}
+
+int main (int argc, char *argv[]) {
+  const char* short_opts = "s:c:b:k:t:h";
+  static struct option long_opts[7] =
+  {
+    {"socket", required_argument, 0, 's'},
+    {"clients", required_argument, 0, 'c'},
+    {"batch", required_argument, 0, 'b'},
+    {"kind", required_argument, 0, 'k'},
+    {"time", required_argument, 0, 't'},
+    {"help", no_argument, 0, 'h'},
+    {nullptr, no_argument, nullptr, 0}
+  };
+
+  int c, option_index;
+
+  std::string socket_path = vis_service::DEFAULT_SOCKET;
+  int n_clients = 64;
+  uint32_t batch_size = 256;
+  uint32_t kind = vis_service::kTileTot;
+  double duration_s = 10.0;
+
+  while ( (c = getopt_long(argc, argv, short_opts, long_opts, &option_index)) != -1) {
+    switch(c) {
+      case 's' : socket_path = optarg; break;
+      case 'c' : n_clients = std::max(1, atoi(optarg)); break;
+      case 'b' : batch_size = std::max(1, atoi(optarg)); break;
+      case 'k' : kind = atoi(optarg); break;
+      case 't' : duration_s = atof(optarg); break;
+      case 'h' :
+        print_usage();
+        exit( EXIT_SUCCESS );
+        break;
+      case '?' :
+        printf("vis_client_bench error: unknown flag %c\n", optopt);
+        print_usage();
+        exit( EXIT_FAILURE );
+        break;
+    }
+  }
+
+  std::vector<float> info;
+  {
+    vis_service::VisClient client;
+    if (client.Connect(socket_path) == false || client.GetInfo(info) != vis_service::kOk) {
+      fprintf(stderr, "vis_client_bench ERROR: Unable to query the server on %s\n", socket_path.c_str());
+      return 1;
+    }
+  }
+  printf("Library: %.0f points, x [%g, %g], y [%g, %g], z [%g, %g]\n",
+      info[6], info[0], info[1], info[2], info[3], info[4], info[5]);
+
+  std::vector<ClientResult> results(n_clients);
+  std::vector<std::thread> clients;
+  const auto t0 = std::chrono::steady_clock::now();
+  for (int i = 0; i < n_clients; i++) {
+    clients.emplace_back(run_client, socket_path, kind, batch_size, duration_s,
+        std::cref(info), 1234u + i, std::ref(results[i]));
+  }
+  for (auto& t : clients) t.join();
+  const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+  std::vector<double> latency;
+  long n_points = 0;
+  int n_errors = 0;
+  for (const auto& r : results) {
+    latency.insert(latency.end(), r.latency_us.begin(), r.latency_us.end());
+    n_points += r.n_points;
+    n_errors += r.n_errors;
+  }
+  if (latency.empty()) {
+    fprintf(stderr, "vis_client_bench ERROR: no successful query (%i errors)\n", n_errors);
+    return 1;
+  }
+  std::sort(latency.begin(), latency.end());
+  auto percentile = [&latency](const double& q) {
+    return latency[ std::min(latency.size()-1, size_t(q*latency.size())) ];
+  };
+
+  printf("\n%i clients, batch %u, kind %u, %.1f s\n", n_clients, batch_size, kind, elapsed);
+  printf("  queries    : %zu (%i errors)\n", latency.size(), n_errors);
+  printf("  throughput : %.1f queries/s, %.3g points/s\n",
+      latency.size() / elapsed, n_points / elapsed);
+  printf("  latency    : p50 %.1f us, p90 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+      percentile(0.50), percentile(0.90), percentile(0.99), percentile(0.999), latency.back());
+
+  return n_errors ? 1 : 0;
+}
@@ -0,0 +1,201 @@
+/**
+ * @file        : vis_compress.hh
+ */
+
+#ifndef VIS_COMPRESS_HH
+#define VIS_COMPRESS_HH
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "Compression.h"
+#include "TString.h"
+#include "TRegexp.h"
+#include "TObjArray.h"
+#include "TObjString.h"
+#include "TNamed.h"
+#include "TList.h"
+#include "TTree.h"
+#include "TBranch.h"
+
+/**
+ * Per-branch compression of the photon library outputs.
+ *
+ * A codec is written as `<algorithm>:<level>[:shuffle]` with algorithm one
+ * of `zlib`, `lzma`, `lz4`, `zstd`, or just `none`. A policy is an ordered
+ * list of `<branch wildcard>=<codec>` rules (last match wins) plus a
+ * default codec for the file and the unmatched branches, e.g.
+ *
+ *    -z "*=lz4:4" -z "vis_*_tile_*=zstd:5" -z "vis_sipm_*=zstd:5:shuffle"
+ *
+ * The `shuffle` flag byte-transposes the float arrays of an entry before
+ * compression (all the first bytes, then all the second bytes, ...): the
+ * exponent bytes of neighbouring channels are then grouped together and
+ * compress much better. ROOT does not undo it, shuffled branches are
+ * recorded in the tree UserInfo as a TNamed("shuffle:<branch>", "4") and
+ * must be restored with vis_compress::byte_unshuffle after reading.
+ */
+namespace vis_compress {
+
+  struct CodecSpec {
+    int  algorithm = ROOT::kUndefinedCompressionAlgorithm;
+    int  level = 0;
+    bool shuffle = false;
+
+    bool IsSet() const {return algorithm != ROOT::kUndefinedCompressionAlgorithm;}
+
+    int Settings() const {
+      return ROOT::CompressionSettings((ROOT::ECompressionAlgorithm)algorithm, level);
+    }
+
+    TString Encode() const {
+      const char* name = "none";
+      if (level > 0) {
+        if (algorithm == ROOT::kZLIB) name = "zlib";
+        else if (algorithm == ROOT::kLZMA) name = "lzma";
+        else if (algorithm == ROOT::kLZ4) name = "lz4";
+        else if (algorithm == ROOT::kZSTD) name = "zstd";
+      }
+      if (level == 0) return shuffle ? "none:0:shuffle" : name;
+      return Form("%s:%i%s", name, level, shuffle ? ":shuffle" : "");
+    }
+  };
+
+  inline bool parse_codec(const TString& str, CodecSpec& spec) {
+    TObjArray* tokens = str.Tokenize(":");
+    const int ntok = tokens->GetEntries();
+    std::vector<TString> tok;
+    for (int i = 0; i < ntok; i++) tok.push_back(((TObjString*)tokens->At(i))->GetString());
+    delete tokens;
+
+    spec = CodecSpec();
+    if (ntok == 0) return false;
+    if (tok[0] == "none") {
+      spec.algorithm = ROOT::kZLIB;
+      spec.level = 0;
+      spec.shuffle = (ntok == 3 && tok[2] == "shuffle");
+      return ntok == 1 || (ntok == 3 && spec.shuffle);
+    }
+    if (ntok < 2 || ntok > 3) return false;
+    if (tok[0] == "zlib") spec.algorithm = ROOT::kZLIB;
+    else if (tok[0] == "lzma") spec.algorithm = ROOT::kLZMA;
+    else if (tok[0] == "lz4") spec.algorithm = ROOT::kLZ4;
+    else if (tok[0] == "zstd") spec.algorithm = ROOT::kZSTD;
+    else return false;
+    spec.level = tok[1].Atoi();
+    if (ntok == 3) {
+      if (tok[2] != "shuffle") return false;
+      spec.shuffle = true;
+    }
+    return (spec.level >= 1 && spec.level <= 9);
+  }
+
+  /**
+   * Ordered list of `<branch wildcard>=<codec>` rules. A rule without the
+   * `=` sets the default codec, used for the output file and for the
+   * branches not matched by any rule.
+   */
+  class CompressionPolicy {
+    public:
+      bool AddRule(const TString& rule) {
+        const Ssiz_t ieq = rule.Index("=");
+        CodecSpec spec;
+        if (ieq == kNPOS) {
+          if (parse_codec(rule, spec) == false) return false;
+          fDefault = spec;
+          return true;
+        }
+        if (parse_codec(rule(ieq+1, rule.Length()-ieq-1), spec) == false) return false;
+        fPatterns.push_back( rule(0, ieq) );
+        fSpecs.push_back( spec );
+        return true;
+      }
+
+      void SetDefault(const CodecSpec& spec) {fDefault = spec;}
+
+      CodecSpec GetDefault() const {return fDefault;}
+
+      CodecSpec GetSpec(const TString& branch_name) const {
+        CodecSpec spec = fDefault;
+        for (size_t i = 0; i < fPatterns.size(); i++) {
+          TRegexp re(fPatterns[i], kTRUE);
+          Ssiz_t len = 0;
+          if (branch_name.Index(re, &len) == 0 && len == branch_name.Length()) {
+            spec = fSpecs[i];
+          }
+        }
+        return spec;
+      }
+
+      // Settings for the output TFile (the caller's fallback if no default)
+      int GetFileSettings(const int& fallback) const {
+        return fDefault.IsSet() ? fDefault.Settings() : fallback;
+      }
+
+      /**
+       * Set the codec of each branch of the tree, the unmatched branches get
+       * the file settings (cloned branches would otherwise keep the ones of
+       * their source). Call it after booking the branches, before the first
+       * Fill.
+       */
+      void Apply(TTree* tree, const int& file_settings) const {
+        for (TObject* obj : *tree->GetListOfBranches()) {
+          TBranch* br = (TBranch*)obj;
+          const CodecSpec spec = GetSpec(br->GetName());
+          br->SetCompressionSettings(spec.IsSet() ? spec.Settings() : file_settings);
+        }
+      }
+
+      bool HasShuffle() const {
+        if (fDefault.shuffle) return true;
+        for (const auto& s : fSpecs) if (s.shuffle) return true;
+        return false;
+      }
+
+      bool IsEmpty() const {return fPatterns.empty() && fDefault.IsSet() == false;}
+
+    private:
+      CodecSpec fDefault;
+      std::vector<TString> fPatterns;
+      std::vector<CodecSpec> fSpecs;
+  };
+
+  // Byte-transpose n elements of the given width (bytes) from src to dst
+  inline void byte_shuffle(const void* src, void* dst, const size_t& n, const size_t& width) {
+    const unsigned char* in = static_cast<const unsigned char*>(src);
+    unsigned char* out = static_cast<unsigned char*>(dst);
+    for (size_t b = 0; b < width; b++) {
+      for (size_t i = 0; i < n; i++) out[b*n + i] = in[i*width + b];
+    }
+  }
+
+  inline void byte_unshuffle(const void* src, void* dst, const size_t& n, const size_t& width) {
+    const unsigned char* in = static_cast<const unsigned char*>(src);
+    unsigned char* out = static_cast<unsigned char*>(dst);
+    for (size_t b = 0; b < width; b++) {
+      for (size_t i = 0; i < n; i++) out[i*width + b] = in[b*n + i];
+    }
+  }
+
+  // In-place variant, tmp is resized as needed
+  inline void byte_unshuffle(void* data, const size_t& n, const size_t& width,
+      std::vector<unsigned char>& tmp)
+  {
+    tmp.resize(n*width);
+    std::memcpy(tmp.data(), data, n*width);
+    byte_unshuffle(tmp.data(), data, n, width);
+  }
+
+  inline bool is_shuffled(TTree* tree, const TString& branch_name) {
+    return tree->GetUserInfo()->FindObject("shuffle:" + branch_name) != nullptr;
+  }
+
+  inline void set_shuffled(TTree* tree, const TString& branch_name, const bool& shuffled) {
+    TList* info = tree->GetUserInfo();
+    TObject* old = info->FindObject("shuffle:" + branch_name);
+    if (old) { info->Remove(old); delete old; }
+    if (shuffled) info->Add( new TNamed("shuffle:" + branch_name, TString("4")) );
+  }
+}
+
+#endif /* end of include guard VIS_COMPRESS_HH */
@@ -0,0 +1,416 @@
+/**
+ * @file        : vis_export.cc
+ */
+
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <cerrno>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "TFile.h"
+#include "TTree.h"
+#include "TLeaf.h"
+#include "TBranch.h"
+#include "TObjArray.h"
+#include "TObjString.h"
+
+#include "vis_quant.hh"
+#include "vis_compress.hh"
+#include "vis_tree_io.hh"
+#include "vis_export.h"
+
+namespace vis_export {
+
+  const int64_t DEFAULT_CHUNK_ROWS = 4096;
+  const Long64_t CACHE_SIZE = 64*1024*1024;
+
+  thread_local std::string g_last_error;
+
+  struct Column {
+    std::string name;
+    TBranch* branch;
+    int32_t type;
+    int32_t width;
+    vis_quant::QuantSpec spec;
+    bool shuffled;
+  };
+
+  // Buffers of one chunk (4-byte values, row-major per column), shared
+  // between the strided view and the Arrow batches exported from it
+  struct Chunk {
+    int64_t rows = 0;
+    std::vector<std::vector<float>> data;
+  };
+
+  // Leaf types that can be exported without conversion (or after decoding)
+  inline bool get_export_type(TLeaf* leaf, const vis_quant::QuantSpec& spec, int32_t& type) {
+    const TString type_name = leaf->GetTypeName();
+    if (type_name == "Float_t" || type_name == "Float16_t") type = VIS_EXPORT_FLOAT32;
+    else if (type_name == "UShort_t" && spec.mode == vis_quant::kLogCode) type = VIS_EXPORT_FLOAT32;
+    else if (type_name == "UInt_t") type = VIS_EXPORT_UINT32;
+    else if (type_name == "Int_t") type = VIS_EXPORT_INT32;
+    else return false;
+    return true;
+  }
+
+  inline const char* get_arrow_format(const int32_t& type) {
+    if (type == VIS_EXPORT_UINT32) return "I";
+    if (type == VIS_EXPORT_INT32) return "i";
+    return "f";
+  }
+}
+
+struct VisExportReader {
+  TFile* file = nullptr;
+  TTree* tree = nullptr;
+  std::vector<vis_export::Column> columns;
+  int64_t chunk_rows = vis_export::DEFAULT_CHUNK_ROWS;
+  int64_t next_row = 0;
+  std::shared_ptr<vis_export::Chunk> current;
+  // one-row staging buffer per column, the branch addresses point there
+  std::vector<std::vector<UInt_t>> row_buffers;
+  std::string error;
+};
+
+namespace {
+
+  void set_error(VisExportReader* reader, const char* fmt, ...) {
+    char msg[1024];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, args);
+    va_end(args);
+    vis_export::g_last_error = msg;
+    if (reader) reader->error = msg;
+  }
+
+  /**
+   * Read the next rows into chunk. The entries are read row by row with
+   * all the columns at once, so the TTreeCache is filled once per cluster,
+   * and copied from the staging buffers into the rows of the chunk:
+   * log-coded branches are decoded, shuffled branches unshuffled.
+   */
+  bool read_chunk(VisExportReader* reader, vis_export::Chunk& chunk) {
+    const int64_t n_rows = std::min<int64_t>(reader->chunk_rows,
+        reader->tree->GetEntries() - reader->next_row);
+    chunk.rows = std::max<int64_t>(n_rows, 0);
+    chunk.data.resize(reader->columns.size());
+    for (size_t icol = 0; icol < reader->columns.size(); icol++) {
+      chunk.data[icol].resize(chunk.rows*reader->columns[icol].width);
+    }
+
+    for (int64_t r = 0; r < chunk.rows; r++) {
+      if (reader->tree->GetEntry(reader->next_row + r) <= 0) {
+        set_error(reader, "vis_export ERROR: unable to read entry %lld", reader->next_row + r);
+        return false;
+      }
+      for (size_t icol = 0; icol < reader->columns.size(); icol++) {
+        const auto& col = reader->columns[icol];
+        const UInt_t* src = reader->row_buffers[icol].data();
+        float* dst = &chunk.data[icol][r*col.width];
+        if (col.spec.mode == vis_quant::kLogCode) {
+          vis_quant::decode(reinterpret_cast<const UShort_t*>(src), dst, col.width, col.spec);
+        }
+        else if (col.shuffled) {
+          vis_compress::byte_unshuffle(src, dst, col.width, sizeof(float));
+        }
+        else {
+          std::memcpy(dst, src, sizeof(float)*col.width);
+        }
+      }
+    }
+    reader->next_row += chunk.rows;
+    return true;
+  }
+
+  // Arrow schema nodes own their strings and children
+  struct SchemaNode {
+    std::string format;
+    std::string name;
+    std::vector<ArrowSchema*> children;
+  };
+
+  void release_schema(ArrowSchema* schema) {
+    auto* node = static_cast<SchemaNode*>(schema->private_data);
+    for (ArrowSchema* child : node->children) {
+      if (child->release) child->release(child);
+      delete child;
+    }
+    delete node;
+    schema->release = nullptr;
+  }
+
+  void init_schema(ArrowSchema* schema, const std::string& format, const std::string& name) {
+    auto* node = new SchemaNode{format, name, {}};
+    schema->format = node->format.c_str();
+    schema->name = node->name.c_str();
+    schema->metadata = nullptr;
+    schema->flags = 0;
+    schema->n_children = 0;
+    schema->children = nullptr;
+    schema->dictionary = nullptr;
+    schema->release = release_schema;
+    schema->private_data = node;
+  }
+
+  ArrowSchema* add_child(ArrowSchema* parent, const std::string& format, const std::string& name) {
+    auto* node = static_cast<SchemaNode*>(parent->private_data);
+    ArrowSchema* child = new ArrowSchema;
+    init_schema(child, format, name);
+    node->children.push_back(child);
+    parent->n_children = node->children.size();
+    parent->children = node->children.data();
+    return child;
+  }
+
+  void build_schema(const VisExportReader* reader, ArrowSchema* schema) {
+    init_schema(schema, "+s", "");
+    for (const auto& col : reader->columns) {
+      const char* format = vis_export::get_arrow_format(col.type);
+      if (col.width == 1) {
+        add_child(schema, format, col.name);
+      }
+      else {
+        ArrowSchema* list = add_child(schema, "+w:" + std::to_string(col.width), col.name);
+        add_child(list, format, "item");
+      }
+    }
+  }
+
+  // Arrow array nodes keep the chunk alive, no data is copied
+  struct ArrayNode {
+    std::shared_ptr<vis_export::Chunk> chunk;
+    const void* buffers[2];
+    std::vector<ArrowArray*> children;
+  };
+
+  void release_array(ArrowArray* array) {
+    auto* node = static_cast<ArrayNode*>(array->private_data);
+    for (ArrowArray* child : node->children) {
+      if (child->release) child->release(child);
+      delete child;
+    }
+    delete node;
+    array->release = nullptr;
+  }
+
+  void init_array(ArrowArray* array, const std::shared_ptr<vis_export::Chunk>& chunk,
+      const int64_t& length, const void* data)
+  {
+    auto* node = new ArrayNode{chunk, {nullptr, data}, {}};
+    array->length = length;
+    array->null_count = 0;
+    array->offset = 0;
+    array->n_buffers = (data == nullptr) ? 1 : 2;  // validity (absent) [+ values]
+    array->n_children = 0;
+    array->buffers = node->buffers;
+    array->children = nullptr;
+    array->dictionary = nullptr;
+    array->release = release_array;
+    array->private_data = node;
+  }
+
+  ArrowArray* add_child(ArrowArray* parent, const int64_t& length, const void* data) {
+    auto* node = static_cast<ArrayNode*>(parent->private_data);
+    ArrowArray* child = new ArrowArray;
+    init_array(child, node->chunk, length, data);
+    node->children.push_back(child);
+    parent->n_children = node->children.size();
+    parent->children = node->children.data();
+    return child;
+  }
+
+  void export_chunk(const VisExportReader* reader,
+      const std::shared_ptr<vis_export::Chunk>& chunk, ArrowArray* array)
+  {
+    init_array(array, chunk, chunk->rows, nullptr);
+    for (size_t icol = 0; icol < reader->columns.size(); icol++) {
+      const auto& col = reader->columns[icol];
+      const float* data = chunk->data[icol].data();
+      if (col.width == 1) {
+        add_child(array, chunk->rows, data);
+      }
+      else {
+        ArrowArray* list = add_child(array, chunk->rows, nullptr);
+        add_child(list, chunk->rows*col.width, data);
+      }
+    }
+  }
+
+  VisExportReader* get_reader(ArrowArrayStream* stream) {
+    return static_cast<VisExportReader*>(stream->private_data);
+  }
+
+  int stream_get_schema(ArrowArrayStream* stream, ArrowSchema* out) {
+    build_schema(get_reader(stream), out);
+    return 0;
+  }
+
+  int stream_get_next(ArrowArrayStream* stream, ArrowArray* out) {
+    VisExportReader* reader = get_reader(stream);
+    if (reader->next_row >= reader->tree->GetEntries()) {
+      out->release = nullptr;  // end of stream
+      return 0;
+    }
+    // every batch owns its buffers, the consumer may keep it
+    auto chunk = std::make_shared<vis_export::Chunk>();
+    if (read_chunk(reader, *chunk) == false) return EIO;
+    export_chunk(reader, chunk, out);
+    return 0;
+  }
+
+  const char* stream_get_last_error(ArrowArrayStream* stream) {
+    const VisExportReader* reader = get_reader(stream);
+    return reader->error.empty() ? nullptr : reader->error.c_str();
+  }
+
+  void stream_release(ArrowArrayStream* stream) {
+    vis_export_close(get_reader(stream));
+    stream->private_data = nullptr;
+    stream->release = nullptr;
+  }
+}
+
+extern "C" {
+
+VisExportReader* vis_export_open(const char* path, const char* columns, int64_t chunk_rows) {
+  TFile* file = TFile::Open(path);
+  if (file == nullptr || file->IsZombie()) {
+    set_error(nullptr, "vis_export ERROR: Unable to open %s", path);
+    delete file;
+    return nullptr;
+  }
+  TTree* tree = file->Get<TTree>(vis_tree::LIB_TREE);
+  if (tree == nullptr) {
+    set_error(nullptr, "vis_export ERROR: No %s tree in %s", vis_tree::LIB_TREE, path);
+    file->Close();
+    delete file;
+    return nullptr;
+  }
+
+  auto* reader = new VisExportReader();
+  reader->file = file;
+  reader->tree = tree;
+  if (chunk_rows > 0) reader->chunk_rows = chunk_rows;
+
+  // requested columns, all the supported branches by default
+  const TString column_list = (columns == nullptr) ? "" : columns;
+  std::vector<TString> names;
+  if (column_list.IsNull()) {
+    for (TObject* obj : *tree->GetListOfBranches()) names.push_back(obj->GetName());
+  }
+  else {
+    TObjArray* tokens = column_list.Tokenize(",");
+    for (TObject* obj : *tokens) names.push_back( ((TObjString*)obj)->GetString().Strip(TString::kBoth) );
+    delete tokens;
+  }
+
+  for (const auto& name : names) {
+    TBranch* branch = tree->GetBranch(name);
+    TLeaf* leaf = (branch && branch->GetListOfLeaves()->GetEntries() == 1) ?
+      (TLeaf*)branch->GetListOfLeaves()->At(0) : nullptr;
+    vis_export::Column col = {name.Data(), branch, VIS_EXPORT_FLOAT32, 0,
+      vis_quant::get_branch_spec(tree, name), vis_compress::is_shuffled(tree, name)};
+    const bool ok = leaf && leaf->GetLeafCount() == nullptr &&
+      vis_export::get_export_type(leaf, col.spec, col.type);
+    if (ok == false) {
+      if (column_list.IsNull()) continue;
+      set_error(reader, "vis_export ERROR: Column %s is missing or not a fixed-size numeric array",
+          name.Data());
+      vis_export_close(reader);
+      return nullptr;
+    }
+    col.width = leaf->GetLenStatic();
+    reader->columns.push_back(col);
+  }
+  if (reader->columns.empty()) {
+    set_error(reader, "vis_export ERROR: No column to export in %s", path);
+    vis_export_close(reader);
+    return nullptr;
+  }
+
+  // only the exported branches are read, into their staging buffers
+  tree->SetBranchStatus("*", 0);
+  reader->row_buffers.resize(reader->columns.size());
+  for (size_t icol = 0; icol < reader->columns.size(); icol++) {
+    auto& col = reader->columns[icol];
+    reader->row_buffers[icol].resize(col.width);
+    tree->SetBranchStatus(col.name.c_str(), 1);
+    col.branch->SetAddress(reader->row_buffers[icol].data());
+  }
+
+  tree->SetCacheSize(vis_export::CACHE_SIZE);
+  for (const auto& col : reader->columns) tree->AddBranchToCache(col.name.c_str());
+  tree->StopCacheLearningPhase();
+  return reader;
+}
+
+void vis_export_close(VisExportReader* reader) {
+  if (reader == nullptr) return;
+  reader->current.reset();
+  if (reader->file) {
+    reader->file->Close();
+    delete reader->file;
+  }
+  delete reader;
+}
+
+const char* vis_export_last_error(void) {
+  return vis_export::g_last_error.c_str();
+}
+
+int64_t vis_export_num_rows(const VisExportReader* reader) {
+  return reader->tree->GetEntries();
+}
+
+int32_t vis_export_num_columns(const VisExportReader* reader) {
+  return reader->columns.size();
+}
+
+int vis_export_column(const VisExportReader* reader, int32_t icol, VisExportColumn* column) {
+  if (icol < 0 || icol >= (int32_t)reader->columns.size()) {
+    set_error(nullptr, "vis_export ERROR: No column %i", icol);
+    return -1;
+  }
+  const auto& col = reader->columns[icol];
+  column->name = col.name.c_str();
+  column->type = col.type;
+  column->width = col.width;
+  column->data = nullptr;
+  column->row_stride = col.width*sizeof(float);
+  return 0;
+}
+
+int vis_export_seek(VisExportReader* reader, int64_t row) {
+  if (row < 0 || row > reader->tree->GetEntries()) {
+    set_error(reader, "vis_export ERROR: Row %lld out of range", (long long)row);
+    return -1;
+  }
+  reader->next_row = row;
+  return 0;
+}
+
+int64_t vis_export_next(VisExportReader* reader, VisExportColumn* columns) {
+  // the buffers of the previous chunk are reused
+  if (reader->current == nullptr) reader->current = std::make_shared<vis_export::Chunk>();
+  if (read_chunk(reader, *reader->current) == false) return -1;
+  for (int32_t icol = 0; icol < (int32_t)reader->columns.size(); icol++) {
+    vis_export_column(reader, icol, &columns[icol]);
+    columns[icol].data = reader->current->data[icol].data();
+  }
+  return reader->current->rows;
+}
+
+int vis_export_arrow_stream(VisExportReader* reader, ArrowArrayStream* stream) {
+  stream->get_schema = stream_get_schema;
+  stream->get_next = stream_get_next;
+  stream->get_last_error = stream_get_last_error;
+  stream->release = stream_release;
+  stream->private_data = reader;
+  return 0;
+}
+
+}
@@ -0,0 +1,148 @@
+/**
+ * @file        : vis_export.h
+ */
+
+#ifndef VIS_EXPORT_H
+#define VIS_EXPORT_H
+
+#include <stdint.h>
+
+/**
+ * C interface to stream the columns of a photonLib tree (make_vis_map
+ * library) in chunks of rows, for consumers outside ROOT (NumPy, Arrow,
+ * ML data loaders). This header does not depend on ROOT.
+ *
+ * Each column is a fixed number of values per row (1 for x, y, z and the
+ * scalar visibilities, the number of tiles or SiPMs for the arrays). The
+ * baskets are read by ROOT directly into the exported buffers: the only
+ * passes over the data are the decompression/streaming of the basket and,
+ * for log-coded or byte-shuffled branches, the in-place decoding. Values
+ * are exported as float32 (float, Float16_t and log-coded branches),
+ * uint32 or int32.
+ *
+ * Two equivalent views of a chunk are provided:
+ *
+ *  - strided buffers (vis_export_next): a pointer to the first row and the
+ *    row stride in bytes for each column, row-major and C-contiguous. The
+ *    buffers stay valid until the next call or vis_export_close. With
+ *    NumPy: np.ctypeslib.as_array(ptr, shape=(n_rows, width)).
+ *
+ *  - Arrow record batches through the Arrow C stream interface
+ *    (vis_export_arrow_stream): a struct array with one child per column,
+ *    float32/uint32/int32 for scalars and fixed_size_list<float32> for the
+ *    arrays. Each batch owns its buffers and can outlive the reader. With
+ *    pyarrow: pa.RecordBatchReader._import_from_c(stream_address).
+ *
+ * Functions returning int return 0 on success; on failure the message is
+ * available from vis_export_last_error (per thread).
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Arrow C data interface, ABI-stable definitions from the Arrow format spec */
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+  const char* format;
+  const char* name;
+  const char* metadata;
+  int64_t flags;
+  int64_t n_children;
+  struct ArrowSchema** children;
+  struct ArrowSchema* dictionary;
+  void (*release)(struct ArrowSchema*);
+  void* private_data;
+};
+
+struct ArrowArray {
+  int64_t length;
+  int64_t null_count;
+  int64_t offset;
+  int64_t n_buffers;
+  int64_t n_children;
+  const void** buffers;
+  struct ArrowArray** children;
+  struct ArrowArray* dictionary;
+  void (*release)(struct ArrowArray*);
+  void* private_data;
+};
+
+#endif /* ARROW_C_DATA_INTERFACE */
+
+#ifndef ARROW_C_STREAM_INTERFACE
+#define ARROW_C_STREAM_INTERFACE
+
+struct ArrowArrayStream {
+  int (*get_schema)(struct ArrowArrayStream*, struct ArrowSchema* out);
+  int (*get_next)(struct ArrowArrayStream*, struct ArrowArray* out);
+  const char* (*get_last_error)(struct ArrowArrayStream*);
+  void (*release)(struct ArrowArrayStream*);
+  void* private_data;
+};
+
+#endif /* ARROW_C_STREAM_INTERFACE */
+
+enum VisExportType {
+  VIS_EXPORT_FLOAT32 = 0,
+  VIS_EXPORT_UINT32  = 1,
+  VIS_EXPORT_INT32   = 2
+};
+
+typedef struct VisExportColumn {
+  const char* name;    /* branch name */
+  int32_t type;        /* VisExportType, 4 bytes per value */
+  int32_t width;       /* values per row */
+  const void* data;    /* first row of the chunk (NULL from vis_export_column) */
+  int64_t row_stride;  /* bytes between consecutive rows */
+} VisExportColumn;
+
+typedef struct VisExportReader VisExportReader;
+
+/**
+ * Open the photonLib tree of a library. columns is a comma-separated list
+ * of branch names (NULL or "" for all the supported branches), chunk_rows
+ * the maximum number of rows per chunk (<= 0 for the default, 4096).
+ * Returns NULL on failure.
+ */
+VisExportReader* vis_export_open(const char* path, const char* columns, int64_t chunk_rows);
+
+void vis_export_close(VisExportReader* reader);
+
+const char* vis_export_last_error(void);
+
+int64_t vis_export_num_rows(const VisExportReader* reader);
+
+int32_t vis_export_num_columns(const VisExportReader* reader);
+
+/* Description of column icol, the data pointer is NULL */
+int vis_export_column(const VisExportReader* reader, int32_t icol, VisExportColumn* column);
+
+/* Position the reader at a given row (0 to restart) */
+int vis_export_seek(VisExportReader* reader, int64_t row);
+
+/**
+ * Read the next chunk, columns must hold vis_export_num_columns entries.
+ * Returns the number of rows of the chunk, 0 at the end of the tree, -1 on
+ * failure.
+ */
+int64_t vis_export_next(VisExportReader* reader, VisExportColumn* columns);
+
+/**
+ * Export the remaining rows as an Arrow C stream. The stream takes over
+ * the reader: do not use or close it afterwards, release the stream
+ * instead.
+ */
+int vis_export_arrow_stream(VisExportReader* reader, struct ArrowArrayStream* stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard VIS_EXPORT_H */
@@ -0,0 +1,380 @@
+/**
+ * @file        : vis_library.hh
+ */
+
+#ifndef VIS_LIBRARY_HH
+#define VIS_LIBRARY_HH
+
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "TFile.h"
+#include "TTree.h"
+#include "TBranch.h"
+#include "TLeaf.h"
+
+#include "vis_quant.hh"
+#include "vis_compress.hh"
+#include "vis_tree_io.hh"
+
+namespace vis_tree {
+
+  /**
+   * Groups of photonLib branches that can be loaded in memory. Tile and
+   * SiPM groups concatenate the main, edge0 and edge1 arrays in this order.
+   * The tile arrival-time group (N_QUANT quantiles per tile) is optional,
+   * it is present only in libraries produced with make_vis_tree --timing.
+   */
+  enum EVisGroup {
+    kGroupVisTot = 0, kGroupVisDir, kGroupVisWls,
+    kGroupTileTot, kGroupTileDir, kGroupTileWls,
+    kGroupSiPM,
+    kGroupTileTime,
+    N_GROUP
+  };
+
+  const unsigned ALL_GROUPS = (1u << N_GROUP) - 1;
+
+  const char* const GROUP_LABEL[N_GROUP] = {
+    "vis_tot", "vis_dir", "vis_wls",
+    "tile_tot", "tile_dir", "tile_wls",
+    "sipm",
+    "tile_time"
+  };
+
+  inline int get_group_size(const int& group) {
+    if (group <= kGroupVisWls) return 1;
+    if (group <= kGroupTileWls) return NTILE_MAIN + 2*NTILE_LAT;
+    if (group == kGroupTileTime) return (NTILE_MAIN + 2*NTILE_LAT)*vis_timing::N_QUANT;
+    return NSIPM_MAIN + 2*NSIPM_LAT;
+  }
+
+  inline std::vector<TString> get_group_branches(const int& group) {
+    std::vector<TString> branches;
+    if (group <= kGroupVisWls) {
+      branches.push_back( Form("vis_%s", COMPONENT_LABEL[group]) );
+    }
+    else if (group <= kGroupTileWls) {
+      for (int ia = 0; ia < N_ANODE; ia++) {
+        branches.push_back( Form("vis_%s_tile_%s", COMPONENT_LABEL[group-kGroupTileTot], ANODE_LABEL[ia]) );
+      }
+    }
+    else if (group == kGroupTileTime) {
+      for (int ia = 0; ia < N_ANODE; ia++) branches.push_back( Form("t_quant_tile_%s", ANODE_LABEL[ia]) );
+    }
+    else {
+      for (int ia = 0; ia < N_ANODE; ia++) branches.push_back( SIPM_BRANCH[ia] );
+    }
+    return branches;
+  }
+
+  /**
+   * Entry-by-entry reader of a photonLib tree. The branch addresses are set
+   * once: each GetEntry streams the coordinates, the events per point (if
+   * stored) and the branches of the selected groups straight into one
+   * contiguous row per group, log-coded and byte-shuffled branches being
+   * decoded in place. The tree must outlive the reader.
+   */
+  class VisRowReader {
+    public:
+      VisRowReader() {}
+
+      /**
+       * Select the groups of group_mask (kGroupTileTime is skipped if the
+       * library has no arrival-time tables) and set the branch addresses.
+       */
+      bool Init(TTree* tree, const unsigned& group_mask = ALL_GROUPS) {
+        fTree = tree;
+        fTree->SetBranchStatus("*", 0);
+        const char* axis_name[3] = {"x", "y", "z"};
+        for (int k = 0; k < 3; k++) {
+          fTree->SetBranchStatus(axis_name[k], 1);
+          fTree->SetBranchAddress(axis_name[k], &fXYZ[k]);
+        }
+        fHasEvents = (fTree->GetBranch("n_events_per_point") != nullptr);
+        if (fHasEvents) {
+          fTree->SetBranchStatus("n_events_per_point", 1);
+          fTree->SetBranchAddress("n_events_per_point", &fNEvents);
+        }
+
+        fBranches.clear();
+        for (int ig = 0; ig < N_GROUP; ig++) {
+          fRow[ig].clear();
+          if ( (group_mask & (1u << ig)) == 0 ) continue;
+          if (ig == kGroupTileTime && fTree->GetBranch("t_quant_tile_main") == nullptr) continue;
+          fRow[ig].assign(get_group_size(ig), 0.0);
+          int offset = 0;
+          for (const auto& br_name : get_group_branches(ig)) {
+            // the leaf name may differ from the branch name (vis_sipm_edge00/vis_sipm_edge0)
+            TBranch* branch = fTree->GetBranch(br_name);
+            TLeaf* leaf = (branch && branch->GetListOfLeaves()->GetEntries() == 1) ?
+              (TLeaf*)branch->GetListOfLeaves()->At(0) : nullptr;
+            if (leaf == nullptr) {
+              fprintf(stderr, "VisLibrary ERROR: Missing branch %s\n", br_name.Data());
+              return false;
+            }
+            const int size = leaf->GetLenStatic();
+            if (offset + size > get_group_size(ig)) break;
+            fBranches.push_back( {br_name, ig, offset, size,
+                vis_quant::get_branch_spec(fTree, br_name),
+                vis_compress::is_shuffled(fTree, br_name), {}} );
+            offset += size;
+          }
+          if (offset != get_group_size(ig)) {
+            fprintf(stderr, "VisLibrary ERROR: Unexpected size of group %i\n", ig);
+            return false;
+          }
+        }
+        // addresses set once the buffers are final
+        for (auto& br : fBranches) {
+          fTree->SetBranchStatus(br.name, 1);
+          if (br.spec.mode == vis_quant::kLogCode) {
+            br.codes.resize(br.size, 0);
+            fTree->SetBranchAddress(br.name, br.codes.data());
+          }
+          else {
+            fTree->SetBranchAddress(br.name, &fRow[br.group][br.offset]);
+          }
+        }
+        return true;
+      }
+
+      void Read(const Long64_t& entry) {
+        fTree->GetEntry(entry);
+        for (auto& br : fBranches) {
+          float* row = &fRow[br.group][br.offset];
+          if (br.spec.mode == vis_quant::kLogCode) {
+            vis_quant::decode(br.codes.data(), row, br.size, br.spec);
+          }
+          else if (br.shuffled) {
+            vis_compress::byte_unshuffle(row, br.size, sizeof(float), fShuffleTmp);
+          }
+        }
+      }
+
+      bool HasGroup(const int& group) const {return fRow[group].empty() == false;}
+
+      // Row of a group in the current entry, get_group_size(group) values
+      const float* Get(const int& group) const {return fRow[group].data();}
+
+      const float* GetCoords() const {return fXYZ;}
+
+      bool HasEventCounts() const {return fHasEvents;}
+
+      UInt_t GetNEvents() const {return fNEvents;}
+
+    private:
+      struct BranchBuffer {
+        TString name;
+        int group; int offset; int size;
+        vis_quant::QuantSpec spec;
+        bool shuffled;
+        std::vector<UShort_t> codes;
+      };
+
+      TTree* fTree = nullptr;
+      float fXYZ[3] = {0, 0, 0};
+      UInt_t fNEvents = 0;
+      bool fHasEvents = false;
+      std::vector<BranchBuffer> fBranches;
+      std::vector<float> fRow[N_GROUP];
+      std::vector<unsigned char> fShuffleTmp;
+  };
+
+  /**
+   * In-memory copy of a make_vis_map library. The visibilities of each
+   * group are stored point-major in a contiguous array, the source points
+   * are located on the x/y/z grid of the production (or on the rectilinear
+   * grid of their coordinates, for a refined point set).
+   */
+  class VisLibrary {
+    public:
+      VisLibrary() {}
+
+      bool Load(const TString& file_path, const unsigned& group_mask = ALL_GROUPS) {
+        TFile* file = TFile::Open(file_path);
+        auto close_file = [&file]() {
+          if (file == nullptr) return;
+          file->Close();
+          delete file;
+          file = nullptr;
+        };
+        if (file == nullptr || file->IsZombie()) {
+          fprintf(stderr, "VisLibrary ERROR: Unable to open %s\n", file_path.Data());
+          close_file();
+          return false;
+        }
+        TTree* tree = file->Get<TTree>(LIB_TREE);
+        if (tree == nullptr) {
+          fprintf(stderr, "VisLibrary ERROR: No %s tree in %s\n", LIB_TREE, file_path.Data());
+          close_file();
+          return false;
+        }
+
+        VisRowReader row;
+        if (row.Init(tree, group_mask) == false) {
+          close_file();
+          return false;
+        }
+
+        const Long64_t n_points = tree->GetEntries();
+        fCoords.resize(3*n_points);
+        fEvents.clear();
+        if (row.HasEventCounts()) fEvents.resize(n_points, 0);
+        for (int ig = 0; ig < N_GROUP; ig++) {
+          fData[ig].clear();
+          if (row.HasGroup(ig)) fData[ig].resize(n_points*get_group_size(ig));
+        }
+
+        for (Long64_t i = 0; i < n_points; i++) {
+          row.Read(i);
+          std::copy(row.GetCoords(), row.GetCoords()+3, &fCoords[3*i]);
+          if (row.HasEventCounts()) fEvents[i] = row.GetNEvents();
+          for (int ig = 0; ig < N_GROUP; ig++) {
+            if (row.HasGroup(ig) == false) continue;
+            const int nch = get_group_size(ig);
+            std::copy(row.Get(ig), row.Get(ig) + nch, &fData[ig][i*nch]);
+          }
+        }
+        tree->ResetBranchAddresses();
+
+        close_file();
+
+        BuildGrid();
+        return true;
+      }
+
+      size_t GetNPoints() const {return fCoords.size() / 3;}
+
+      bool HasGroup(const int& group) const {return fData[group].empty() == false;}
+
+      const float* GetCoords(const size_t& ipoint) const {return &fCoords[3*ipoint];}
+
+      bool HasEventCounts() const {return fEvents.empty() == false;}
+
+      // Number of simulated events of a point (0 if not stored)
+      UInt_t GetNEvents(const size_t& ipoint) const {return fEvents.empty() ? 0 : fEvents[ipoint];}
+
+      const float* Get(const int& group, const size_t& ipoint) const {
+        return &fData[group][ipoint*get_group_size(group)];
+      }
+
+      const std::vector<float>& GetAxis(const int& k) const {return fAxis[k];}
+
+      /**
+       * Sample the arrival time (ns) of a photon detected by a tile (index
+       * in the concatenated main, edge0, edge1 list) from the quantile
+       * table of the point, u uniform in [0, 1). Requires kGroupTileTime.
+       */
+      float SampleArrivalTime(const size_t& ipoint, const int& tile, const double& u) const {
+        return vis_timing::sample(Get(kGroupTileTime, ipoint) + tile*vis_timing::N_QUANT, u);
+      }
+
+      /**
+       * Index of the library point closest to (x, y, z). The position is
+       * first matched to the nearest node of the x/y/z axes, which may be
+       * non-uniform (refined library). When that node has no library entry
+       * (thinned or incomplete grid), the closest point among the 26
+       * neighbouring nodes is returned. Returns -1 when the position is
+       * outside the grid (by more than half the first/last grid step) or no
+       * point is found around it.
+       */
+      Long64_t Locate(const float& x, const float& y, const float& z) const {
+        const float pos[3] = {x, y, z};
+        int inode[3] = {0, 0, 0};
+        for (int k = 0; k < 3; k++) {
+          const auto& axis = fAxis[k];
+          if (axis.empty()) return -1;
+          if (pos[k] < axis.front() - fEdgeHalfStep[k][0]) return -1;
+          if (pos[k] > axis.back() + fEdgeHalfStep[k][1]) return -1;
+          auto it = std::lower_bound(axis.begin(), axis.end(), pos[k]);
+          size_t i = it - axis.begin();
+          if (i == axis.size()) i--;
+          else if (i > 0 && (pos[k] - axis[i-1]) < (axis[i] - pos[k])) i--;
+          inode[k] = i;
+        }
+        const Long64_t ipoint = FindNode(inode);
+        if (ipoint >= 0) return ipoint;
+
+        Long64_t closest = -1;
+        float d2_min = 0;
+        int in[3];
+        for (in[0] = inode[0]-1; in[0] <= inode[0]+1; in[0]++) {
+          for (in[1] = inode[1]-1; in[1] <= inode[1]+1; in[1]++) {
+            for (in[2] = inode[2]-1; in[2] <= inode[2]+1; in[2]++) {
+              const Long64_t ip = FindNode(in);
+              if (ip < 0) continue;
+              float d2 = 0;
+              for (int k = 0; k < 3; k++) d2 += (fCoords[3*ip+k] - pos[k])*(fCoords[3*ip+k] - pos[k]);
+              if (closest < 0 || d2 < d2_min) {
+                closest = ip;
+                d2_min = d2;
+              }
+            }
+          }
+        }
+        return closest;
+      }
+
+      // Library point at the grid node of indices inode, -1 if there is none
+      Long64_t FindNode(const int* inode) const {
+        for (int k = 0; k < 3; k++) {
+          if (inode[k] < 0 || inode[k] >= int(fAxis[k].size())) return -1;
+        }
+        return fGrid[(size_t(inode[0])*fAxis[1].size() + inode[1])*fAxis[2].size() + inode[2]];
+      }
+
+      /**
+       * True if the three axes are uniformly spaced, as in the production
+       * grid. A refined library (see plan_vis_refinement) has non-uniform
+       * axes and grid nodes without points outside the refined cells.
+       */
+      bool IsUniform() const {return fUniform;}
+
+      // Grid nodes of the x/y/z axes without a library point
+      size_t GetNMissingNodes() const {return std::count(fGrid.begin(), fGrid.end(), -1);}
+
+    private:
+      std::vector<float> fCoords;
+      std::vector<UInt_t> fEvents;
+      std::vector<float> fData[N_GROUP];
+      std::vector<float> fAxis[3];
+      float fEdgeHalfStep[3][2] = {{0, 0}, {0, 0}, {0, 0}};
+      bool fUniform = true;
+      std::vector<Long64_t> fGrid;
+
+      void BuildGrid() {
+        const size_t n_points = GetNPoints();
+        fUniform = true;
+        for (int k = 0; k < 3; k++) {
+          auto& axis = fAxis[k];
+          axis.clear();
+          for (size_t i = 0; i < n_points; i++) axis.push_back(fCoords[3*i+k]);
+          std::sort(axis.begin(), axis.end());
+          axis.erase(std::unique(axis.begin(), axis.end()), axis.end());
+          float step_min = 0, step_max = 0;
+          for (size_t i = 1; i < axis.size(); i++) {
+            const float step = axis[i] - axis[i-1];
+            step_min = (i == 1) ? step : std::min(step_min, step);
+            step_max = std::max(step_max, step);
+          }
+          if (step_max - step_min > 1e-3*step_max) fUniform = false;
+          const size_t n = axis.size();
+          fEdgeHalfStep[k][0] = (n > 1) ? 0.5*(axis[1] - axis[0]) : 0;
+          fEdgeHalfStep[k][1] = (n > 1) ? 0.5*(axis[n-1] - axis[n-2]) : 0;
+        }
+
+        fGrid.assign(fAxis[0].size()*fAxis[1].size()*fAxis[2].size(), -1);
+        for (size_t i = 0; i < n_points; i++) {
+          size_t inode[3] = {0, 0, 0};
+          for (int k = 0; k < 3; k++) {
+            inode[k] = std::lower_bound(fAxis[k].begin(), fAxis[k].end(), fCoords[3*i+k]) - fAxis[k].begin();
+          }
+          fGrid[(inode[0]*fAxis[1].size() + inode[1])*fAxis[2].size() + inode[2]] = i;
+        }
+      }
+  };
+}
+
+#endif /* end of include guard VIS_LIBRARY_HH */
@@ -0,0 +1,406 @@
+/**
+ * @file        : vis_octree.hh
+ */
+
+#ifndef VIS_OCTREE_HH
+#define VIS_OCTREE_HH
+
+#include <cstdio>
+#include <cmath>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include "TFile.h"
+#include "TTree.h"
+#include "TNamed.h"
+
+#include "vis_tree_io.hh"
+#include "vis_library.hh"
+
+/**
+ * Multi-resolution storage of a make_vis_map library (see make_vis_octree).
+ *
+ * The cells of the production grid are grouped in an octree built in grid
+ * index space. A cube becomes a leaf when the trilinear interpolation of
+ * its 8 corner points reproduces every library point inside it within a
+ * relative tolerance (above an absolute floor); otherwise it is split, down
+ * to single grid cells. Only the grid points used as leaf corners are kept
+ * (the samples), so smooth regions cost a handful of arrays while the
+ * regions close to the anode keep the full grid. Each group gets its own
+ * octree: the large SiPM arrays are refined only where they need to be.
+ *
+ * The nodes are stored breadth-first in a flat int32 array, the 8 children
+ * of a node being contiguous. A node holds the index of its first child,
+ * kEmpty for cells without library points, or -(leaf+2) for a leaf. The
+ * lookup descends using the bits of the grid cell index of the position,
+ * without any geometry stored in the nodes.
+ *
+ * The octree requires the uniform production grid: a refined point set
+ * (plan_vis_refinement) mixes cell sizes, and most of the nodes of its
+ * rectilinear grid have no point, so Build rejects it.
+ */
+namespace vis_tree {
+
+  const char* const OCT_AXES_TREE = "photonLibOctAxes";
+
+  inline TString get_octree_tree_name(const int& group, const char* kind) {
+    return Form("%sOct%s_%s", LIB_TREE, kind, GROUP_LABEL[group]);
+  }
+
+  // Trilinear combination of the 8 corner arrays, corner bits are x, y, z
+  inline void interpolate_corners(const float* const* corner, const float* t,
+      float* out, const int& n)
+  {
+    float w[8];
+    for (int i = 0; i < 8; i++) {
+      w[i] = ((i & 1) ? t[0] : 1 - t[0]) * ((i & 2) ? t[1] : 1 - t[1]) * ((i & 4) ? t[2] : 1 - t[2]);
+    }
+    const float* v0 = corner[0]; const float* v1 = corner[1];
+    const float* v2 = corner[2]; const float* v3 = corner[3];
+    const float* v4 = corner[4]; const float* v5 = corner[5];
+    const float* v6 = corner[6]; const float* v7 = corner[7];
+    for (int c = 0; c < n; c++) {
+      out[c] = w[0]*v0[c] + w[1]*v1[c] + w[2]*v2[c] + w[3]*v3[c]
+             + w[4]*v4[c] + w[5]*v5[c] + w[6]*v6[c] + w[7]*v7[c];
+    }
+  }
+
+  class VisOctree {
+    public:
+      static constexpr int32_t kEmpty = -1;
+
+      VisOctree() {}
+
+      /**
+       * Build the octree of a group from an in-memory library. A point is
+       * reproduced when |interpolated - v| <= tolerance * max(|v|, floor)
+       * for all the channels.
+       */
+      bool Build(const VisLibrary& lib, const int& group, const float& tolerance, const float& floor) {
+        if (lib.HasGroup(group) == false) {
+          fprintf(stderr, "VisOctree ERROR: group %s not loaded\n", GROUP_LABEL[group]);
+          return false;
+        }
+        fGroup = group;
+        fNChannels = get_group_size(group);
+        fTolerance = tolerance;
+        fFloor = floor;
+        int n_cells = 1;
+        for (int k = 0; k < 3; k++) {
+          fAxis[k] = lib.GetAxis(k);
+          if (fAxis[k].size() < 2) {
+            fprintf(stderr, "VisOctree ERROR: axis %i has less than 2 grid nodes\n", k);
+            return false;
+          }
+          n_cells = std::max<int>(n_cells, fAxis[k].size() - 1);
+        }
+        if (lib.IsUniform() == false) {
+          fprintf(stderr, "VisOctree ERROR: non-uniform grid axes (refined point set) are not supported\n");
+          return false;
+        }
+        if (lib.GetNMissingNodes() > 0) {
+          printf("VisOctree: %zu grid nodes without library point, the cells around them"
+              " are left empty unless a coarser cube is accepted\n", lib.GetNMissingNodes());
+        }
+        fDepth = 0;
+        while ((1 << fDepth) < n_cells) fDepth++;
+
+        const int n[3] = {int(fAxis[0].size()), int(fAxis[1].size()), int(fAxis[2].size())};
+        auto grid_point = [&lib](const int* inode) -> Long64_t {return lib.FindNode(inode);};
+
+        std::vector<int32_t> sample_of(lib.GetNPoints(), -1);
+        fNodes.assign(1, kEmpty);
+        fLeaves.clear();
+        fSamples.clear();
+        fSampleNode.clear();
+        std::vector<float> interp(fNChannels);
+
+        struct Cube {
+          int32_t node;
+          int origin[3];
+          int size;
+        };
+        std::deque<Cube> queue;
+        queue.push_back( {0, {0, 0, 0}, 1 << fDepth} );
+        while (queue.empty() == false) {
+          const Cube cube = queue.front();
+          queue.pop_front();
+          if (cube.origin[0] >= n[0]-1 || cube.origin[1] >= n[1]-1 || cube.origin[2] >= n[2]-1) continue;
+
+          // cubes crossing the end of the grid are clipped to its last node
+          int upper[3];
+          for (int k = 0; k < 3; k++) upper[k] = std::min(cube.origin[k] + cube.size, n[k] - 1);
+          Long64_t corner[8];
+          bool complete = true;
+          for (int ic = 0; ic < 8; ic++) {
+            const int inode[3] = {
+              (ic & 1) ? upper[0] : cube.origin[0],
+              (ic & 2) ? upper[1] : cube.origin[1],
+              (ic & 4) ? upper[2] : cube.origin[2]};
+            corner[ic] = grid_point(inode);
+            complete = complete && (corner[ic] >= 0);
+          }
+
+          if (complete && (cube.size == 1 || Accept(lib, cube.origin, upper, corner, grid_point, interp))) {
+            fNodes[cube.node] = -(int32_t(fLeaves.size()/8) + 2);
+            for (int ic = 0; ic < 8; ic++) {
+              int32_t& isample = sample_of[corner[ic]];
+              if (isample < 0) {
+                isample = fSampleNode.size() / 3;
+                const float* xyz = lib.GetCoords(corner[ic]);
+                for (int k = 0; k < 3; k++) {
+                  fSampleNode.push_back( std::lower_bound(fAxis[k].begin(), fAxis[k].end(), xyz[k]) - fAxis[k].begin() );
+                }
+                const float* vis = lib.Get(group, corner[ic]);
+                fSamples.insert(fSamples.end(), vis, vis + fNChannels);
+              }
+              fLeaves.push_back(isample);
+            }
+            continue;
+          }
+          if (cube.size == 1) continue;  // cell with missing corners
+
+          const int32_t first_child = fNodes.size();
+          fNodes[cube.node] = first_child;
+          fNodes.resize(first_child + 8, kEmpty);
+          const int h = cube.size / 2;
+          for (int oct = 0; oct < 8; oct++) {
+            queue.push_back( {first_child + oct, {
+                cube.origin[0] + ((oct & 1) ? h : 0),
+                cube.origin[1] + ((oct & 2) ? h : 0),
+                cube.origin[2] + ((oct & 4) ? h : 0)}, h} );
+          }
+        }
+        return true;
+      }
+
+      /**
+       * Interpolated visibilities at (x, y, z), out holds GetNChannels()
+       * values. Returns false outside the grid or in cells without data.
+       */
+      bool Interpolate(const float& x, const float& y, const float& z, float* out) const {
+        const float pos[3] = {x, y, z};
+        int cell[3] = {0, 0, 0};
+        for (int k = 0; k < 3; k++) {
+          const auto& axis = fAxis[k];
+          if (axis.empty() || pos[k] < axis.front() || pos[k] > axis.back()) return false;
+          const int i = std::upper_bound(axis.begin(), axis.end(), pos[k]) - axis.begin() - 1;
+          cell[k] = std::min<int>(i, axis.size() - 2);
+        }
+
+        int origin[3] = {0, 0, 0};
+        int size = 1 << fDepth;
+        int32_t node = fNodes[0];
+        while (node >= 0) {
+          size >>= 1;
+          int oct = 0;
+          for (int k = 0; k < 3; k++) {
+            if (cell[k] & size) {
+              oct |= (1 << k);
+              origin[k] += size;
+            }
+          }
+          node = fNodes[node + oct];
+        }
+        if (node == kEmpty) return false;
+
+        const int32_t* leaf = &fLeaves[8*size_t(-node - 2)];
+        const float* corner[8];
+        for (int ic = 0; ic < 8; ic++) corner[ic] = &fSamples[size_t(leaf[ic])*fNChannels];
+        float t[3];
+        for (int k = 0; k < 3; k++) {
+          const auto& axis = fAxis[k];
+          const int upper = std::min<int>(origin[k] + size, axis.size() - 1);
+          t[k] = (pos[k] - axis[origin[k]]) / (axis[upper] - axis[origin[k]]);
+        }
+        interpolate_corners(corner, t, out, fNChannels);
+        return true;
+      }
+
+      int GetGroup() const {return fGroup;}
+      int GetNChannels() const {return fNChannels;}
+      int GetDepth() const {return fDepth;}
+      size_t GetNNodes() const {return fNodes.size();}
+      size_t GetNLeaves() const {return fLeaves.size() / 8;}
+      size_t GetNSamples() const {return fSampleNode.size() / 3;}
+
+      // In-memory size of nodes, leaves and samples in bytes
+      size_t GetMemory() const {
+        return (fNodes.size() + fLeaves.size() + fSampleNode.size()) * sizeof(int32_t)
+          + fSamples.size() * sizeof(float);
+      }
+
+      // Grid axes, written once per file
+      void WriteAxes() const {
+        TTree* axes = new TTree(OCT_AXES_TREE, "SoLAr@ProtoDUNE3 Photon Library octree grid axes");
+        Int_t axis = 0;
+        Float_t value = 0;
+        axes->Branch("axis", &axis, "axis/I");
+        axes->Branch("value", &value, "value/F");
+        for (axis = 0; axis < 3; axis++) {
+          for (const auto& v : fAxis[axis]) {
+            value = v;
+            axes->Fill();
+          }
+        }
+        axes->Write();
+      }
+
+      void Write() const {
+        const char* label = GROUP_LABEL[fGroup];
+        TTree* nodes = new TTree(get_octree_tree_name(fGroup, "Nodes"),
+            Form("SoLAr@ProtoDUNE3 Photon Library octree nodes (%s)", label));
+        Int_t node = 0;
+        nodes->Branch("node", &node, "node/I");
+        nodes->GetUserInfo()->Add( new TNamed("depth", Form("%i", fDepth)) );
+        nodes->GetUserInfo()->Add( new TNamed("tolerance", Form("%g", fTolerance)) );
+        nodes->GetUserInfo()->Add( new TNamed("floor", Form("%g", fFloor)) );
+        for (const auto& n : fNodes) {
+          node = n;
+          nodes->Fill();
+        }
+        nodes->Write();
+
+        TTree* leaves = new TTree(get_octree_tree_name(fGroup, "Leaves"),
+            Form("SoLAr@ProtoDUNE3 Photon Library octree leaves (%s)", label));
+        Int_t corner[8] = {0};
+        leaves->Branch("corner", corner, "corner[8]/I");
+        for (size_t il = 0; il < GetNLeaves(); il++) {
+          std::copy(&fLeaves[8*il], &fLeaves[8*il] + 8, corner);
+          leaves->Fill();
+        }
+        leaves->Write();
+
+        TTree* samples = new TTree(get_octree_tree_name(fGroup, "Samples"),
+            Form("SoLAr@ProtoDUNE3 Photon Library octree samples (%s)", label));
+        Int_t inode[3] = {0};
+        std::vector<float> vis(fNChannels);
+        samples->Branch("inode", inode, "inode[3]/I");
+        samples->Branch("vis", vis.data(), Form("vis[%i]/F", fNChannels));
+        for (size_t is = 0; is < GetNSamples(); is++) {
+          std::copy(&fSampleNode[3*is], &fSampleNode[3*is] + 3, inode);
+          std::copy(&fSamples[is*fNChannels], &fSamples[is*fNChannels] + fNChannels, vis.begin());
+          samples->Fill();
+        }
+        samples->Write();
+      }
+
+      bool Load(const TString& file_path, const int& group) {
+        TFile* file = TFile::Open(file_path);
+        if (file == nullptr || file->IsZombie()) {
+          fprintf(stderr, "VisOctree ERROR: Unable to open %s\n", file_path.Data());
+          return false;
+        }
+        TTree* axes = file->Get<TTree>(OCT_AXES_TREE);
+        TTree* nodes = file->Get<TTree>(get_octree_tree_name(group, "Nodes"));
+        TTree* leaves = file->Get<TTree>(get_octree_tree_name(group, "Leaves"));
+        TTree* samples = file->Get<TTree>(get_octree_tree_name(group, "Samples"));
+        if (axes == nullptr || nodes == nullptr || leaves == nullptr || samples == nullptr) {
+          fprintf(stderr, "VisOctree ERROR: No %s octree in %s\n", GROUP_LABEL[group], file_path.Data());
+          file->Close();
+          delete file;
+          return false;
+        }
+
+        fGroup = group;
+        fNChannels = get_group_size(group);
+        auto get_info = [&](const char* key) {
+          TNamed* rec = (TNamed*)nodes->GetUserInfo()->FindObject(key);
+          return rec ? TString(rec->GetTitle()) : TString("0");
+        };
+        fDepth = get_info("depth").Atoi();
+        fTolerance = get_info("tolerance").Atof();
+        fFloor = get_info("floor").Atof();
+
+        Int_t axis = 0;
+        Float_t value = 0;
+        axes->SetBranchAddress("axis", &axis);
+        axes->SetBranchAddress("value", &value);
+        for (int k = 0; k < 3; k++) fAxis[k].clear();
+        for (Long64_t i = 0; i < axes->GetEntries(); i++) {
+          axes->GetEntry(i);
+          fAxis[axis].push_back(value);
+        }
+
+        Int_t node = 0;
+        nodes->SetBranchAddress("node", &node);
+        fNodes.resize(nodes->GetEntries());
+        for (Long64_t i = 0; i < nodes->GetEntries(); i++) {
+          nodes->GetEntry(i);
+          fNodes[i] = node;
+        }
+
+        // the branch addresses are set once on entry buffers, copied out
+        Int_t corner[8] = {0};
+        leaves->SetBranchAddress("corner", corner);
+        fLeaves.resize(8*leaves->GetEntries());
+        for (Long64_t i = 0; i < leaves->GetEntries(); i++) {
+          leaves->GetEntry(i);
+          std::copy(corner, corner+8, &fLeaves[8*i]);
+        }
+
+        const Long64_t n_samples = samples->GetEntries();
+        Int_t inode[3] = {0, 0, 0};
+        std::vector<float> vis(fNChannels, 0.0);
+        samples->SetBranchAddress("inode", inode);
+        samples->SetBranchAddress("vis", vis.data());
+        fSampleNode.resize(3*n_samples);
+        fSamples.resize(n_samples*fNChannels);
+        for (Long64_t i = 0; i < n_samples; i++) {
+          samples->GetEntry(i);
+          std::copy(inode, inode+3, &fSampleNode[3*i]);
+          std::copy(vis.begin(), vis.end(), &fSamples[i*fNChannels]);
+        }
+
+        file->Close();
+        delete file;
+        return true;
+      }
+
+    private:
+      int fGroup = 0;
+      int fNChannels = 0;
+      int fDepth = 0;
+      float fTolerance = 0;
+      float fFloor = 0;
+      std::vector<float> fAxis[3];
+      std::vector<int32_t> fNodes;
+      std::vector<int32_t> fLeaves;      // 8 sample indices per leaf
+      std::vector<float> fSamples;       // fNChannels values per sample
+      std::vector<int32_t> fSampleNode;  // grid indices of the samples
+
+      // Check the interpolation of a cube at all the library points it contains
+      template <typename GridPoint>
+      bool Accept(const VisLibrary& lib, const int* origin, const int* upper,
+          const Long64_t* corner, GridPoint& grid_point, std::vector<float>& interp) const
+      {
+        const float* corner_vis[8];
+        for (int ic = 0; ic < 8; ic++) corner_vis[ic] = lib.Get(fGroup, corner[ic]);
+        float span[3];
+        for (int k = 0; k < 3; k++) span[k] = fAxis[k][upper[k]] - fAxis[k][origin[k]];
+
+        int inode[3];
+        for (inode[0] = origin[0]; inode[0] <= upper[0]; inode[0]++) {
+          for (inode[1] = origin[1]; inode[1] <= upper[1]; inode[1]++) {
+            for (inode[2] = origin[2]; inode[2] <= upper[2]; inode[2]++) {
+              const Long64_t ipoint = grid_point(inode);
+              if (ipoint < 0) continue;
+              float t[3];
+              for (int k = 0; k < 3; k++) t[k] = (fAxis[k][inode[k]] - fAxis[k][origin[k]]) / span[k];
+              interpolate_corners(corner_vis, t, interp.data(), fNChannels);
+              const float* vis = lib.Get(fGroup, ipoint);
+              int n_bad = 0;
+              for (int c = 0; c < fNChannels; c++) {
+                const float tol = fTolerance * std::max(std::fabs(vis[c]), fFloor);
+                n_bad += (std::fabs(interp[c] - vis[c]) > tol);
+              }
+              if (n_bad > 0) return false;
+            }
+          }
+        }
+        return true;
+      }
+  };
+}
+
+#endif /* end of include guard VIS_OCTREE_HH */
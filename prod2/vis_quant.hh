@@ -0,0 +1,259 @@
+/**
+ * @file        : vis_quant.hh
+ */
+
+#ifndef VIS_QUANT_HH
+#define VIS_QUANT_HH
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "TString.h"
+#include "TRegexp.h"
+#include "TObjArray.h"
+#include "TObjString.h"
+#include "TNamed.h"
+#include "TList.h"
+#include "TTree.h"
+
+/**
+ * Quantised storage of the photon library visibility arrays.
+ *
+ * The visibilities are estimated from O(10^7) photons per point, so their
+ * statistical precision is far below the 24 bits of a float mantissa. A
+ * branch can be stored in one of the following modes:
+ *
+ *  - `float`                   : plain 32-bit float (default)
+ *  - `f16:<nbits>`             : ROOT Float16_t with the mantissa truncated
+ *                                to nbits (2-14). The relative error is
+ *                                bounded by 2^-(nbits+1) over the full range.
+ *  - `f16:<xmin>:<xmax>:<nbits>`: ROOT Float16_t packed as an nbits integer
+ *                                in [xmin, xmax] (absolute error bound).
+ *  - `log:<nbits>:<vmin>:<vmax>`: logarithmic integer code (UShort_t,
+ *                                nbits <= 16). Code 0 is reserved for zero,
+ *                                the relative error in [vmin, vmax] is bounded
+ *                                by exp(0.5*dlog)-1.
+ *
+ * Float16_t branches are decoded transparently by ROOT. Log-coded branches
+ * must be decoded with vis_quant::decode, the encoding is recorded in the
+ * tree UserInfo as a TNamed("quant:<branch>", "<spec>").
+ */
+namespace vis_quant {
+
+  enum EQuantMode {kFloat = 0, kFloat16 = 1, kLogCode = 2};
+
+  struct QuantSpec {
+    EQuantMode mode = kFloat;
+    int   nbits = 0;
+    float xmin = 0.0;
+    float xmax = 0.0;
+
+    TString Encode() const {
+      if (mode == kFloat16 && xmin == xmax) return Form("f16:%i", nbits);
+      if (mode == kFloat16) return Form("f16:%g:%g:%i", xmin, xmax, nbits);
+      if (mode == kLogCode) return Form("log:%i:%g:%g", nbits, xmin, xmax);
+      return "float";
+    }
+
+    // Leaf type string to be appended to the leaf name in the leaflist
+    TString LeafType() const {
+      if (mode == kFloat16) return Form("f[%g,%g,%i]", xmin, xmax, nbits);
+      if (mode == kLogCode) return "s";
+      return "F";
+    }
+  };
+
+  inline bool parse_spec(const TString& str, QuantSpec& spec) {
+    TObjArray* tokens = str.Tokenize(":");
+    const int ntok = tokens->GetEntries();
+    std::vector<TString> tok;
+    for (int i = 0; i < ntok; i++) tok.push_back(((TObjString*)tokens->At(i))->GetString());
+    delete tokens;
+
+    spec = QuantSpec();
+    if (ntok == 1 && tok[0] == "float") {
+      return true;
+    }
+    else if (ntok == 2 && tok[0] == "f16") {
+      spec.mode = kFloat16;
+      spec.nbits = tok[1].Atoi();
+      return (spec.nbits >= 2 && spec.nbits <= 14);
+    }
+    else if (ntok == 4 && tok[0] == "f16") {
+      spec.mode = kFloat16;
+      spec.xmin = tok[1].Atof();
+      spec.xmax = tok[2].Atof();
+      spec.nbits = tok[3].Atoi();
+      return (spec.xmin < spec.xmax && spec.nbits >= 2 && spec.nbits <= 31);
+    }
+    else if (ntok == 4 && tok[0] == "log") {
+      spec.mode = kLogCode;
+      spec.nbits = tok[1].Atoi();
+      spec.xmin = tok[2].Atof();
+      spec.xmax = tok[3].Atof();
+      return (spec.xmin > 0 && spec.xmin < spec.xmax && spec.nbits >= 2 && spec.nbits <= 16);
+    }
+
+    return false;
+  }
+
+  /**
+   * Ordered list of `<branch wildcard>=<spec>` rules. When several rules
+   * match a branch the last one wins.
+   */
+  class QuantPolicy {
+    public:
+      bool AddRule(const TString& rule) {
+        const Ssiz_t ieq = rule.Index("=");
+        if (ieq == kNPOS) return false;
+        QuantSpec spec;
+        if (parse_spec(rule(ieq+1, rule.Length()-ieq-1), spec) == false) return false;
+        fPatterns.push_back( rule(0, ieq) );
+        fSpecs.push_back( spec );
+        return true;
+      }
+
+      QuantSpec GetSpec(const TString& branch_name) const {
+        QuantSpec spec;
+        for (size_t i = 0; i < fPatterns.size(); i++) {
+          TRegexp re(fPatterns[i], kTRUE);
+          Ssiz_t len = 0;
+          if (branch_name.Index(re, &len) == 0 && len == branch_name.Length()) {
+            spec = fSpecs[i];
+          }
+        }
+        return spec;
+      }
+
+      bool IsEmpty() const {return fPatterns.empty();}
+
+    private:
+      std::vector<TString> fPatterns;
+      std::vector<QuantSpec> fSpecs;
+  };
+
+  inline UShort_t log_encode(const float& v, const QuantSpec& spec) {
+    if (v <= 0) return 0;
+    const int kmax = (1 << spec.nbits) - 1;
+    const double dlog = (std::log(spec.xmax) - std::log(spec.xmin)) / (kmax - 1);
+    const long k = 1 + std::lround( (std::log(v) - std::log(spec.xmin)) / dlog );
+    if (k < 1) return 1;
+    if (k > kmax) return kmax;
+    return k;
+  }
+
+  inline float log_decode(const UShort_t& k, const QuantSpec& spec) {
+    if (k == 0) return 0.0;
+    const int kmax = (1 << spec.nbits) - 1;
+    const double dlog = (std::log(spec.xmax) - std::log(spec.xmin)) / (kmax - 1);
+    return spec.xmin * std::exp( (k-1)*dlog );
+  }
+
+  // Emulation of TBufferFile::WriteFloat16/ReadFloat16
+  inline float f16_round_trip(const float& v, const QuantSpec& spec) {
+    if (spec.xmin < spec.xmax) {
+      const double factor =
+        (spec.nbits < 32 ? double(1u << spec.nbits) : double(0xffffffff)) / (spec.xmax - spec.xmin);
+      double x = v;
+      if (x < spec.xmin) x = spec.xmin;
+      if (x > spec.xmax) x = spec.xmax;
+      const UInt_t aint = UInt_t(0.5 + factor*(x - spec.xmin));
+      return spec.xmin + aint/factor;
+    }
+
+    const int nbits = spec.nbits;
+    union { Float_t fFloatValue; Int_t fIntValue; };
+    fFloatValue = v;
+    const UChar_t theExp = (UChar_t)(0x000000ff & ((fIntValue<<1)>>24));
+    UShort_t theMan = ((1<<(nbits+1))-1) & (fIntValue>>(23-nbits-1));
+    theMan++;
+    theMan = theMan>>1;
+    if (theMan&1<<nbits) theMan = (1<<nbits) - 1;
+    if (fFloatValue < 0) theMan |= (1<<(nbits+1));
+
+    fIntValue = theExp;
+    fIntValue <<= 23;
+    fIntValue |= (theMan & ((1<<(nbits+1))-1)) << (23-nbits);
+    if ((1<<(nbits+1)) & theMan) fFloatValue = -fFloatValue;
+    return fFloatValue;
+  }
+
+  inline float round_trip(const float& v, const QuantSpec& spec) {
+    if (spec.mode == kFloat16) return f16_round_trip(v, spec);
+    if (spec.mode == kLogCode) return log_decode(log_encode(v, spec), spec);
+    return v;
+  }
+
+  inline void encode(const float* data, UShort_t* codes, const int& n, const QuantSpec& spec) {
+    for (int i = 0; i < n; i++) codes[i] = log_encode(data[i], spec);
+  }
+
+  inline void decode(const UShort_t* codes, float* data, const int& n, const QuantSpec& spec) {
+    for (int i = 0; i < n; i++) data[i] = log_decode(codes[i], spec);
+  }
+
+  /**
+   * Retrieve the storage spec of a branch from the tree UserInfo. Branches
+   * without a record are plain floats (or Float16_t, decoded by ROOT).
+   */
+  inline QuantSpec get_branch_spec(TTree* tree, const TString& branch_name) {
+    QuantSpec spec;
+    TNamed* rec = (TNamed*)tree->GetUserInfo()->FindObject("quant:" + branch_name);
+    if (rec) parse_spec(rec->GetTitle(), spec);
+    return spec;
+  }
+
+  inline void set_branch_spec(TTree* tree, const TString& branch_name, const QuantSpec& spec) {
+    TList* info = tree->GetUserInfo();
+    TObject* old = info->FindObject("quant:" + branch_name);
+    if (old) { info->Remove(old); delete old; }
+    if (spec.mode != kFloat) info->Add( new TNamed("quant:" + branch_name, spec.Encode()) );
+  }
+
+  /**
+   * Relative error accumulated over the values of a quantised branch with
+   * respect to the original float values. Zeroes are excluded from the
+   * relative error (the log code and the mantissa truncation keep them
+   * exact), values outside the encoding range are counted as clamped.
+   */
+  struct QuantStats {
+    double   max_rel_err = 0.0;
+    double   sum_rel_err = 0.0;
+    Long64_t n_values = 0;
+    Long64_t n_clamped = 0;
+
+    void Fill(const float* data, const int& n, const QuantSpec& spec) {
+      for (int i = 0; i < n; i++) {
+        if (data[i] == 0) continue;
+        const double q = round_trip(data[i], spec);
+        const double rel_err = std::fabs(q - data[i]) / std::fabs(data[i]);
+        if (rel_err > max_rel_err) max_rel_err = rel_err;
+        sum_rel_err += rel_err;
+        n_values++;
+        if (spec.mode != kFloat && spec.xmin < spec.xmax &&
+            (data[i] < spec.xmin || data[i] > spec.xmax)) n_clamped++;
+      }
+    }
+  };
+
+  inline void print_report(
+      const std::vector<TString>& names,
+      const std::vector<QuantSpec>& specs,
+      const std::vector<QuantStats>& stats)
+  {
+    printf("\nQuantisation report (relative error w.r.t. float output):\n");
+    printf("  %-20s %-22s %12s %12s %12s %10s\n",
+        "branch", "storage", "max rel err", "mean rel err", "values", "clamped");
+    for (size_t i = 0; i < names.size(); i++) {
+      if (specs[i].mode == kFloat) continue;
+      const auto& s = stats[i];
+      printf("  %-20s %-22s %12.3e %12.3e %12lld %10lld\n",
+          names[i].Data(), specs[i].Encode().Data(), s.max_rel_err,
+          s.n_values ? s.sum_rel_err / s.n_values : 0.0, s.n_values, s.n_clamped);
+    }
+    return;
+  }
+}
+
+#endif /* end of include guard VIS_QUANT_HH */
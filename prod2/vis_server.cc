@@ -0,0 +1,230 @@
+/**
+ * @file        : vis_server.cc
+ */
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "vis_library.hh"
+#include "vis_client.hh"
+
+/**
+ * Local visibility query service: load a make_vis_map library once and
+ * serve batched queries from the fast-simulation workers of the node over
+ * a Unix domain socket (see vis_client.hh for the protocol). Each client
+ * connection is served by its own thread, the library is read-only. At
+ * most max_clients connections are served at once, the others wait in the
+ * listen backlog until a connection closes.
+ */
+
+static std::string g_socket_path = vis_service::DEFAULT_SOCKET;
+static int g_listen_fd = -1;
+
+// live client connections
+static std::mutex g_clients_mutex;
+static std::condition_variable g_clients_cv;
+static int g_n_clients = 0;
+
+void handle_signal(int) {
+  if (g_listen_fd >= 0) close(g_listen_fd);
+  unlink(g_socket_path.c_str());
+  _exit(EXIT_SUCCESS);
+}
+
+void serve_client(const int fd, const vis_tree::VisLibrary& vislib) {
+  using namespace vis_service;
+  std::vector<float> points;
+  std::vector<float> reply;
+
+  RequestHeader req;
+  while (read_full(fd, &req, sizeof(req))) {
+    ReplyHeader rep = {MAGIC, kOk, 0, 0};
+
+    if (req.magic != MAGIC || req.n_points > MAX_BATCH_POINTS) {
+      rep.status = kBadRequest;
+      write_full(fd, &rep, sizeof(rep));
+      break;
+    }
+
+    points.resize(3*size_t(req.n_points));
+    if (read_full(fd, points.data(), sizeof(float)*points.size()) == false) break;
+
+    if (req.kind == kInfo) {
+      reply.clear();
+      for (int k = 0; k < 3; k++) {
+        const auto& axis = vislib.GetAxis(k);
+        reply.push_back( axis.empty() ? 0 : axis.front() );
+        reply.push_back( axis.empty() ? 0 : axis.back() );
+      }
+      reply.push_back( vislib.GetNPoints() );
+      rep.n_points = 1;
+      rep.n_channels = INFO_SIZE;
+    }
+    else if (req.kind >= vis_tree::N_GROUP) {
+      rep.status = kBadRequest;
+    }
+    else if (vislib.HasGroup(req.kind) == false) {
+      rep.status = kGroupNotLoaded;
+    }
+    else {
+      const size_t nch = vis_tree::get_group_size(req.kind);
+      if (nch*req.n_points > MAX_REPLY_FLOATS) {
+        // the client splits the query with the number of channels
+        rep.status = kTooLarge;
+        rep.n_channels = nch;
+        if (write_full(fd, &rep, sizeof(rep)) == false) break;
+        continue;
+      }
+      reply.assign(nch*req.n_points, 0.0);
+      for (size_t i = 0; i < req.n_points; i++) {
+        const Long64_t ipoint = vislib.Locate(points[3*i], points[3*i+1], points[3*i+2]);
+        if (ipoint < 0) continue;
+        const float* vis = vislib.Get(req.kind, ipoint);
+        std::copy(vis, vis+nch, &reply[i*nch]);
+      }
+      rep.n_points = req.n_points;
+      rep.n_channels = nch;
+    }
+
+    if (write_full(fd, &rep, sizeof(rep)) == false) break;
+    if (rep.status == kOk &&
+        write_full(fd, reply.data(), sizeof(float)*rep.n_points*rep.n_channels) == false) break;
+  }
+
+  close(fd);
+  {
+    std::lock_guard<std::mutex> lock(g_clients_mutex);
+    g_n_clients--;
+  }
+  g_clients_cv.notify_one();
+  return;
+}
+
+int vis_server(const TString& library_path, const unsigned& group_mask, const int& max_clients) {
+  vis_tree::VisLibrary vislib;
+  printf("vis_server: loading %s...\n", library_path.Data());
+  if (vislib.Load(library_path, group_mask) == false) return 1;
+  printf("vis_server: %zu points loaded, grid %zu x %zu x %zu\n", vislib.GetNPoints(),
+      vislib.GetAxis(0).size(), vislib.GetAxis(1).size(), vislib.GetAxis(2).size());
+
+  sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (g_socket_path.size() >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "vis_server ERROR: socket path too long: %s\n", g_socket_path.c_str());
+    return 1;
+  }
+  std::strncpy(addr.sun_path, g_socket_path.c_str(), sizeof(addr.sun_path)-1);
+
+  g_listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(g_socket_path.c_str());
+  if (g_listen_fd < 0 ||
+      bind(g_listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0 ||
+      listen(g_listen_fd, 128) < 0) {
+    fprintf(stderr, "vis_server ERROR: Unable to listen on %s: %s\n",
+        g_socket_path.c_str(), strerror(errno));
+    return 1;
+  }
+
+  signal(SIGINT, handle_signal);
+  signal(SIGTERM, handle_signal);
+  signal(SIGPIPE, SIG_IGN);
+  printf("vis_server: listening on %s\n", g_socket_path.c_str());
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(g_clients_mutex);
+      g_clients_cv.wait(lock, [&]() {return g_n_clients < max_clients;});
+    }
+    const int fd = accept(g_listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR) continue;
+      perror("vis_server ERROR: accept");
+      break;
+    }
+    {
+      std::lock_guard<std::mutex> lock(g_clients_mutex);
+      g_n_clients++;
+    }
+    std::thread(serve_client, fd, std::cref(vislib)).detach();
+  }
+
+  close(g_listen_fd);
+  unlink(g_socket_path.c_str());
+  return 0;
+}
+
+void print_usage() {
+  printf("vis_server usage:\n");
+  printf("\t-i | --input\tmake_vis_map library file\n");
+  printf("\t-s | --socket\tUnix socket path (default: %s)\n", vis_service::DEFAULT_SOCKET);
+  printf("\t-n | --no-sipm\tdo not load the SiPM arrays (tile-level queries only)\n");
+  printf("\t-c | --max-clients\tclient connections served at once (default: 64)\n");
+
+  return;
+}
+
+int main (int argc, char *argv[]) {
+  const char* short_opts = "i:s:nc:h";
+  static struct option long_opts[6] =
+  {
+    {"input", required_argument, 0, 'i'},
+    {"socket", required_argument, 0, 's'},
+    {"no-sipm", no_argument, 0, 'n'},
+    {"max-clients", required_argument, 0, 'c'},
+    {"help", no_argument, 0, 'h'},
+    {nullptr, no_argument, nullptr, 0}
+  };
+
+  int c, option_index;
+
+  TString library_path = "";
+  unsigned group_mask = vis_tree::ALL_GROUPS;
+  int max_clients = 64;
+
+  while ( (c = getopt_long(argc, argv, short_opts, long_opts, &option_index)) != -1) {
+    switch(c) {
+      case 'i' :
+        library_path = optarg;
+        break;
+      case 's' :
+        g_socket_path = optarg;
+        break;
+      case 'n' :
+        group_mask &= ~(1u << vis_tree::kGroupSiPM);
+        break;
+      case 'c' :
+        max_clients = std::max(atoi(optarg), 1);
+        break;
+      case 'h' :
+        print_usage();
+        exit( EXIT_SUCCESS );
+        break;
+      case '?' :
+        printf("vis_server error: unknown flag %c\n", optopt);
+        print_usage();
+        exit( EXIT_FAILURE );
+        break;
+    }
+  }
+
+  if (library_path.IsNull()) {
+    printf("vis_server error: no input library\n");
+    print_usage();
+    exit( EXIT_FAILURE );
+  }
+
+  return vis_server(library_path, group_mask, max_clients);
+}
@@ -0,0 +1,285 @@
+/**
+ * @file        : vis_spatial_index.hh
+ */
+
+#ifndef VIS_SPATIAL_INDEX_HH
+#define VIS_SPATIAL_INDEX_HH
+
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include "TFile.h"
+#include "TTree.h"
+#include "TBranch.h"
+#include "TNamed.h"
+#include "TList.h"
+
+#include "vis_tree_io.hh"
+
+/**
+ * Entry ordering and spatial index of a make_vis_map library.
+ *
+ * The source points lie on the x/y/z production grid. Each point gets the
+ * integer coordinates of its grid node and a key along a curve through the
+ * grid: the lexicographic (x, y, z) order of export_filemap.sql, a Morton
+ * (z-order) curve or a Hilbert curve. With the entries sorted along a
+ * curve, neighbouring points end up in the same TTree cluster.
+ *
+ * The INDEX_TREE stores one entry per cluster of the library: the entry
+ * range, the range of curve keys and the bounding box of its points. A
+ * region query selects the clusters whose box overlaps the region and
+ * reads only those, so its I/O scales with the region size.
+ */
+namespace vis_tree {
+
+  const char* const INDEX_TREE = "photonLibIndex";
+
+  enum ECurveOrder {kOrderLex = 0, kOrderMorton = 1, kOrderHilbert = 2};
+
+  const char* const CURVE_LABEL[3] = {"lex", "morton", "hilbert"};
+
+  inline int parse_curve_order(const TString& label) {
+    for (int i = 0; i < 3; i++) {
+      if (label == CURVE_LABEL[i]) return i;
+    }
+    return -1;
+  }
+
+  // Number of bits per axis for a grid of n_max nodes along the largest axis
+  inline int get_curve_bits(const size_t& n_max) {
+    int nbits = 1;
+    while ( (size_t(1) << nbits) < n_max ) nbits++;
+    return nbits;
+  }
+
+  // Interleave the bits of the three coordinates, x most significant
+  inline ULong64_t interleave_bits(const UInt_t* X, const int& nbits) {
+    ULong64_t key = 0;
+    for (int b = nbits-1; b >= 0; b--) {
+      for (int i = 0; i < 3; i++) key = (key << 1) | ((X[i] >> b) & 1u);
+    }
+    return key;
+  }
+
+  inline ULong64_t morton_key(const UInt_t* inode, const int& nbits) {
+    return interleave_bits(inode, nbits);
+  }
+
+  // Hilbert key (J. Skilling, AIP Conf. Proc. 707, 381 (2004))
+  inline ULong64_t hilbert_key(const UInt_t* inode, const int& nbits) {
+    UInt_t X[3] = {inode[0], inode[1], inode[2]};
+    const UInt_t M = 1u << (nbits-1);
+    // inverse undo excess work
+    for (UInt_t Q = M; Q > 1; Q >>= 1) {
+      const UInt_t P = Q - 1;
+      for (int i = 0; i < 3; i++) {
+        if (X[i] & Q) X[0] ^= P;
+        else {
+          const UInt_t t = (X[0] ^ X[i]) & P;
+          X[0] ^= t;
+          X[i] ^= t;
+        }
+      }
+    }
+    // Gray encode
+    for (int i = 1; i < 3; i++) X[i] ^= X[i-1];
+    UInt_t t = 0;
+    for (UInt_t Q = M; Q > 1; Q >>= 1) {
+      if (X[2] & Q) t ^= Q - 1;
+    }
+    for (int i = 0; i < 3; i++) X[i] ^= t;
+    return interleave_bits(X, nbits);
+  }
+
+  inline ULong64_t get_curve_key(const int& order, const UInt_t* inode,
+      const size_t* n_nodes, const int& nbits)
+  {
+    if (order == kOrderMorton) return morton_key(inode, nbits);
+    if (order == kOrderHilbert) return hilbert_key(inode, nbits);
+    return (ULong64_t(inode[0])*n_nodes[1] + inode[1])*n_nodes[2] + inode[2];
+  }
+
+  struct ClusterRange {
+    Long64_t  entry_lo = 0;
+    Long64_t  entry_hi = 0; // one past the last entry
+    ULong64_t key_lo = 0;
+    ULong64_t key_hi = 0;
+    float     bbox[6] = {0, 0, 0, 0, 0, 0}; // xmin, xmax, ymin, ymax, zmin, zmax
+
+    bool Overlaps(const float* box) const {
+      for (int k = 0; k < 3; k++) {
+        if (bbox[2*k] > box[2*k+1] || bbox[2*k+1] < box[2*k]) return false;
+      }
+      return true;
+    }
+  };
+
+  /**
+   * Build the cluster table of a library from the coordinates and curve
+   * keys of its entries, following the cluster boundaries of the tree.
+   */
+  inline std::vector<ClusterRange> build_cluster_table(TTree* tree,
+      const std::vector<float>& coords, const std::vector<ULong64_t>& keys)
+  {
+    std::vector<ClusterRange> table;
+    const Long64_t n_entries = keys.size();
+    auto clusters = tree->GetClusterIterator(0);
+    Long64_t start = 0;
+    while ( (start = clusters.Next()) < n_entries ) {
+      ClusterRange cl;
+      cl.entry_lo = start;
+      cl.entry_hi = std::min(clusters.GetNextEntry(), n_entries);
+      cl.key_lo = keys[start];
+      cl.key_hi = keys[start];
+      for (int k = 0; k < 3; k++) {
+        cl.bbox[2*k] = cl.bbox[2*k+1] = coords[3*start+k];
+      }
+      for (Long64_t i = start; i < cl.entry_hi; i++) {
+        cl.key_lo = std::min(cl.key_lo, keys[i]);
+        cl.key_hi = std::max(cl.key_hi, keys[i]);
+        for (int k = 0; k < 3; k++) {
+          cl.bbox[2*k  ] = std::min(cl.bbox[2*k  ], coords[3*i+k]);
+          cl.bbox[2*k+1] = std::max(cl.bbox[2*k+1], coords[3*i+k]);
+        }
+      }
+      table.push_back(cl);
+    }
+    return table;
+  }
+
+  inline void write_cluster_table(const std::vector<ClusterRange>& table, const int& order) {
+    TTree* index = new TTree(INDEX_TREE,
+        Form("SoLAr@ProtoDUNE3 Photon Library spatial index (%s)", CURVE_LABEL[order]));
+    ClusterRange cl;
+    index->Branch("entry_lo", &cl.entry_lo, "entry_lo/L");
+    index->Branch("entry_hi", &cl.entry_hi, "entry_hi/L");
+    index->Branch("key_lo", &cl.key_lo, "key_lo/l");
+    index->Branch("key_hi", &cl.key_hi, "key_hi/l");
+    index->Branch("bbox", cl.bbox, "bbox[6]/F");
+    index->GetUserInfo()->Add( new TNamed("curve_order", CURVE_LABEL[order]) );
+    for (const auto& c : table) {
+      cl = c;
+      index->Fill();
+    }
+    index->Write();
+    return;
+  }
+
+  /**
+   * Region queries on a make_vis_map library. Select() returns the entries
+   * inside an axis-aligned box reading the coordinates of the overlapping
+   * clusters only; the entries can then be read with GetTree()->GetEntry()
+   * with the branches of interest enabled.
+   */
+  class VisRegionQuery {
+    public:
+      VisRegionQuery() {}
+      ~VisRegionQuery() {Close();}
+      VisRegionQuery(const VisRegionQuery&) = delete;
+      VisRegionQuery& operator=(const VisRegionQuery&) = delete;
+
+      bool Open(const TString& file_path) {
+        Close();
+        fFile = TFile::Open(file_path);
+        if (fFile == nullptr || fFile->IsZombie()) {
+          fprintf(stderr, "VisRegionQuery ERROR: Unable to open %s\n", file_path.Data());
+          Close();
+          return false;
+        }
+        fTree = fFile->Get<TTree>(LIB_TREE);
+        if (fTree == nullptr) {
+          fprintf(stderr, "VisRegionQuery ERROR: No %s tree in %s\n", LIB_TREE, file_path.Data());
+          Close();
+          return false;
+        }
+
+        TTree* index = fFile->Get<TTree>(INDEX_TREE);
+        if (index == nullptr) {
+          // library without index: a single cluster covering everything
+          fprintf(stderr, "VisRegionQuery WARNING: No %s in %s, queries will scan the library\n",
+              INDEX_TREE, file_path.Data());
+          ClusterRange cl;
+          cl.entry_hi = fTree->GetEntries();
+          cl.bbox[0] = cl.bbox[2] = cl.bbox[4] = -1e30;
+          cl.bbox[1] = cl.bbox[3] = cl.bbox[5] =  1e30;
+          fClusters.push_back(cl);
+          return true;
+        }
+
+        ClusterRange cl;
+        index->SetBranchAddress("entry_lo", &cl.entry_lo);
+        index->SetBranchAddress("entry_hi", &cl.entry_hi);
+        index->SetBranchAddress("key_lo", &cl.key_lo);
+        index->SetBranchAddress("key_hi", &cl.key_hi);
+        index->SetBranchAddress("bbox", cl.bbox);
+        for (Long64_t i = 0; i < index->GetEntries(); i++) {
+          index->GetEntry(i);
+          fClusters.push_back(cl);
+        }
+        index->ResetBranchAddresses();
+        TNamed* rec = (TNamed*)index->GetUserInfo()->FindObject("curve_order");
+        if (rec) fOrder = parse_curve_order(rec->GetTitle());
+        return true;
+      }
+
+      void Close() {
+        if (fFile) {
+          fFile->Close();
+          delete fFile;
+        }
+        fFile = nullptr;
+        fTree = nullptr;
+        fClusters.clear();
+        fOrder = kOrderLex;
+      }
+
+      TTree* GetTree() const {return fTree;}
+
+      int GetOrder() const {return fOrder;}
+
+      const std::vector<ClusterRange>& GetClusters() const {return fClusters;}
+
+      // Clusters overlapping the box {xmin, xmax, ymin, ymax, zmin, zmax}
+      std::vector<size_t> FindClusters(const float* box) const {
+        std::vector<size_t> found;
+        for (size_t i = 0; i < fClusters.size(); i++) {
+          if (fClusters[i].Overlaps(box)) found.push_back(i);
+        }
+        return found;
+      }
+
+      std::vector<Long64_t> Select(const float* box) {
+        std::vector<Long64_t> entries;
+        float xyz[3] = {0, 0, 0};
+        TBranch* br[3] = {fTree->GetBranch("x"), fTree->GetBranch("y"), fTree->GetBranch("z")};
+        for (int k = 0; k < 3; k++) br[k]->SetAddress(&xyz[k]);
+
+        for (const auto& icl : FindClusters(box)) {
+          const auto& cl = fClusters[icl];
+          for (Long64_t i = cl.entry_lo; i < cl.entry_hi; i++) {
+            for (int k = 0; k < 3; k++) br[k]->GetEntry(i);
+            bool inside = true;
+            for (int k = 0; k < 3; k++) {
+              if (xyz[k] < box[2*k] || xyz[k] > box[2*k+1]) inside = false;
+            }
+            if (inside) entries.push_back(i);
+          }
+        }
+
+        for (int k = 0; k < 3; k++) br[k]->ResetAddress();
+        return entries;
+      }
+
+      Long64_t GetBytesRead() const {return fFile ? fFile->GetBytesRead() : 0;}
+
+      Long64_t GetFileSize() const {return fFile ? fFile->GetSize() : 0;}
+
+    private:
+      TFile* fFile = nullptr;
+      TTree* fTree = nullptr;
+      int fOrder = kOrderLex;
+      std::vector<ClusterRange> fClusters;
+  };
+}
+
+#endif /* end of include guard VIS_SPATIAL_INDEX_HH */
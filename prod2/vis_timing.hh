@@ -0,0 +1,81 @@
+/**
+ * @file        : vis_timing.hh
+ */
+
+#ifndef VIS_TIMING_HH
+#define VIS_TIMING_HH
+
+#include <cmath>
+#include <algorithm>
+#include "Rtypes.h"
+
+/**
+ * Photon arrival-time profiles of the anode tiles.
+ *
+ * The hit times of each tile are accumulated in a fixed histogram with
+ * N_TBIN bins: [0, T_MIN) and N_TBIN-1 logarithmic bins up to T_MAX (later
+ * hits are clamped to the last bin). Being integer counts with fixed bins,
+ * the histograms of partial results can be summed (raw count mode).
+ *
+ * In the library the histogram of each tile and point is compressed into a
+ * table of N_QUANT arrival-time quantiles, q = 0, 1/(N_QUANT-1), ..., 1.
+ * The first entry is the arrival delay of the earliest photons, and
+ * arrival times are sampled cheaply by interpolating the table at a
+ * uniform random number (logarithmic interpolation between the nodes).
+ */
+namespace vis_timing {
+
+  const int N_TBIN = 64;
+  const double T_MIN = 1.0;   // ns
+  const double T_MAX = 1.0e4; // ns
+  const int N_QUANT = 17;
+
+  inline double get_bin_low_edge(const int& ibin) {
+    if (ibin <= 0) return 0.0;
+    return T_MIN * std::pow(T_MAX/T_MIN, double(ibin-1)/(N_TBIN-1));
+  }
+
+  inline int get_time_bin(const double& t) {
+    if (t < T_MIN) return 0;
+    const int ibin = 1 + int( (N_TBIN-1) * std::log(t/T_MIN) / std::log(T_MAX/T_MIN) );
+    return (ibin < N_TBIN) ? ibin : N_TBIN-1;
+  }
+
+  // Compress a time histogram into the quantile table
+  inline void compress(const UInt_t* hist, float* quantiles) {
+    double n_tot = 0;
+    for (int ib = 0; ib < N_TBIN; ib++) n_tot += hist[ib];
+    if (n_tot == 0) {
+      for (int k = 0; k < N_QUANT; k++) quantiles[k] = 0.0;
+      return;
+    }
+
+    int ib = 0;
+    double cum = 0;
+    for (int k = 0; k < N_QUANT; k++) {
+      const double target = n_tot * k / (N_QUANT-1);
+      // first bin that contains the target fraction of the hits
+      while (ib < N_TBIN-1 && (hist[ib] == 0 || cum + hist[ib] < target)) {
+        cum += hist[ib];
+        ib++;
+      }
+      const double lo = get_bin_low_edge(ib);
+      const double hi = get_bin_low_edge(ib+1);
+      const double frac = hist[ib] ? (target - cum) / hist[ib] : 0.0;
+      quantiles[k] = lo + (hi - lo) * std::min(1.0, std::max(0.0, frac));
+    }
+    return;
+  }
+
+  // Sample an arrival time from a quantile table, u uniform in [0, 1)
+  inline float sample(const float* quantiles, const double& u) {
+    const double x = u * (N_QUANT-1);
+    int k = int(x);
+    if (k >= N_QUANT-1) k = N_QUANT-2;
+    // interpolate in log(t) as the histogram binning, linearly near t = 0
+    if (quantiles[k] < T_MIN) return quantiles[k] + (x - k) * (quantiles[k+1] - quantiles[k]);
+    return quantiles[k] * std::pow(quantiles[k+1] / quantiles[k], x - k);
+  }
+}
+
+#endif /* end of include guard VIS_TIMING_HH */
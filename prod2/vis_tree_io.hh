@@ -0,0 +1,472 @@
+/**
+ * @file        : vis_tree_io.hh
+ */
+
+#ifndef VIS_TREE_IO_HH
+#define VIS_TREE_IO_HH
+
+#include <cstring>
+#include <vector>
+#include "TString.h"
+#include "TTree.h"
+
+#include "vis_quant.hh"
+#include "vis_timing.hh"
+
+/**
+ * Layout of the SoLAr@ProtoDUNE3 photon library trees.
+ *
+ * Two formats are produced:
+ *  - `photonLib`: normalised visibilities (float, optionally quantised),
+ *    one entry per source point. This is the format of the library.
+ *  - `photonLibCounts`: raw integer hit counts and number of events per
+ *    point. Partial results for the same point can be summed exactly and
+ *    normalised at the end (see reduce_vis_tree).
+ *
+ * Both can optionally carry the arrival-time profiles of the tiles, as
+ * histograms (raw counts) or quantile tables (library), see vis_timing.hh.
+ *
+ * The `hitSkim` tree is a flat per-event copy of the SiPM hits of the
+ * SoLAr-sim output, from which both formats can be rebuilt quickly.
+ */
+namespace vis_tree {
+
+  const int N_CRU = 2;
+  const int N_CRU_TILE = 30;
+  const int N_CRU_SIPM = 160;
+
+  const int N_CRU_EDGE = 1;
+  const int N_EDGE_TILE = 10;
+  const int N_EDGE_SIPM = 60;
+
+  const int N_ANODE = 3;
+  const int NTILE_MAIN = N_CRU*N_CRU_TILE;
+  const int NTILE_LAT  = N_CRU_EDGE*N_EDGE_TILE;
+  const int NSIPM_MAIN = NTILE_MAIN*N_CRU_SIPM;
+  const int NSIPM_LAT  = NTILE_LAT*N_EDGE_SIPM;
+  const int NTILE[N_ANODE] = {NTILE_MAIN, NTILE_LAT, NTILE_LAT};
+  const int NSIPM[N_ANODE] = {NSIPM_MAIN, NSIPM_LAT, NSIPM_LAT};
+  const int NSIPM_PER_TILE[N_ANODE] = {N_CRU_SIPM, N_EDGE_SIPM, N_EDGE_SIPM};
+  const char* const ANODE_LABEL[N_ANODE] = {"main", "edge0", "edge1"};
+
+  // SiPM branches of the photonLib tree keep their historical names
+  const char* const SIPM_BRANCH[N_ANODE] = {"vis_sipm_main", "vis_sipm_edge00", "vis_sipm_edge11"};
+  const char* const SIPM_LEAF  [N_ANODE] = {"vis_sipm_main", "vis_sipm_edge0" , "vis_sipm_edge1" };
+
+  enum EVisComponent {kTot = 0, kDir = 1, kWls = 2};
+  const int N_COMPONENT = 3;
+  const char* const COMPONENT_LABEL[N_COMPONENT] = {"tot", "dir", "wls"};
+
+  const float NUM_PHOTONS = 1e7;
+  const char* const LIB_TREE = "photonLib";
+  const char* const COUNTS_TREE = "photonLibCounts";
+  const char* const SKIM_TREE = "hitSkim";
+
+  const int N_PROC = 6;
+  const int MAX_SKIM_SIPM = NSIPM_MAIN + 2*NSIPM_LAT;
+  const int MAX_SKIM_TBIN = MAX_SKIM_SIPM * vis_timing::N_TBIN;
+
+  inline int get_sipm_index_main(const int& mt_idx, const int& t_idx, const int& sipm_idx)
+  {
+    int idx = sipm_idx + N_CRU_SIPM*(t_idx + N_CRU_TILE*(mt_idx));
+    return idx;
+  }
+
+  inline int get_sipm_index_lat(const int& mt_idx, const int& t_idx, const int& sipm_idx)
+  {
+    int idx = sipm_idx + N_EDGE_SIPM*(t_idx + N_EDGE_TILE*(mt_idx));
+    return idx;
+  }
+
+  inline int get_tile_index_main(const int& mt_idx, const int& t_idx) {
+    return t_idx + N_CRU_TILE*(mt_idx);
+  }
+
+  inline int get_tile_index_lat(const int& mt_idx, const int& t_idx) {
+    return t_idx + N_EDGE_TILE*(mt_idx);
+  }
+
+  inline int get_anode_idx(const Int_t& tpc_id) {
+    if (tpc_id == 11) return 0;
+    else if (tpc_id == 12) return 1;
+    else if (tpc_id == 13) return 2;
+    else return -1;
+  }
+
+  /**
+   * Raw hit counts of a source point.
+   */
+  struct VisCounts {
+    float coords[3] = {0.0, 0.0, 0.0};
+    UInt_t n_events_per_point = 0;
+    float  n_photons = NUM_PHOTONS;
+    ULong64_t n_hits[N_COMPONENT] = {0};
+    UInt_t tile_main[N_COMPONENT][NTILE_MAIN] = {{0}};
+    UInt_t tile_lat0[N_COMPONENT][NTILE_LAT ] = {{0}};
+    UInt_t tile_lat1[N_COMPONENT][NTILE_LAT ] = {{0}};
+    UInt_t sipm_main[NSIPM_MAIN] = {0};
+    UInt_t sipm_lat0[NSIPM_LAT ] = {0};
+    UInt_t sipm_lat1[NSIPM_LAT ] = {0};
+    UInt_t thist_main[NTILE_MAIN][vis_timing::N_TBIN] = {{0}};
+    UInt_t thist_lat0[NTILE_LAT ][vis_timing::N_TBIN] = {{0}};
+    UInt_t thist_lat1[NTILE_LAT ][vis_timing::N_TBIN] = {{0}};
+
+    UInt_t* Tile(const int& comp, const int& anode) {
+      if (anode == 0) return tile_main[comp];
+      else if (anode == 1) return tile_lat0[comp];
+      return tile_lat1[comp];
+    }
+
+    const UInt_t* Tile(const int& comp, const int& anode) const {
+      return const_cast<VisCounts*>(this)->Tile(comp, anode);
+    }
+
+    UInt_t* SiPM(const int& anode) {
+      if (anode == 0) return sipm_main;
+      else if (anode == 1) return sipm_lat0;
+      return sipm_lat1;
+    }
+
+    const UInt_t* SiPM(const int& anode) const {
+      return const_cast<VisCounts*>(this)->SiPM(anode);
+    }
+
+    // Arrival-time histograms of the tiles of an anode (N_TBIN per tile)
+    UInt_t* TimeHist(const int& anode) {
+      if (anode == 0) return thist_main[0];
+      else if (anode == 1) return thist_lat0[0];
+      return thist_lat1[0];
+    }
+
+    const UInt_t* TimeHist(const int& anode) const {
+      return const_cast<VisCounts*>(this)->TimeHist(anode);
+    }
+
+    void AddHitTime(const int& anode, const int& sipm_idx, const double& t, const UInt_t& n) {
+      AddHitTimeBin(anode, sipm_idx, vis_timing::get_time_bin(t), n);
+    }
+
+    void AddHitTimeBin(const int& anode, const int& sipm_idx, const int& ibin, const UInt_t& n) {
+      const int tile_idx = sipm_idx / NSIPM_PER_TILE[anode];
+      TimeHist(anode)[tile_idx*vis_timing::N_TBIN + ibin] += n;
+    }
+
+    // Reset the counters (the point coordinates are kept)
+    void Reset() {
+      n_events_per_point = 0;
+      std::memset(n_hits, 0, sizeof(n_hits));
+      std::memset(tile_main, 0, sizeof(tile_main));
+      std::memset(tile_lat0, 0, sizeof(tile_lat0));
+      std::memset(tile_lat1, 0, sizeof(tile_lat1));
+      std::memset(sipm_main, 0, sizeof(sipm_main));
+      std::memset(sipm_lat0, 0, sizeof(sipm_lat0));
+      std::memset(sipm_lat1, 0, sizeof(sipm_lat1));
+      std::memset(thist_main, 0, sizeof(thist_main));
+      std::memset(thist_lat0, 0, sizeof(thist_lat0));
+      std::memset(thist_lat1, 0, sizeof(thist_lat1));
+    }
+
+    /**
+     * Add the hits of a SiPM. nHitsPerProc follows the backtracker process
+     * convention: [0] total, [3] WLS, [4] direct scintillation light.
+     */
+    void AddSiPMHits(const int& anode, const int& sipm_idx, const int* nHitsPerProc) {
+      const int tile_idx = sipm_idx / NSIPM_PER_TILE[anode];
+      n_hits[kTot] += nHitsPerProc[0];
+      n_hits[kDir] += nHitsPerProc[4];
+      n_hits[kWls] += nHitsPerProc[3];
+      Tile(kTot, anode)[tile_idx] += nHitsPerProc[0];
+      Tile(kDir, anode)[tile_idx] += nHitsPerProc[4];
+      Tile(kWls, anode)[tile_idx] += nHitsPerProc[3];
+      SiPM(anode)[sipm_idx] += nHitsPerProc[0];
+    }
+
+    // Sum the counts of another (partial) accumulator of the same point
+    void Add(const VisCounts& other) {
+      n_events_per_point += other.n_events_per_point;
+      for (int ic = 0; ic < N_COMPONENT; ic++) {
+        n_hits[ic] += other.n_hits[ic];
+        for (int ia = 0; ia < N_ANODE; ia++) {
+          UInt_t* t = Tile(ic, ia);
+          const UInt_t* t_other = other.Tile(ic, ia);
+          for (int it = 0; it < NTILE[ia]; it++) t[it] += t_other[it];
+        }
+      }
+      for (int ia = 0; ia < N_ANODE; ia++) {
+        UInt_t* s = SiPM(ia);
+        const UInt_t* s_other = other.SiPM(ia);
+        for (int is = 0; is < NSIPM[ia]; is++) s[is] += s_other[is];
+        UInt_t* h = TimeHist(ia);
+        const UInt_t* h_other = other.TimeHist(ia);
+        for (int ib = 0; ib < NTILE[ia]*vis_timing::N_TBIN; ib++) h[ib] += h_other[ib];
+      }
+    }
+
+    void Book(TTree* tree, const bool& with_timing = false) {
+      tree->Branch("x", &coords[0]);
+      tree->Branch("y", &coords[1]);
+      tree->Branch("z", &coords[2]);
+      tree->Branch("n_events_per_point", &n_events_per_point, "n_events_per_point/i");
+      tree->Branch("n_photons", &n_photons, "n_photons/F");
+      for (int ic = 0; ic < N_COMPONENT; ic++) {
+        tree->Branch(Form("n_%s", COMPONENT_LABEL[ic]), &n_hits[ic],
+            Form("n_%s/l", COMPONENT_LABEL[ic]));
+      }
+      for (int ic = 0; ic < N_COMPONENT; ic++) {
+        for (int ia = 0; ia < N_ANODE; ia++) {
+          TString name = Form("n_%s_tile_%s", COMPONENT_LABEL[ic], ANODE_LABEL[ia]);
+          tree->Branch(name, Tile(ic, ia), Form("%s[%i]/i", name.Data(), NTILE[ia]));
+        }
+      }
+      for (int ia = 0; ia < N_ANODE; ia++) {
+        TString name = Form("n_sipm_%s", ANODE_LABEL[ia]);
+        tree->Branch(name, SiPM(ia), Form("%s[%i]/i", name.Data(), NSIPM[ia]));
+      }
+      if (with_timing == false) return;
+      for (int ia = 0; ia < N_ANODE; ia++) {
+        TString name = Form("t_hist_tile_%s", ANODE_LABEL[ia]);
+        tree->Branch(name, TimeHist(ia), Form("%s[%i]/i", name.Data(), NTILE[ia]*vis_timing::N_TBIN));
+      }
+    }
+
+    // Returns true if the tree carries the arrival-time histograms
+    bool SetAddresses(TTree* tree) {
+      tree->SetBranchAddress("x", &coords[0]);
+      tree->SetBranchAddress("y", &coords[1]);
+      tree->SetBranchAddress("z", &coords[2]);
+      tree->SetBranchAddress("n_events_per_point", &n_events_per_point);
+      tree->SetBranchAddress("n_photons", &n_photons);
+      for (int ic = 0; ic < N_COMPONENT; ic++) {
+        tree->SetBranchAddress(Form("n_%s", COMPONENT_LABEL[ic]), &n_hits[ic]);
+        for (int ia = 0; ia < N_ANODE; ia++) {
+          tree->SetBranchAddress(Form("n_%s_tile_%s", COMPONENT_LABEL[ic], ANODE_LABEL[ia]), Tile(ic, ia));
+        }
+      }
+      for (int ia = 0; ia < N_ANODE; ia++) {
+        tree->SetBranchAddress(Form("n_sipm_%s", ANODE_LABEL[ia]), SiPM(ia));
+      }
+      if (tree->GetBranch("t_hist_tile_main") == nullptr) return false;
+      for (int ia = 0; ia < N_ANODE; ia++) {
+        tree->SetBranchAddress(Form("t_hist_tile_%s", ANODE_LABEL[ia]), TimeHist(ia));
+      }
+      return true;
+    }
+  };
+
+  /**
+   * Flat SiPM hit table of a SoLAr-sim event (see make_hit_skim). Each
+   * SiPM with hits is stored with its anode, its index from the
+   * get_sipm_index_* mapping and its hit counts per backtracker process
+   * ([0] total, [3] WLS, [4] direct scintillation light). The hit times
+   * are kept as the non-empty vis_timing bins of each SiPM: tbin_sipm is
+   * the position of the SiPM in the table, tbin the time bin.
+   */
+  struct HitSkimEvent {
+    Long64_t event_id = 0;
+    float  coords[3] = {0.0, 0.0, 0.0};
+    Int_t  n_sipm = 0;
+    UChar_t  sipm_anode[MAX_SKIM_SIPM] = {0};
+    UShort_t sipm_idx[MAX_SKIM_SIPM] = {0};
+    UInt_t   hit_counts[MAX_SKIM_SIPM][N_PROC] = {{0}};
+    Int_t    n_tbin = 0;
+    UShort_t tbin_sipm[MAX_SKIM_TBIN] = {0};
+    UChar_t  tbin[MAX_SKIM_TBIN] = {0};
+    UInt_t   tbin_hits[MAX_SKIM_TBIN] = {0};
+
+    void Book(TTree* tree) {
+      tree->Branch("event_id", &event_id, "event_id/L");
+      tree->Branch("x", &coords[0], "x/F");
+      tree->Branch("y", &coords[1], "y/F");
+      tree->Branch("z", &coords[2], "z/F");
+      tree->Branch("n_sipm", &n_sipm, "n_sipm/I");
+      tree->Branch("sipm_anode", sipm_anode, "sipm_anode[n_sipm]/b");
+      tree->Branch("sipm_idx", sipm_idx, "sipm_idx[n_sipm]/s");
+      tree->Branch("hit_counts", hit_counts, Form("hit_counts[n_sipm][%i]/i", N_PROC));
+      tree->Branch("n_tbin", &n_tbin, "n_tbin/I");
+      tree->Branch("tbin_sipm", tbin_sipm, "tbin_sipm[n_tbin]/s");
+      tree->Branch("tbin", tbin, "tbin[n_tbin]/b");
+      tree->Branch("tbin_hits", tbin_hits, "tbin_hits[n_tbin]/i");
+    }
+
+    // Returns false if the skim has no hit times (older make_hit_skim)
+    bool SetAddresses(TTree* tree) {
+      tree->SetBranchAddress("event_id", &event_id);
+      tree->SetBranchAddress("x", &coords[0]);
+      tree->SetBranchAddress("y", &coords[1]);
+      tree->SetBranchAddress("z", &coords[2]);
+      tree->SetBranchAddress("n_sipm", &n_sipm);
+      tree->SetBranchAddress("sipm_anode", sipm_anode);
+      tree->SetBranchAddress("sipm_idx", sipm_idx);
+      tree->SetBranchAddress("hit_counts", hit_counts);
+      if (tree->GetBranch("n_tbin") == nullptr) return false;
+      tree->SetBranchAddress("n_tbin", &n_tbin);
+      tree->SetBranchAddress("tbin_sipm", tbin_sipm);
+      tree->SetBranchAddress("tbin", tbin);
+      tree->SetBranchAddress("tbin_hits", tbin_hits);
+      return true;
+    }
+  };
+
+  /**
+   * Normalised visibilities of a source point as stored in the photonLib
+   * tree. The tile and SiPM arrays can be quantised according to a
+   * vis_quant::QuantPolicy.
+   */
+  class VisBuffer {
+    public:
+      float coords[3] = {0.0, 0.0, 0.0};
+      UInt_t n_events_per_point = 0;
+      float vis[N_COMPONENT] = {0.0};
+      float tile_main[N_COMPONENT][NTILE_MAIN] = {{0.0}};
+      float tile_lat0[N_COMPONENT][NTILE_LAT ] = {{0.0}};
+      float tile_lat1[N_COMPONENT][NTILE_LAT ] = {{0.0}};
+      float sipm_main[NSIPM_MAIN] = {0.0};
+      float sipm_lat0[NSIPM_LAT ] = {0.0};
+      float sipm_lat1[NSIPM_LAT ] = {0.0};
+      float tquant_main[NTILE_MAIN][vis_timing::N_QUANT] = {{0.0}};
+      float tquant_lat0[NTILE_LAT ][vis_timing::N_QUANT] = {{0.0}};
+      float tquant_lat1[NTILE_LAT ][vis_timing::N_QUANT] = {{0.0}};
+
+      VisBuffer() {}
+      VisBuffer(const VisBuffer&) = delete;
+      VisBuffer& operator=(const VisBuffer&) = delete;
+
+      float* Tile(const int& comp, const int& anode) {
+        if (anode == 0) return tile_main[comp];
+        else if (anode == 1) return tile_lat0[comp];
+        return tile_lat1[comp];
+      }
+
+      float* SiPM(const int& anode) {
+        if (anode == 0) return sipm_main;
+        else if (anode == 1) return sipm_lat0;
+        return sipm_lat1;
+      }
+
+      // Arrival-time quantile tables of the tiles of an anode (N_QUANT per tile)
+      float* TimeQuantiles(const int& anode) {
+        if (anode == 0) return tquant_main[0];
+        else if (anode == 1) return tquant_lat0[0];
+        return tquant_lat1[0];
+      }
+
+      void Book(TTree* tree,
+          const vis_quant::QuantPolicy& quant_policy = vis_quant::QuantPolicy(),
+          const bool& with_timing = false)
+      {
+        tree->Branch("x", &coords[0]);
+        tree->Branch("y", &coords[1]);
+        tree->Branch("z", &coords[2]);
+        tree->Branch("n_events_per_point", &n_events_per_point, "n_events_per_point/i");
+
+        tree->Branch("vis_tot", &vis[kTot]);
+        tree->Branch("vis_dir", &vis[kDir]);
+        tree->Branch("vis_wls", &vis[kWls]);
+
+        fArrays.clear();
+        fArrays.reserve(N_COMPONENT*N_ANODE + N_ANODE);
+        for (int ic = 0; ic < N_COMPONENT; ic++) {
+          for (int ia = 0; ia < N_ANODE; ia++) {
+            TString name = Form("vis_%s_tile_%s", COMPONENT_LABEL[ic], ANODE_LABEL[ia]);
+            BookArray(tree, quant_policy, name, name, Tile(ic, ia), NTILE[ia]);
+          }
+        }
+        for (int ia = 0; ia < N_ANODE; ia++) {
+          BookArray(tree, quant_policy, SIPM_BRANCH[ia], SIPM_LEAF[ia], SiPM(ia), NSIPM[ia]);
+        }
+
+        fTiming = with_timing;
+        if (with_timing == false) return;
+        for (int ia = 0; ia < N_ANODE; ia++) {
+          TString name = Form("t_quant_tile_%s", ANODE_LABEL[ia]);
+          tree->Branch(name, TimeQuantiles(ia),
+              Form("%s[%i]/F", name.Data(), NTILE[ia]*vis_timing::N_QUANT));
+        }
+      }
+
+      // Normalise the raw counts to the number of generated photons
+      void Normalise(const VisCounts& counts) {
+        coords[0] = counts.coords[0];
+        coords[1] = counts.coords[1];
+        coords[2] = counts.coords[2];
+        n_events_per_point = counts.n_events_per_point;
+        const double scaling = counts.n_events_per_point * (double)counts.n_photons;
+        for (int ic = 0; ic < N_COMPONENT; ic++) {
+          vis[ic] = counts.n_hits[ic] / scaling;
+          for (int ia = 0; ia < N_ANODE; ia++) {
+            float* v = Tile(ic, ia);
+            const UInt_t* n = counts.Tile(ic, ia);
+            for (int it = 0; it < NTILE[ia]; it++) v[it] = n[it] / scaling;
+          }
+        }
+        for (int ia = 0; ia < N_ANODE; ia++) {
+          float* v = SiPM(ia);
+          const UInt_t* n = counts.SiPM(ia);
+          for (int is = 0; is < NSIPM[ia]; is++) v[is] = n[is] / scaling;
+        }
+        if (fTiming == false) return;
+        for (int ia = 0; ia < N_ANODE; ia++) {
+          for (int it = 0; it < NTILE[ia]; it++) {
+            vis_timing::compress(counts.TimeHist(ia) + it*vis_timing::N_TBIN,
+                TimeQuantiles(ia) + it*vis_timing::N_QUANT);
+          }
+        }
+      }
+
+      // Encode the quantised arrays, to be called before each TTree::Fill
+      void Quantise() {
+        for (auto& arr : fArrays) {
+          if (arr.spec.mode == vis_quant::kFloat) continue;
+          arr.stats.Fill(arr.data, arr.size, arr.spec);
+          if (arr.spec.mode == vis_quant::kLogCode) {
+            vis_quant::encode(arr.data, arr.codes.data(), arr.size, arr.spec);
+          }
+        }
+      }
+
+      bool IsQuantised() const {
+        for (const auto& arr : fArrays) {
+          if (arr.spec.mode != vis_quant::kFloat) return true;
+        }
+        return false;
+      }
+
+      void PrintQuantReport() const {
+        std::vector<TString> names;
+        std::vector<vis_quant::QuantSpec> specs;
+        std::vector<vis_quant::QuantStats> stats;
+        for (const auto& arr : fArrays) {
+          names.push_back(arr.name); specs.push_back(arr.spec); stats.push_back(arr.stats);
+        }
+        vis_quant::print_report(names, specs, stats);
+      }
+
+    private:
+      struct VisArrayBranch {
+        TString name;
+        float* data;
+        int size;
+        vis_quant::QuantSpec spec;
+        std::vector<UShort_t> codes;
+        vis_quant::QuantStats stats;
+      };
+      std::vector<VisArrayBranch> fArrays;
+      bool fTiming = false;
+
+      void BookArray(TTree* tree, const vis_quant::QuantPolicy& quant_policy,
+          const TString& name, const TString& leaf_name, float* data, const int& size)
+      {
+        fArrays.push_back( {name, data, size, quant_policy.GetSpec(name), {}, {}} );
+        auto& arr = fArrays.back();
+        void* address = data;
+        if (arr.spec.mode == vis_quant::kLogCode) {
+          arr.codes.resize(size, 0);
+          address = arr.codes.data();
+        }
+        tree->Branch(name, address, Form("%s[%i]/%s", leaf_name.Data(), size, arr.spec.LeafType().Data()));
+        vis_quant::set_branch_spec(tree, name, arr.spec);
+      }
+  };
+}
+
+#endif /* end of include guard VIS_TREE_IO_HH */
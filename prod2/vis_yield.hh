@@ -0,0 +1,253 @@
+/**
+ * @file        : vis_yield.hh
+ */
+
+#ifndef VIS_YIELD_HH
+#define VIS_YIELD_HH
+
+#include <cmath>
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include "vis_library.hh"
+
+/**
+ * Fast photon-yield estimate from the photon library: the energy
+ * depositions of a batch (e.g. one event) are converted into expected
+ * photoelectrons per SiPM and per tile, without optical tracking.
+ *
+ * Each step emits edep*yield photons from the library point closest to it
+ * (VisLibrary::Locate, which also covers the non-uniform and incomplete
+ * grids of a refined point set: no interpolation is made between points).
+ * Steps falling on the same point are merged first, so that the
+ * accumulation costs one pass over the visibility arrays per distinct
+ * point, in library order. Poisson-distributed signals can be sampled
+ * from the expectations with a multi-lane generator whose inner loops are
+ * vectorised by the compiler.
+ */
+namespace vis_yield {
+
+  struct EDepStep {
+    float x;      // mm
+    float y;      // mm
+    float z;      // mm
+    float edep;   // MeV
+    float yield;  // scintillation photons per MeV
+  };
+
+  // Above this mean the Poisson sampling uses the normal approximation
+  const float POISSON_NORMAL_MU = 30.0;
+
+  /**
+   * N_LANE independent xoshiro128+ generators advanced together, the lane
+   * loop has no dependencies between iterations and vectorises.
+   */
+  class LaneRng {
+    public:
+      static const int N_LANE = 16;
+
+      LaneRng(const uint64_t& seed = 0) {Seed(seed);}
+
+      void Seed(uint64_t seed) {
+        // splitmix64 initialisation of the lane states
+        for (int k = 0; k < 4; k++) {
+          for (int l = 0; l < N_LANE; l++) {
+            seed += 0x9e3779b97f4a7c15ull;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            fState[k][l] = uint32_t((z ^ (z >> 31)) >> 32);
+          }
+        }
+        for (int l = 0; l < N_LANE; l++) fState[0][l] |= 1u;  // no all-zero lane
+      }
+
+      // Fill u with n uniform numbers in [0, 1)
+      void Fill(float* u, const size_t& n) {
+        size_t i = 0;
+        for (; i + N_LANE <= n; i += N_LANE) Step(&u[i]);
+        if (i < n) {
+          float tail[N_LANE];
+          Step(tail);
+          std::copy(tail, tail + (n - i), &u[i]);
+        }
+      }
+
+    private:
+      uint32_t fState[4][N_LANE];
+
+      void Step(float* out) {
+        uint32_t* s0 = fState[0]; uint32_t* s1 = fState[1];
+        uint32_t* s2 = fState[2]; uint32_t* s3 = fState[3];
+        for (int l = 0; l < N_LANE; l++) {
+          const uint32_t result = s0[l] + s3[l];
+          const uint32_t t = s1[l] << 9;
+          s2[l] ^= s0[l];
+          s3[l] ^= s1[l];
+          s1[l] ^= s2[l];
+          s0[l] ^= s3[l];
+          s2[l] ^= t;
+          s3[l] = (s3[l] << 11) | (s3[l] >> 21);
+          out[l] = (result >> 8) * (1.0f / 16777216.0f);
+        }
+      }
+  };
+
+  /**
+   * Poisson samples k of the means mu. Two uniforms per value are drawn in
+   * bulk (tmp is resized as needed): inversion for small means, normal
+   * approximation (Box-Muller) above POISSON_NORMAL_MU.
+   */
+  inline void sample_poisson(const float* mu, UInt_t* k, const size_t& n,
+      LaneRng& rng, std::vector<float>& tmp)
+  {
+    tmp.resize(2*n);
+    rng.Fill(tmp.data(), 2*n);
+    for (size_t i = 0; i < n; i++) {
+      const float m = mu[i];
+      const float u = tmp[2*i];
+      if (m <= 0) {
+        k[i] = 0;
+      }
+      else if (m < POISSON_NORMAL_MU) {
+        double p = std::exp(-double(m));
+        double cdf = p;
+        UInt_t j = 0;
+        const UInt_t j_max = UInt_t(m + 20*std::sqrt(m) + 20);
+        while (u > cdf && j < j_max) {
+          j++;
+          p *= m / j;
+          cdf += p;
+        }
+        k[i] = j;
+      }
+      else {
+        const float z = std::sqrt(-2.0f*std::log(1.0f - u)) * std::cos(6.2831853f*tmp[2*i+1]);
+        k[i] = UInt_t( std::max(0.0f, std::floor(m + std::sqrt(m)*z + 0.5f)) );
+      }
+    }
+  }
+
+  /**
+   * Expected (and optionally sampled) photoelectrons of a batch of steps.
+   * An engine is meant to be used by one thread; engines of different
+   * threads can share the same library.
+   */
+  class YieldEngine {
+    public:
+      YieldEngine(const vis_tree::VisLibrary& lib, const uint64_t& seed = 0)
+        : fLib(lib), fRng(seed)
+      {
+        if (lib.HasGroup(vis_tree::kGroupSiPM)) fSiPM.resize(vis_tree::get_group_size(vis_tree::kGroupSiPM));
+        if (lib.HasGroup(vis_tree::kGroupTileTot)) fTile.resize(vis_tree::get_group_size(vis_tree::kGroupTileTot));
+      }
+
+      // Accumulate the expected photoelectrons of the steps, replacing the previous batch
+      void Process(const EDepStep* steps, const size_t& n_steps) {
+        fSources.clear();
+        for (size_t i = 0; i < n_steps; i++) {
+          const EDepStep& s = steps[i];
+          const Long64_t ipoint = fLib.Locate(s.x, s.y, s.z);
+          if (ipoint < 0) continue;
+          fSources.push_back( {ipoint, s.edep * s.yield} );
+        }
+        fNLocated = fSources.size();
+
+        // merge the steps on the same library point
+        std::sort(fSources.begin(), fSources.end(),
+            [](const Source& a, const Source& b) {return a.ipoint < b.ipoint;});
+        size_t n_src = 0;
+        for (size_t i = 0; i < fSources.size(); i++) {
+          if (n_src > 0 && fSources[n_src-1].ipoint == fSources[i].ipoint) {
+            fSources[n_src-1].n_photons += fSources[i].n_photons;
+          }
+          else {
+            fSources[n_src++] = fSources[i];
+          }
+        }
+        fSources.resize(n_src);
+
+        std::fill(fSiPM.begin(), fSiPM.end(), 0.0f);
+        std::fill(fTile.begin(), fTile.end(), 0.0f);
+        for (const auto& src : fSources) {
+          if (fSiPM.empty() == false) {
+            accumulate(fLib.Get(vis_tree::kGroupSiPM, src.ipoint), src.n_photons, fSiPM);
+          }
+          if (fTile.empty() == false) {
+            accumulate(fLib.Get(vis_tree::kGroupTileTot, src.ipoint), src.n_photons, fTile);
+          }
+        }
+      }
+
+      // Poisson samples of the current expectations
+      void Sample() {
+        fSiPMCounts.resize(fSiPM.size());
+        fTileCounts.resize(fTile.size());
+        sample_poisson(fSiPM.data(), fSiPMCounts.data(), fSiPM.size(), fRng, fUniform);
+        sample_poisson(fTile.data(), fTileCounts.data(), fTile.size(), fRng, fUniform);
+      }
+
+      const std::vector<float>& GetSiPM() const {return fSiPM;}
+      const std::vector<float>& GetTile() const {return fTile;}
+      const std::vector<UInt_t>& GetSiPMCounts() const {return fSiPMCounts;}
+      const std::vector<UInt_t>& GetTileCounts() const {return fTileCounts;}
+
+      // Steps of the last batch inside the library, and distinct points
+      size_t GetNLocated() const {return fNLocated;}
+      size_t GetNSources() const {return fSources.size();}
+
+    private:
+      struct Source {
+        Long64_t ipoint;
+        float n_photons;
+      };
+
+      const vis_tree::VisLibrary& fLib;
+      LaneRng fRng;
+      std::vector<Source> fSources;
+      size_t fNLocated = 0;
+      std::vector<float> fSiPM;
+      std::vector<float> fTile;
+      std::vector<UInt_t> fSiPMCounts;
+      std::vector<UInt_t> fTileCounts;
+      std::vector<float> fUniform;
+
+      static void accumulate(const float* vis, const float& n_photons, std::vector<float>& pe) {
+        float* out = pe.data();
+        const size_t n = pe.size();
+        for (size_t c = 0; c < n; c++) out[c] += n_photons * vis[c];
+      }
+  };
+
+  /**
+   * Process the batches on n_threads workers, each with its own engine
+   * (seeded with seed + worker index), scheduling the batches dynamically.
+   * consume(ibatch, engine) is called by the worker right after processing
+   * (and sampling, if requested) each batch.
+   */
+  template <typename Consumer>
+  void process_batches(const vis_tree::VisLibrary& lib,
+      const std::vector<std::vector<EDepStep>>& batches,
+      const int& n_threads, const bool& sample, const uint64_t& seed, Consumer consume)
+  {
+    std::atomic<size_t> next_batch(0);
+    auto worker = [&](const int& iw) {
+      YieldEngine engine(lib, seed + iw);
+      size_t ib = 0;
+      while ( (ib = next_batch++) < batches.size() ) {
+        engine.Process(batches[ib].data(), batches[ib].size());
+        if (sample) engine.Sample();
+        consume(ib, engine);
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (int iw = 0; iw < std::max(1, n_threads); iw++) threads.emplace_back(worker, iw);
+    for (auto& t : threads) t.join();
+  }
+}
+
+#endif /* end of include guard VIS_YIELD_HH */